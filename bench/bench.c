@@ -0,0 +1,294 @@
+/*
+ * bench: measure what a Display() call costs.
+ *
+ *      $ make bench                  (from the repository root)
+ *      $ ./bench [-c calls] [-t max-threads] [-o results-file]
+ *
+ * Every case runs `calls` Display() calls (split evenly across threads) twice:
+ * once back to back, for throughput, and once with each call timed on its
+ * own, for the latency percentiles. Cases cover disabled and filtered calls,
+ * each output mode writing to /dev/null or to a file, formatting with
+ * vsnprintf() instead of the built-in engine, and 1 to `max-threads` threads
+ * contending for the same stream. Two more cases time only the formatting of
+ * the message into a buffer, by the built-in engine and by vsnprintf(), with
+ * no Display() call around it.
+ *
+ * Results are written as one JSON object per line, so runs can be compared
+ * with a script:
+ *
+ *      {"case":"sync-devnull","threads":1,"calls":200000,"ns_per_call":...,
+ *       "calls_per_sec":...,"p50_ns":...,"p99_ns":...,"p999_ns":...}
+ *
+ * The first line describes the run, including the cost of reading the clock,
+ * which is included in every latency sample.
+ */
+
+#include "Display.h"
+
+#include <stdint.h>
+
+#define DEFAULT_CALLS   200000
+#define DEFAULT_THREADS 64
+#define WARMUP_CALLS    1000
+
+#define FILE_OUTPUT     "bench_file.log"
+#define MAPPED_OUTPUT   "bench_mapped.log"
+
+// What a benchmark thread logs with.
+enum Call { CALL_DISPLAY, CALL_DEBUG, CALL_FORMAT };
+
+struct Case {
+    const char *name;
+    int         call;
+    int         threads;
+};
+
+struct Worker {
+    pthread_t          thread;
+    pthread_barrier_t *start;
+    int                call;
+    long               calls;
+    uint32_t          *samples;  // NULL for the throughput pass
+};
+
+static FILE *results;
+static volatile char formatted;  // keeps the format-only work from being dropped
+
+
+
+static long long nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// The library's message formatter on its own, with the arguments of a
+// Display() call.
+static void formatOnce(const char *format, ...)
+{
+    char    buffer[BUFFLEN];
+    va_list args;
+    va_start(args, format);
+    __DisplayVformat(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    formatted = buffer[0];
+}
+
+static void logOnce(int call, long i)
+{
+    if (call == CALL_FORMAT)
+        formatOnce("Benchmark message %ld: %d %s %.3f", i, 42, "text", 3.25);
+    else if (call == CALL_DEBUG)
+        DisplayDebug("Filtered message %ld: %d %s", i, 42, "text");
+    else
+        Display("Benchmark message %ld: %d %s %.3f", i, 42, "text", 3.25);
+}
+
+static void *workerMain(void *arg)
+{
+    struct Worker *worker = arg;
+    pthread_barrier_wait(worker->start);
+
+    if (worker->samples == NULL)
+    {
+        for (long i = 0; i < worker->calls; i++)
+            logOnce(worker->call, i);
+    }
+    else
+    {
+        for (long i = 0; i < worker->calls; i++)
+        {
+            long long before = nowNs();
+            logOnce(worker->call, i);
+            long long elapsed = nowNs() - before;
+            worker->samples[i] = (elapsed > UINT32_MAX) ? UINT32_MAX :
+                (uint32_t)elapsed;
+        }
+    }
+    return NULL;
+}
+
+// Run `calls` calls across `threads` threads. Returns the wall-clock time in
+// ns, from the moment all threads are released until everything is written.
+static long long runPass(int call, int threads, long calls, uint32_t *samples)
+{
+    struct Worker     *workers = calloc(threads, sizeof(*workers));
+    pthread_barrier_t  start;
+    pthread_barrier_init(&start, NULL, threads + 1);
+
+    for (int t = 0; t < threads; t++)
+    {
+        workers[t].start   = &start;
+        workers[t].call    = call;
+        workers[t].calls   = calls / threads;
+        workers[t].samples = (samples != NULL) ?
+            samples + t * (calls / threads) : NULL;
+        pthread_create(&workers[t].thread, NULL, workerMain, &workers[t]);
+    }
+
+    pthread_barrier_wait(&start);
+    long long begin = nowNs();
+    for (int t = 0; t < threads; t++)
+        pthread_join(workers[t].thread, NULL);
+    DisplayFlush();  // asynchronous mode: count the writer's work too
+    long long elapsed = nowNs() - begin;
+
+    pthread_barrier_destroy(&start);
+    free(workers);
+    return elapsed;
+}
+
+
+static int compareSamples(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const uint32_t *sorted, long count, double p)
+{
+    long index = (long)(p * (count - 1) + 0.5);
+    return sorted[index];
+}
+
+static void runCase(const struct Case *c, long calls)
+{
+    calls -= calls % c->threads;
+    uint32_t *samples = malloc(calls * sizeof(*samples));
+    if (samples == NULL)
+    {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+
+    runPass(c->call, 1, WARMUP_CALLS, NULL);
+    long long elapsed = runPass(c->call, c->threads, calls, NULL);
+    runPass(c->call, c->threads, calls, samples);
+    qsort(samples, calls, sizeof(*samples), compareSamples);
+
+    fprintf(results, "{\"case\":\"%s\",\"threads\":%d,\"calls\":%ld,"
+        "\"ns_per_call\":%.1f,\"calls_per_sec\":%.0f,"
+        "\"p50_ns\":%u,\"p99_ns\":%u,\"p999_ns\":%u}\n",
+        c->name, c->threads, calls, (double)elapsed / calls,
+        calls * 1e9 / elapsed, percentile(samples, calls, 0.50),
+        percentile(samples, calls, 0.99), percentile(samples, calls, 0.999));
+    fflush(results);
+    free(samples);
+}
+
+// Run one case for 1, 2, 4, ... `maxThreads` threads.
+static void runScaling(const char *name, int maxThreads, long calls)
+{
+    for (int threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        struct Case c = { name, CALL_DISPLAY, threads };
+        runCase(&c, calls);
+    }
+}
+
+
+
+static double clockOverhead()
+{
+    const int rounds = 100000;
+    long long begin = nowNs();
+    for (int i = 0; i < rounds; i++) nowNs();
+    return (double)(nowNs() - begin) / rounds;
+}
+
+int main(int argc, char *argv[])
+{
+    long calls      = DEFAULT_CALLS;
+    int  maxThreads = DEFAULT_THREADS;
+    int  opt;
+    results = stdout;
+    while ((opt = getopt(argc, argv, "c:t:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c': calls = atol(optarg); break;
+            case 't': maxThreads = atoi(optarg); break;
+            case 'o':
+                if ((results = fopen(optarg, "w")) == NULL)
+                {
+                    perror(optarg);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-c calls] [-t max-threads] "
+                    "[-o results-file]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (calls < 1 || maxThreads < 1)
+    {
+        fprintf(stderr, "bench: calls and threads must be positive\n");
+        return 2;
+    }
+
+    // InitializeDisplay() reorders argv, so parse our own options first.
+    InitializeDisplay(argc, argv);
+
+    // Messages go to /dev/null unless a case says otherwise, without color so
+    // every case formats the same bytes.
+    FILE *devnull = fopen("/dev/null", "w");
+    SetStream(STANDARD, devnull);
+    SetColorfulness(DISABLE);
+
+    fprintf(results, "{\"run\":\"display-bench\",\"calls\":%ld,"
+        "\"max_threads\":%d,\"clock_ns\":%.1f}\n",
+        calls, maxThreads, clockOverhead());
+
+    // Calls that print nothing.
+    SetVerbose(DISABLE);
+    runCase(&(struct Case){ "disabled", CALL_DISPLAY, 1 }, calls);
+    SetVerbose(ENABLE);
+    runCase(&(struct Case){ "filtered", CALL_DEBUG, 1 }, calls);
+
+    // Single-threaded output, one case per mode. Plain text to /dev/null is
+    // the one-thread row of the contention runs below.
+    FILE *out = fopen(FILE_OUTPUT, "w");
+    SetStream(STANDARD, out);
+    runCase(&(struct Case){ "sync-file", CALL_DISPLAY, 1 }, calls);
+    SetStream(STANDARD, devnull);
+    fclose(out);
+    remove(FILE_OUTPUT);
+
+    struct DisplayMappedFile *mapped = OpenMappedFile(MAPPED_OUTPUT, 0);
+    SetMappedStream(STANDARD, mapped);
+    runCase(&(struct Case){ "mapped-file", CALL_DISPLAY, 1 }, calls);
+    CloseMappedFile(mapped);
+    remove(MAPPED_OUTPUT);
+
+    SetBinaryStream(devnull);
+    runCase(&(struct Case){ "binary-devnull", CALL_DISPLAY, 1 }, calls);
+    SetBinaryStream(NULL);
+
+    // The same message formatted by glibc, against sync-devnull below.
+    SetFastFormat(DISABLE);
+    runCase(&(struct Case){ "vsnprintf-devnull", CALL_DISPLAY, 1 }, calls);
+    SetFastFormat(ENABLE);
+
+    // Only the formatting of that message, the margin of the built-in engine
+    // over vsnprintf().
+    runCase(&(struct Case){ "format-fast", CALL_FORMAT, 1 }, calls);
+    SetFastFormat(DISABLE);
+    runCase(&(struct Case){ "format-vsnprintf", CALL_FORMAT, 1 }, calls);
+    SetFastFormat(ENABLE);
+
+    // Contention: every thread writes to the same stream, through the console
+    // lock in synchronous mode and through per-thread queues in asynchronous
+    // mode.
+    runScaling("sync-devnull", maxThreads, calls);
+    SetAsync(ENABLE);
+    runScaling("async-devnull", maxThreads, calls);
+    SetAsync(DISABLE);
+
+    SetStream(STANDARD, stdout);
+    fclose(devnull);
+    if (results != stdout) fclose(results);
+    CloseDisplay();
+    return 0;
+}
@@ -3,6 +3,7 @@
 int main(int argc, char *argv[])
 {
     InitializeDisplay(argc, argv);
+    SetStats(ENABLE);  // count messages and bytes, see DisplayPrintStats()
 
     // This will only print if verbosity is enabled (-v flag).
     Display("This is a number! %d", 5);
@@ -16,6 +17,56 @@ int main(int argc, char *argv[])
     DisplayWarning("This is a warning!");
     DisplayWarning("Numbers: %d, %d, %d", 1, 2, 3);
 
+    // Severity levels. Debug and trace messages are silent until the display
+    // level is lowered, either globally or for a single source file.
+    DisplayInfo("This is an informational message.");
+    DisplayDebug("You will not see this debug message.");
+    SetFileDisplayLevel("demo.c", LEVEL_TRACE);
+    DisplayDebug("Debug messages from demo.c are now enabled.");
+
+    // Single call sites can be switched off (or on) by file, line or function
+    // while the process runs; see also SetSiteControlFile().
+    char site[32];
+    snprintf(site, sizeof(site), "demo.c:%d", __LINE__ + 2);  // the next call
+    SetSiteState(site, SITE_DISABLED);
+    DisplayDebug("You will not see this one either.");
+
+    // Typed key-value fields. SetOutputFormat(JSON) or SetOutputFormat(LOGFMT)
+    // prints every message as structured fields instead.
+    DisplayKV("Request done", KV_STR("path", "/index.html"), KV_INT("status", 200),
+        KV_FLOAT("ms", 1.25));
+    SetOutputFormat(JSON);
+    DisplayKV("Request done", KV_STR("path", "/index.html"), KV_INT("status", 200),
+        KV_FLOAT("ms", 1.25));
+    SetOutputFormat(TEXT);
+
+    // Identical messages within a second are counted, then summarized.
+    SetCoalesceWindow(1000);
+    for (int i = 0; i < 5; i++)
+        DisplayWarning("Connection to %s refused.", "backend");
+    SetCoalesceWindow(0);
+
+    // Silenced messages are kept in memory and printed before the next error.
+    SetHistorySize(256);
+    SetVerbose(DISABLE);
+    for (int i = 1; i <= 3; i++)
+        Display("Retrying %s (attempt %d of %d).", "backend", i, 3);
+    SetVerbose(ENABLE);
+    DisplayError("Giving up on %s.", "backend");
+    SetHistorySize(0);
+
+    // Dump a buffer in one message, laid out like `hexdump -C`.
+    const char packet[] = "GET / HTTP/1.1\r\nHost: example\r\n";
+    DisplayHexDump(packet, sizeof(packet), "Request (%s)", "example");
+
+    // Formatted without vsnprintf(), byte for byte what glibc would print;
+    // SetFastFormat(DISABLE) goes back to vsnprintf().
+    Display("[%-6s|%+08.3f|%#x|%.3e|%g]", "fast", 3.14159, 255, 6.02e23, 0.5);
+
+    // Safe to call from a signal handler. SetCrashHandler(ENABLE) would also
+    // write out buffered lines if this process crashed.
+    DisplayEmergency("Emergency messages take no lock (%d allocations).", 0);
+
     // This will print in a custom color (obeying verbosity). Notice how we can
     // combine difference ANSI color / format codes together. The C 
     // preprocessor concatenates the strings automatically for us!
@@ -39,6 +90,11 @@ int main(int argc, char *argv[])
 
     SetShowTrace(ENABLE);
 
+    // Lay the header out differently, with the source line of each call.
+    SetDisplayPattern("%T [%L] %F:%l %f: ");
+    Display("Printed with a custom header.");
+    SetDisplayPattern(NULL);
+
     FILE *fd = fopen("testOutput.txt","w");
     SetStream(STANDARD, fd);
     Display("Hello, text file!");
@@ -46,9 +102,27 @@ int main(int argc, char *argv[])
     SetStream(STANDARD, stdout);
     Display("Wrote to output text file, `testOutput.txt`.");
 
+    // Batch standard output: lines go out together, once enough are pending,
+    // after 50 ms or when a warning or error is printed.
+    SetStreamBuffering(STANDARD, BATCHED, 0, 0);
+    Display("Batched line one.");
+    Display("Batched line two.");
+    SetStreamBuffering(STANDARD, STDIO_BUFFERED, 0, 0);
+
     DisplayFile(fd, "Another line in the same open %s!", "file");
     fclose(fd);
 
+    // Time a block without printing anything; CloseDisplay() prints a table.
+    for (int i = 0; i < 100; i++)
+    {
+        DisplayTimeScope("demo loop");
+        fd = fopen("/dev/null", "w");
+        fclose(fd);
+    }
+
+    // Totals since SetStats(ENABLE), on one line.
+    DisplayPrintStats(stdout);
+
     CloseDisplay();
     return 0;
 }
@@ -0,0 +1,20 @@
+#include "Display.hpp"
+
+#include <string>
+
+int main(int argc, char *argv[])
+{
+    InitializeDisplay(argc, argv);
+
+    // Same macros as in C, with the format checked at compile time.
+    std::string user = "Ben";
+    long        bytes = 1L << 20;
+    Display("Hello, %s! You have %d bytes left.", user, bytes);
+    DisplayWarning("Disk %.1f%% full.", 93.25);
+
+    // Would not compile: %d needs an integer.
+    // Display("Hello, %d!", user);
+
+    CloseDisplay();
+    return 0;
+}
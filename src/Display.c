@@ -1,14 +1,36 @@
-#include "Display.h"
+#include "DisplayPrivate.h"
+
+#include <stdint.h>
 
 static void dprint(FILE *stream, char *format, ...);
+static void displayv(struct DisplaySite *site, const char *function, int level,
+    int type, FILE *fd, const char *color, const struct DisplayField *fields,
+    int fieldCount, const struct DisplayBytes *dump, const char *format,
+    va_list args);
+static void displayf(struct DisplaySite *site, const char *function, int level,
+    int type, FILE *fd, const char *color, const struct DisplayField *fields,
+    int fieldCount, const struct DisplayBytes *dump, const char *format, ...);
+static void buildRecord(struct DisplayRecord *record, struct SinkLine *line,
+    const struct DisplaySite *site, const char *function, int level, int type,
+    const char *color,
+    const struct DisplayField *fields, int fieldCount,
+    const struct DisplayBytes *dump, const char *format, va_list args,
+    unsigned long suppressed);
+
+// Output locks. Each stream hashes to one of these, so writes to different
+// streams (stdout and stderr, or unrelated DisplayFile() files) run in
+// parallel. Matlab's mexPrintf is not thread-safe, so it gets a single lock.
+#ifdef MATLAB
+#define LOCK_STRIPES 1
+#else
+#define LOCK_STRIPES 32
+#endif
 
 // Variables
-pthread_mutex_t consoleLock;    // lock to avoid interleaving prints
-va_list         args;           // variable argument function inputs
-char            timestamp[32];  // store current time
-time_t          rawtime;        // store raw time
-struct tm      *timeinfo;       // store timeinfo struct
-int             isLocked;       // is print mutex already locked (by user)?
+static pthread_mutex_t streamLocks[LOCK_STRIPES] = {
+    [0 ... LOCK_STRIPES - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+static __thread int    lockDepth;  // DisplayLock() calls not yet undone
 
 // Default values
 int   verbose      = ENABLE;   // Function verbosity
@@ -24,6 +46,7 @@ int matlabMexPrintf = ENABLE;  // Display prints to terminal and Matlab console
 // Default stream array. Elements correspond to order of PrintType enum:
 //    { STANDARD, WARNING, ERROR }
 FILE *streams[3];
+FILE *stream;
 
 // Check if user is redirecting output to a text file.
 int stdoutToFile = 0;
@@ -108,6 +131,11 @@ int SetShowTrace(int s)
 // Set stream (file descriptor) for output.
 int SetStream(int streamType, FILE *newStream)
 {
+    // Queued asynchronous records and batched bytes still belong to the old
+    // stream; write them out before the caller gets a chance to close it.
+    if (asyncMode) DisplayFlush();
+    else           buffersFlush();
+
     if (streamType >= STANDARD && streamType <= ERROR)
         streams[streamType] = newStream;
     else
@@ -144,26 +172,42 @@ int SetMatlabMexPrintf(int m)
 #endif
 
 
-// Block until we can lock the Display mutex.
+// Block until the calling thread has every output lock. Calls nest: only the
+// outermost DisplayLock() locks and the matching DisplayUnlock() unlocks.
+// In asynchronous mode this thread's queued records are written out first;
+// inside the lock it writes synchronously, and the writer thread waits.
 int DisplayLock()
 {
-    if (!isLocked) pthread_mutex_lock(&consoleLock);
-    isLocked = 1;
+    if (lockDepth == 0)
+    {
+        asyncFlush();
+        for (int i = 0; i < LOCK_STRIPES; i++)
+            pthread_mutex_lock(&streamLocks[i]);
+    }
+    lockDepth++;
     return 0;
 }
 
-// Unlock the Display mutex.
+// True if the calling thread is inside DisplayLock().
+int displayLocked()
+{
+    return lockDepth > 0;
+}
+
+// Undo one DisplayLock() of the calling thread.
 int DisplayUnlock()
 {
-    if (isLocked) pthread_mutex_unlock(&consoleLock);
-    isLocked = 0;
+    if (lockDepth == 0) return -1;  // not held by this thread
+    if (--lockDepth == 0)
+        for (int i = LOCK_STRIPES - 1; i >= 0; i--)
+            pthread_mutex_unlock(&streamLocks[i]);
     return 0;
 }
 
 
 
 // InitializeDisplay sets the calling file's name.
-int __InitializeDisplay(char *filename, int argc, char *argv[])
+int __InitializeDisplay(const char *filename, int argc, char *argv[])
 {
     // Check to see if the user is redirecting output ('>' symbol in bash). If
     // so, disable colorfulness so that the escape characters don't get in the
@@ -208,79 +252,336 @@ int __InitializeDisplay(char *filename, int argc, char *argv[])
     }
     
     // Get just the filename from full filepath.
-    snprintf(file, sizeof(file)-1, "%s", basename(filename));
+    const char *name = strrchr(filename, '/');
+    snprintf(file, sizeof(file)-1, "%s", (name != NULL) ? name + 1 : filename);
     return 0;
 }
 
 // Clean up Display, free memory, etc.
 int CloseDisplay() { 
-    pthread_mutex_destroy(&consoleLock);
+    controlStop();
+    coalesceStop();
+    statsDumpStop();
+    asyncStop();
+    buffersStop();
+    DisplayFlush();
+    if (verbose && streams[STANDARD] != NULL)
+        DisplayPrintTimers(streams[STANDARD]);
     return 0; 
 }
 
 
 
 // Don't call this function. Use the Display(format, ...) macro instead!
+void __DisplayAt(struct DisplaySite *site, int type, FILE *fd,
+    const char *color, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    // First call from this site: find its file's threshold, which the macro
+    // could not check yet. DisplayFile() is not subject to display levels.
+    if (type != CUSTOM &&
+        __atomic_load_n(&site->threshold, __ATOMIC_RELAXED) ==
+            &__displayUnresolved &&
+        !levelResolve(site))
+    {
+        if (historyOn()) historyRemember(site, format, args);
+    }
+    else
+        displayv(site, site->function, site->level, type, fd, color, NULL, 0,
+            NULL, format, args);
+    va_end(args);
+}
+
+// Don't call this function. Use the DisplayKV(message, ...) macro instead!
+void __DisplayFields(struct DisplaySite *site, int type, const char *color,
+    const char *message, const struct DisplayField *fields, int count)
+{
+    if (__atomic_load_n(&site->threshold, __ATOMIC_RELAXED) ==
+            &__displayUnresolved && !levelResolve(site))
+        return;
+    displayf(site, site->function, site->level, type, NULL, color, fields,
+        count, NULL, "%s", message);
+}
+
+// Don't call this function. Use the DisplayHex(buffer, length) macro instead!
+void __DisplayHex(struct DisplaySite *site, int type, const char *color,
+    const void *buffer, size_t length, const char *format, ...)
+{
+    if (__atomic_load_n(&site->threshold, __ATOMIC_RELAXED) ==
+            &__displayUnresolved && !levelResolve(site))
+        return;
+
+    struct DisplayBytes dump = { buffer, length };
+    if (format == NULL)
+    {
+        displayf(site, site->function, site->level, type, NULL, color, NULL,
+            0, &dump, "%zu bytes", length);
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    displayv(site, site->function, site->level, type, NULL, color, NULL, 0,
+        &dump, format, args);
+    va_end(args);
+}
+
+// Entry point of the original macros, which did not pass a call site.
 void __Display(const char *function, int type, FILE *fd, char *color, \
     char *format, ...)
 {
+    va_list args;
+    va_start(args, format);
+    displayv(NULL, function, levelOfType(type), type, fd, color, NULL, 0,
+        NULL, format, args);
+    va_end(args);
+}
 
-    // Lock debug printing to console so threads don't interleave. We only need
-    // to do this if `isLocked` is 0. If it's 1, that means the user has chosen
-    // to acquire the necessary mutex, so things are in their hands now...
-    if (!isLocked) pthread_mutex_lock(&consoleLock);
+// Common implementation of __DisplayAt(), __DisplayFields(), __DisplayHex()
+// and __Display(). `site`, `fields` and `dump` may be NULL.
+static void displayv(struct DisplaySite *site, const char *function, int level,
+    int type, FILE *fd, const char *color, const struct DisplayField *fields,
+    int fieldCount, const struct DisplayBytes *dump, const char *format,
+    va_list args)
+{
+    char                 storage[RECORD_SIZE];
+    struct DisplayRecord record;
+    recordInit(&record, storage, sizeof(storage));
 
-    // Check if user is redirecting output to a text file.
-    int old_colorfulness = GetColorfulness();
-    if ( (stdoutToFile && (type == STANDARD)) || \
-         (stderrToFile && ((type == WARNING) || (type == ERROR))) )
-        SetColorfulness(DISABLE);
+    // What was recorded while silent comes before the error.
+    if (level == LEVEL_ERROR && type != CUSTOM && historyOn()) historyDump();
 
-    // Get a pointer to our stream file descriptor.
-    FILE *stream;
-    if (type == CUSTOM)
-        stream = fd;  // user-specified stream file descriptor
+    // Binary mode defers formatting to the display-decode tool. Fields and
+    // dumps are not deferred: they are stored as text, after the message.
+    if (type != CUSTOM && binaryStream != NULL)
+    {
+        if (fieldCount == 0 && dump == NULL)
+        {
+            binaryWrite(site, function, level, format, args);
+            if (statsOn()) statsMessage(level, -1, 0);  // not text: no bytes
+        }
+        else
+        {
+            // Written as text in one record, not through a second record,
+            // which could not grow while this one holds the arena.
+            size_t lengthAt = binaryTextStart(&record, site, function, level,
+                format);
+            size_t start    = record.length;
+            recordVappendf(&record, recordLimit(), format, args);
+            fieldsAppend(&record, fields, fieldCount);
+            if (dump != NULL) hexAppend(&record, dump->data, dump->length);
+            binaryTextSubmit(&record, lengthAt, start);
+            if (statsOn()) statsMessage(level, -1, 0);
+            recordDone(&record);
+        }
+        return;
+    }
+
+    // Assemble the whole line before taking any lock, so the lock is only
+    // held for a single write.
+    unsigned long suppressed = (site != NULL) ?
+        __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED) : 0;
+    struct SinkLine line;
+    if (structuredFormat() == TEXT)
+        buildRecord(&record, &line, site, function, level, type, color,
+            fields, fieldCount, dump, format, args, suppressed);
     else
-        stream = GetStream(type);
+    {
+        // A dump becomes a field of plain hex digits.
+        line.bodyStart = structuredRecord(&record, function, level, format,
+            args, fields, fieldCount, dump, suppressed);
+        line.color        = NULL;  // never colored
+        line.colored      = DISABLE;
+        line.contentStart = 0;
+    }
+
+    // A repeat of the last message on this stream is only counted.
+    if (type != CUSTOM && site != NULL && coalesceOn() &&
+        coalesceRepeat(type, site, function, level, color, format,
+            record.data + line.bodyStart, record.length - line.bodyStart))
+    {
+        if (statsOn()) statsSuppressed(1);
+        recordDone(&record);
+        return;
+    }
+
+    displayWrite(type, fd, level, record.data, record.length);
+
+    // Then every additional output, from the same buffer.
+    if (type != CUSTOM)
+    {
+        line.data   = record.data;
+        line.length = record.length;
+        sinksWrite(&line, level);
+    }
+    if (statsOn())
+    {
+        statsMessage(level, type, record.length);
+        if (suppressed > 0) statsSuppressed(suppressed);
+    }
+    recordDone(&record);
+}
 
-    // Populate va_list with args from '...' parameter
+static void displayf(struct DisplaySite *site, const char *function, int level,
+    int type, FILE *fd, const char *color, const struct DisplayField *fields,
+    int fieldCount, const struct DisplayBytes *dump, const char *format, ...)
+{
+    va_list args;
     va_start(args, format);
+    displayv(site, function, level, type, fd, color, fields, fieldCount, dump,
+        format, args);
+    va_end(args);
+}
 
-    // Get current system timestamp
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
-    strftime(timestamp, sizeof(timestamp), "%T", timeinfo);
+// Summary of messages counted by coalescing. No call site, so it is never
+// coalesced itself.
+void displayRepeats(int type, const char *function, int level,
+    const char *color, unsigned long count)
+{
+    displayf(NULL, function, level, type, NULL, color, NULL, 0, NULL,
+        "last message repeated %lu times", count);
+}
 
-    // Print message header to console and add a space at after it.
-    if (showTrace)
+
+
+// Write a finished record to where PrintType `type` goes, or to `fd` for
+// CUSTOM. DisplayFile() stays synchronous even in asynchronous mode, because
+// its caller owns the file and may close it as soon as we return. Memory-
+// mapped and rotating files, and streams with a buffering policy, need
+// neither the lock nor the writer thread.
+void displayWrite(int type, FILE *fd, int level, const char *buffer,
+    size_t length)
+{
+    struct DisplayMappedFile *mapped;
+    if (type == CUSTOM)
+        dlockedWrite(fd, buffer, length);
+    else if ((mapped = GetMappedStream(type)) != NULL)
+        mappedWrite(mapped, buffer, length);
+    else if (rotatingStreamWrite(type, buffer, length))
+        return;
+    else if (GetStreamBuffering(type) != STDIO_BUFFERED)
+        bufferWrite(type, buffer, length, level >= LEVEL_WARNING);
+    else
+        dsubmit(GetStream(type), buffer, length);
+}
+
+// Hand a finished record to the writer thread in asynchronous mode, or write
+// it now.
+void dsubmit(FILE *stream, const char *buffer, size_t length)
+{
+    if (__atomic_load_n(&asyncMode, __ATOMIC_ACQUIRE) && lockDepth == 0)
+        asyncPush(stream, buffer, length);
+    else
+        dlockedWrite(stream, buffer, length);
+}
+
+// Write a finished record while holding the lock of its stream.
+void dlockedWrite(FILE *stream, const char *buffer, size_t length)
+{
+    // Lock the stream so threads don't interleave. A thread inside
+    // DisplayLock() already holds every lock, so things are in its hands now...
+    if (lockDepth > 0)
     {
-        if (colorfulness)
-            dprint(stream, "%s[%s][%s][%s]", color, timestamp, file, function);
-        else
-            dprint(stream, "[%s][%s][%s]", timestamp, file, function);
+        dwrite(stream, buffer, length);
+        return;
     }
 
-    if      (type == ERROR)   dprint(stream, "[ERROR] ");
-    else if (type == WARNING) dprint(stream, "[WARNING] ");
-    else if (showTrace)       dprint(stream, " ");
+    // Streams are at least 16-byte aligned objects; mix in higher bits so
+    // neighbours such as stdout and stderr land on different locks.
+    uintptr_t key = (uintptr_t)stream >> 4;
+    pthread_mutex_t *lock = &streamLocks[(key ^ (key >> 5) ^ (key >> 10)) %
+        LOCK_STRIPES];
+    if (!statsOn())
+        pthread_mutex_lock(lock);
+    else if (pthread_mutex_trylock(lock) != 0)
+    {
+        // Only a contended lock is timed.
+        long long start = statsClock();
+        pthread_mutex_lock(lock);
+        statsLockWait(statsClock() - start);
+    }
+    dwrite(stream, buffer, length);
+    pthread_mutex_unlock(lock);
+}
+
 
-    // Print variable argument message body to console
-    char tmpBuffer[BUFFLEN];
-    vsnprintf(tmpBuffer, BUFFLEN-1, format, args);
-    va_end(args);
-    dprint(stream, tmpBuffer);
+
+// Format a complete message into `record`: trace header, message body, rate
+// limiting note, hex dump, color reset and newline. Uses only locals, so it
+// is safe to call without holding the console lock. `line` receives where the
+// color codes are, for sinks that want the other form.
+static void buildRecord(struct DisplayRecord *record, struct SinkLine *line,
+    const struct DisplaySite *site, const char *function, int level, int type,
+    const char *color,
+    const struct DisplayField *fields, int fieldCount,
+    const struct DisplayBytes *dump, const char *format, va_list args,
+    unsigned long suppressed)
+{
+    // Check if user is redirecting output to a text file.
+    int useColor = colorfulness;
+    if ( (stdoutToFile && (type == STANDARD)) || \
+         (stderrToFile && ((type == WARNING) || (type == ERROR))) || \
+         (type != CUSTOM && GetMappedStream(type) != NULL) || \
+         (type != CUSTOM && GetRotatingStream(type) != NULL) )
+        useColor = DISABLE;
+
+    line->color        = color;
+    line->colored      = useColor;
+    line->trace        = showTrace;
+    line->contentStart = 0;
+
+    // Message header, laid out by SetDisplayPattern(). Without it, only the
+    // level tag is kept.
+    if (showTrace)
+    {
+        if (useColor) recordAppendString(record, color);
+        line->contentStart = record->length;
+        patternAppend(record, site, function, level);
+    }
+    else
+    {
+        const char *tag = levelTag(level);
+        if (tag != NULL) recordAppendString(record, tag);
+    }
+
+    // Variable argument message body, up to SetMaxMessageLength().
+    line->bodyStart = record->length;
+    recordVappendf(record, recordLimit(), format, args);
+    fieldsAppend(record, fields, fieldCount);
+    if (suppressed > 0)
+        recordAppendf(record, " (%lu suppressed)", suppressed);
+    if (dump != NULL)
+        hexAppend(record, dump->data, dump->length);
 
     // If colorfulness is enabled, reset the color after printing.
-    if (colorfulness)
-        dprint(stream, RESET);  // Reset ANSI color (RESET)
-    
-    if (autoNewline) dprint(stream, "\n");
+    line->contentEnd = record->length;
+    if (useColor)    recordAppendString(record, RESET);
+    if (autoNewline) recordAppendString(record, "\n");
+}
 
-    SetColorfulness(old_colorfulness);
 
-    if (!isLocked) pthread_mutex_unlock(&consoleLock);
 
-    return;
+// Write an already formatted buffer to `stream` in a single call, so a line
+// is never split across several stdio operations.
+void dwrite(FILE *stream, const char *buffer, size_t length)
+{
+    long long start = statsOn() ? statsClock() : 0;
+
+    // See the NOFPRINTF note in dprint().
+    #ifdef NOFPRINTF
+        printf("%.*s", (int)length, buffer);
+    #else
+        fwrite(buffer, 1, length, stream);
+    #endif
+
+    #ifdef MATLAB
+    if (stream == stdout || stream == stderr)
+        if (matlabMexPrintf)
+            mexPrintf("%.*s", (int)length, buffer);
+    #endif
+
+    if (start != 0) statsWrite(statsClock() - start);
 }
 
 
@@ -291,12 +592,14 @@ void __Display(const char *function, int type, FILE *fd, char *color, \
 // Matlab command window when running the GUI.
 static void dprint(FILE *stream, char *format, ...)
 {
-    char    messageBuffer[BUFFLEN];
-    va_list args;
+    char                 storage[BUFFLEN];
+    struct DisplayRecord record;
+    va_list              args;
 
     // Insert args into format string and buffer it.
+    recordInit(&record, storage, sizeof(storage));
     va_start(args, format);
-    vsnprintf(messageBuffer, BUFFLEN-1, format, args);
+    recordVappendf(&record, recordLimit(), format, args);
     va_end(args);
 
     // NOTE:    When building with SWIG for Python, the file descriptors in 
@@ -304,19 +607,8 @@ static void dprint(FILE *stream, char *format, ...)
     //          you must replaced fprintf with just printf (no file descriptor)
     //          and to do this, you must include the -DNOFPRINTF compiler flag
     //          when building. This will produce a segmentation fault 
-    //          (segfault) otherwise.
-    #ifdef NOFPRINTF
-        printf("%s", messageBuffer);
-    #else
-        fprintf(stream, "%s", messageBuffer);
-    #endif
-
-    // Print to terminal and Matlab command window (if required).
-    #ifdef MATLAB
-    if (stream == stdout || stream == stderr)
-        if (matlabMexPrintf)
-            mexPrintf(messageBuffer);
-    #endif
-
-    return;
+    //          (segfault) otherwise. dwrite() also prints to the Matlab
+    //          command window (if required).
+    dwrite(stream, record.data, record.length);
+    recordDone(&record);
 }
\ No newline at end of file
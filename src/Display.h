@@ -25,6 +25,9 @@
  *      }
  *      @endcode
  *
+ * C++ programs should include Display.hpp instead, which checks format strings
+ * and argument types at compile time.
+ *
  *
  *
  * By default, processes that use Display will boot with verbosity enabled. To 
@@ -91,6 +94,10 @@
 #include "mex.h"
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define BUFFLEN 256  ///< Buffer length for strings being printed.
 
 
@@ -122,6 +129,25 @@ enum Verbosity {
     ENABLE    ///< Enable verbosity.
 };
 
+/* Message severities, lowest first. These are macros rather than an enum so
+ * that DISPLAY_MIN_LEVEL can be compared by the preprocessor. */
+#define LEVEL_TRACE     0  ///< DisplayTrace(): fine-grained tracing.
+#define LEVEL_DEBUG     1  ///< DisplayDebug(): debugging information.
+#define LEVEL_INFO      2  ///< DisplayInfo(): informational messages.
+#define LEVEL_STANDARD  3  ///< Display() and DisplayColor().
+#define LEVEL_WARNING   4  ///< DisplayWarning().
+#define LEVEL_ERROR     5  ///< DisplayError().
+
+/**
+ * Lowest severity compiled into the program. Calls to Display macros below it
+ * are removed entirely, arguments included. Defaults to LEVEL_TRACE (keep
+ * everything); for example, compile with `-DDISPLAY_MIN_LEVEL=LEVEL_INFO` to
+ * drop DisplayTrace() and DisplayDebug() from a release build.
+ */
+#ifndef DISPLAY_MIN_LEVEL
+#define DISPLAY_MIN_LEVEL LEVEL_TRACE
+#endif
+
 /** Enumerated output types for determining what user is printing. */
 enum PrintType {
     STANDARD,  ///< Standard print, obeys defined verbosity.
@@ -133,13 +159,149 @@ enum PrintType {
     CUSTOM
 };
 
+/** Sub-second precision of the trace timestamp. */
+enum TimestampPrecision {
+    SECONDS,       ///< `12:00:00` (default).
+    MILLISECONDS,  ///< `12:00:00.123`
+    MICROSECONDS,  ///< `12:00:00.123456`
+    NANOSECONDS    ///< `12:00:00.123456789`
+};
+
+/** Clock source for the trace timestamp. */
+enum TimestampClock {
+    REALTIME,   ///< System wall clock (default).
+    MONOTONIC,  ///< Monotonic clock anchored to the wall clock when selected.
+    TSC         ///< Calibrated CPU time stamp counter (x86 only).
+};
 
+/** What a thread does when its asynchronous ring buffer is full. */
+enum Backpressure {
+    BLOCK,        ///< Wait for the writer thread to make room (default).
+    DROP_NEWEST,  ///< Discard the record being logged.
+    DROP_OLDEST   ///< Discard the oldest queued record to make room.
+};
+
+
+/** How a PrintType's stream is buffered (see `SetStreamBuffering()`). */
+enum BufferPolicy {
+    STDIO_BUFFERED,  ///< Whatever the FILE's own buffering does (default).
+    UNBUFFERED,      ///< Every record is written at once.
+    LINE_BUFFERED,   ///< Written whenever a record ends a line.
+    BATCHED          ///< Written by size, age or severity.
+};
+
+/** Layout of each printed line (see `SetOutputFormat()`). */
+enum OutputFormat {
+    TEXT,   ///< `[12:00:00][file][function] message` (default).
+    JSON,   ///< One JSON object per line.
+    LOGFMT  ///< One line of `key=value` pairs.
+};
+
+/** Type of a `DisplayKV()` field. */
+enum FieldType {
+    FIELD_INT,     ///< Signed integer, see KV_INT().
+    FIELD_FLOAT,   ///< Double, see KV_FLOAT().
+    FIELD_STRING,  ///< NUL-terminated string, see KV_STR().
+    FIELD_BOOL     ///< true or false, see KV_BOOL().
+};
+
+/** Runtime state of a call site (see `SetSiteState()`). */
+enum SiteState {
+    SITE_DISABLED,  ///< Never printed.
+    SITE_ENABLED,   ///< Printed whatever the display level.
+    SITE_DEFAULT    ///< Printed according to the display level (default).
+};
+
+/**
+ * Thread information shown in the trace header (see `SetShowThread()`). The
+ * values can be combined with `|`.
+ */
+enum ThreadField {
+    THREAD_ID   = 1,  ///< Kernel thread id: `[4242]`.
+    THREAD_NAME = 2   ///< Name from `DisplaySetThreadName()`: `[worker]`.
+};
+
+
+
+/**
+ * Set the display level: messages with a lower severity are not printed. This
+ * applies to every source file without a level of its own (see
+ * `SetFileDisplayLevel()`). The default is LEVEL_INFO, so DisplayTrace() and
+ * DisplayDebug() are silent until enabled. LEVEL_ERROR + 1 silences all
+ * Display macros, errors included. Verbosity still applies on top of this.
+ */
+int SetDisplayLevel(int level);
+/** Get the default display level. */
+int GetDisplayLevel();
+
+/**
+ * Set the display level of a single source file, given by name or path (only
+ * the basename is compared, e.g. "network.c"). Can be changed at any time;
+ * call sites in that file pick up the change with their next call.
+ *
+ *      @code
+ *      SetFileDisplayLevel("network.c", LEVEL_TRACE);
+ *      @endcode
+ */
+int SetFileDisplayLevel(const char *name, int level);
+/** Get the display level of a single source file. */
+int GetFileDisplayLevel(const char *name);
+
+/**
+ * Enable or disable individual call sites in a running process. Every Display
+ * macro records its file, function, line and format in a static descriptor, so
+ * the library knows every call site, including those that have not run yet.
+ *
+ * `pattern` is a shell glob matched against each site's source file (its full
+ * `__FILE__` or just the basename), `file:line` and function name. `state` is
+ * a SiteState value: SITE_ENABLED prints the matching sites whatever the
+ * display level, SITE_DISABLED silences them, and SITE_DEFAULT returns them to
+ * the display level. Verbosity still applies. Returns the number of sites
+ * changed.
+ *
+ *      @code
+ *      SetSiteState("network.c", SITE_ENABLED);       // a whole file
+ *      SetSiteState("parser.c:120", SITE_DISABLED);   // a single line
+ *      SetSiteState("cache_*", SITE_ENABLED);         // functions
+ *      @endcode
+ *
+ * Enabling a site only changes which threshold it points at, and a disabled
+ * site points at none, so the macro drops it after a single load. States set
+ * here survive control file reloads; the file applies on top of them (see
+ * `SetSiteControlFile()`). `DisplayFile()` is not affected.
+ */
+int SetSiteState(const char *pattern, int state);
+
+/**
+ * List every known call site to `stream`, one per line:
+ * `file:line function [LEVEL] state "format"`.
+ */
+int DisplayListSites(FILE *stream);
+
+/**
+ * Watch a control file and apply it whenever it changes (checked once a
+ * second, on a background thread). Each line holds a pattern, as for
+ * `SetSiteState()`, and `on`, `off` or `default`; `#` starts a comment. Lines
+ * apply in order, on top of the states set by `SetSiteState()`, so removing a
+ * line undoes it. Each site gets its new state in one step; sites the change
+ * does not affect are not touched. For example:
+ *
+ *      # /etc/myprocess/display.conf
+ *      network.c         on
+ *      network.c:88      off
+ *      cache_*           on
+ *
+ * NULL stops watching; sites keep their state.
+ */
+int SetSiteControlFile(const char *path);
+/** Return the watched control file, or NULL. */
+const char *GetSiteControlFile();
 
 /** Set Display verbosity. Verbose is enabled by default. */
 int SetVerbose(int v);
 /** Return value of `verbose`. */
 int GetVerbose();
-int verbose;  ///< Use Set/GetVerbose() to access this value.
+extern int verbose;  ///< Use Set/GetVerbose() to access this value.
 
 /**
  * Enable or disable ANSI text coloring. This option is included for operating
@@ -149,7 +311,7 @@ int verbose;  ///< Use Set/GetVerbose() to access this value.
 int SetColorfulness(int c);
 /** Return value of `colorfulness`. */
 int GetColorfulness();
-int colorfulness;  ///< Use Set/GetColorfulness() to access this value.
+extern int colorfulness;  ///< Use Set/GetColorfulness() to access this value.
 
 /** Set filename used in Display trace. Provided for manual override. */
 int SetFilename(char *newFilename);
@@ -161,6 +323,67 @@ int SetAutoNewline(int a);
 /** Get automatic newline inclusion setting. */
 int GetAutoNewline();
 
+/**
+ * Format messages with Display's own printf engine instead of `vsnprintf()`.
+ * Enabled by default. It converts `d i u o x X c s p f F e E g G` with any
+ * flags, width, precision and length modifier, and prints the same bytes as
+ * glibc, floating-point rounding included. A message using anything else
+ * (`%a`, `%m`, `%n`, long double, wide characters, positional arguments, or
+ * a double too large or too small to convert exactly in 128 bits) is
+ * formatted by `vsnprintf()` as a whole.
+ */
+int SetFastFormat(int f);
+/** Get the fast formatting setting. */
+int GetFastFormat();
+
+/**
+ * Add the calling thread to the trace header, after the function name:
+ * THREAD_ID, THREAD_NAME, or `THREAD_ID | THREAD_NAME` for `[4242:worker]`.
+ * 0 (the default) leaves it out. A thread without a name shows its id.
+ *
+ * Each thread formats its part of the header once and reuses it, so this
+ * adds no system call or formatting to a message.
+ */
+int SetShowThread(int fields);
+/** Get the thread information shown in the trace header. */
+int GetShowThread();
+
+/**
+ * Name the calling thread in the trace header (at most 31 characters). NULL
+ * or an empty string removes the name.
+ */
+int DisplaySetThreadName(const char *name);
+/** Return the calling thread's name, or an empty string. */
+const char *DisplayGetThreadName();
+
+/**
+ * Print each message as a JSON object or a logfmt line instead of the usual
+ * text, for log collectors:
+ *
+ *      @code
+ *      {"time":"12:00:00","level":"standard","file":"FileName.c","function":"FunctionName","thread":4242,"message":"Hello, Ben!"}
+ *      time=12:00:00 level=standard file=FileName.c function=FunctionName thread=4242 message="Hello, Ben!"
+ *      @endcode
+ *
+ * A `thread_name` field is added for threads named with
+ * `DisplaySetThreadName()`, and `DisplayKV()` fields follow the message.
+ * Strings are escaped as JSON strings (logfmt values are only quoted when
+ * needed). Colors are never used. The default is TEXT.
+ */
+int SetOutputFormat(int f);
+/** Get the output format. */
+int GetOutputFormat();
+
+/**
+ * Set the longest message body printed, in bytes (default 1 MiB). Messages
+ * are never cut at `BUFFLEN`: short ones are formatted on the stack and long
+ * ones in a buffer each thread keeps for reuse. This cap only guards against
+ * runaway messages; anything longer is truncated.
+ */
+int SetMaxMessageLength(size_t length);
+/** Get the longest message body printed. */
+size_t GetMaxMessageLength();
+
 /** 
  * Set show trace (include function name and timestamp). Enabled by default. 
  * @note By disabling the trace, you are also removing ANSI color information,
@@ -170,6 +393,208 @@ int SetShowTrace(int s);
 /** Get show trace setting. */
 int GetShowTrace();
 
+/**
+ * Set the layout of the trace header, everything printed before the message.
+ * NULL restores the default, `"[%T][%P][%f]%t%V"`. Fields:
+ *
+ *      %T  time, with the digits chosen by SetTimestampPrecision()
+ *      %m  milliseconds, %u microseconds, %n nanoseconds (of the same time)
+ *      %P  program file name (see InitializeDisplay())
+ *      %F  source file of the call          %l  source line of the call
+ *      %f  calling function                 %L  level name, e.g. `WARNING`
+ *      %V  level tag as in the default header: `[INFO] `, or a space
+ *      %t  thread as chosen by SetShowThread(), e.g. `[4242:worker]`
+ *      %i  thread id                        %N  thread name
+ *      %%  a percent sign
+ *
+ *      @code
+ *      SetDisplayPattern("%T.%u [%L] %F:%l %f: ");
+ *      // 12:00:00.123456 [STANDARD] main.c:42 main: Hello, Ben!
+ *      @endcode
+ *
+ * The pattern is compiled when it is set, so printing a header is a handful
+ * of copies whatever its layout. An unknown field is an error. The pattern is
+ * not used by structured or binary output.
+ */
+int SetDisplayPattern(const char *pattern);
+/** Get the trace header layout. */
+const char *GetDisplayPattern();
+
+/**
+ * Open a log file for memory-mapped output, creating it if needed. New lines
+ * are appended after any existing contents. Use with `SetMappedStream()`.
+ *
+ * Messages are copied straight into a shared mapping of the file, so logging
+ * a line costs no system call and takes no lock, and everything logged is in
+ * the kernel page cache as soon as the call returns: nothing is lost if the
+ * process crashes. The file is grown and mapped `chunkSize` bytes at a time
+ * (rounded up to whole pages, 0 selects 4 MiB).
+ *
+ *      @code
+ *      struct DisplayMappedFile *log = OpenMappedFile("process.log", 0);
+ *      SetMappedStream(STANDARD, log);
+ *      Display("Logged without a system call.");
+ *      ...
+ *      CloseMappedFile(log);
+ *      @endcode
+ *
+ * @note After a crash, the file ends with NUL bytes up to the end of the last
+ *       chunk. `CloseMappedFile()` trims them on a clean shutdown.
+ */
+struct DisplayMappedFile *OpenMappedFile(const char *path, size_t chunkSize);
+/**
+ * Close a file opened with `OpenMappedFile()`, trimming its unused space. Any
+ * PrintType still sent to it reverts to its regular stream. Make sure no other
+ * thread is still logging to the file.
+ */
+int CloseMappedFile(struct DisplayMappedFile *file);
+
+/**
+ * Send messages of one PrintType (STANDARD, WARNING or ERROR) to a memory-
+ * mapped file instead of the stream set with `SetStream()`, or back to that
+ * stream when `file` is NULL. Colors are never written to mapped files.
+ */
+int SetMappedStream(int streamType, struct DisplayMappedFile *file);
+/** Return the memory-mapped file used for a PrintType, or NULL. */
+struct DisplayMappedFile *GetMappedStream(int streamType);
+
+/**
+ * Open (or continue) a log file that rotates itself: once it reaches
+ * `maxBytes` bytes or is `maxSeconds` seconds old (0 disables either limit),
+ * it is renamed to `path.1`, older files move up to `path.2` ... `path.keep`,
+ * and logging continues in a new file at `path`. Use with
+ * `SetRotatingStream()` or `AddRotatingSink()`.
+ *
+ *      @code
+ *      struct DisplayRotatingFile *log =
+ *          OpenRotatingFile("process.log", 64 << 20, 24 * 3600, 5);
+ *      SetRotatingStream(STANDARD, log);
+ *      @endcode
+ *
+ * Display calls never wait for a rotation. The switch to the new file is a
+ * single pointer exchange; renaming, closing and compressing happen on a
+ * background thread, which also flushes the file at least once a second.
+ * Unlike copying and truncating the file from outside, no line is lost.
+ */
+struct DisplayRotatingFile *OpenRotatingFile(const char *path,
+    size_t maxBytes, unsigned int maxSeconds, int keep);
+/**
+ * Close a file opened with `OpenRotatingFile()`. Any PrintType still sent to
+ * it reverts to its regular stream, and messages already being written to it
+ * are finished first. Remove sinks using it first.
+ */
+int CloseRotatingFile(struct DisplayRotatingFile *file);
+/** Rotate now, e.g. on SIGHUP, whatever the size and age of the file. */
+int RotateFile(struct DisplayRotatingFile *file);
+/** Compress rotated files with gzip (`path.1.gz`, ...). Disabled by default. */
+int SetRotatingCompress(struct DisplayRotatingFile *file, int c);
+/** Get whether rotated files are compressed. */
+int GetRotatingCompress(struct DisplayRotatingFile *file);
+
+/**
+ * Send messages of one PrintType (STANDARD, WARNING or ERROR) to a rotating
+ * file instead of the stream set with `SetStream()`, or back to that stream
+ * when `file` is NULL. Colors are never written to rotating files.
+ */
+int SetRotatingStream(int streamType, struct DisplayRotatingFile *file);
+/** Return the rotating file used for a PrintType, or NULL. */
+struct DisplayRotatingFile *GetRotatingStream(int streamType);
+
+/**
+ * Additional outputs. Every message printed to a PrintType's stream can also
+ * be sent to up to 16 sinks: other streams, log files, memory-mapped files,
+ * unix-domain sockets or a function of your own. The message is formatted
+ * once and the same text is passed to every sink.
+ *
+ * Sinks are written after the console, one after another, by the thread that
+ * printed the message (the console line is already out by then), so a slow
+ * sink delays that thread and the sinks after it. Stream and file sinks are
+ * handed to the writer thread instead in asynchronous mode (`SetAsync()`);
+ * socket sinks never wait, and memory-mapped and rotating files only copy
+ * into memory. A callback sink runs for as long as the callback does.
+ *
+ *      @code
+ *      struct DisplaySink *log = AddFileSink("errors.log", LEVEL_WARNING);
+ *      DisplayError("Shown on stderr and appended to errors.log.");
+ *      ...
+ *      RemoveSink(log);
+ *      @endcode
+ *
+ * Each sink has its own level filter, applied on top of the display level
+ * (a sink cannot see messages the display level already filters out), and its
+ * own color setting. DisplayFile() messages and binary output are not sent to
+ * sinks. The `Add*Sink()` functions return NULL if the sink cannot be opened
+ * or 16 sinks are already registered.
+ */
+struct DisplaySink;
+
+/** Called with each line (not NUL-terminated) sent to a callback sink. */
+typedef void (*DisplaySinkCallback)(const char *line, size_t length, int level,
+    void *context);
+
+/** Also write messages to `stream`, with colors if it is a terminal. */
+struct DisplaySink *AddStreamSink(FILE *stream, int level);
+/** Also append messages to the file at `path`; RemoveSink() closes it. */
+struct DisplaySink *AddFileSink(const char *path, int level);
+/** Also copy messages into a file opened with `OpenMappedFile()`. */
+struct DisplaySink *AddMappedSink(struct DisplayMappedFile *file, int level);
+/** Also write messages to a file opened with `OpenRotatingFile()`. */
+struct DisplaySink *AddRotatingSink(struct DisplayRotatingFile *file,
+    int level);
+/**
+ * Also send each message as a datagram to the unix-domain socket at `path`.
+ * Messages the socket cannot accept immediately are dropped and counted (see
+ * `GetSinkDropped()`).
+ */
+struct DisplaySink *AddSocketSink(const char *path, int level);
+/** Also pass messages to `callback`, on the thread that printed them. */
+struct DisplaySink *AddCallbackSink(DisplaySinkCallback callback,
+    void *context, int level);
+/**
+ * Unregister a sink, closing the file or socket it opened. No thread is still
+ * writing to the sink when this returns, except when it is called inside
+ * `DisplayLock()` or from the sink's own callback: the sink is then closed
+ * when the writes in progress end.
+ */
+int RemoveSink(struct DisplaySink *sink);
+
+/** Set the lowest severity a sink receives. */
+int SetSinkLevel(struct DisplaySink *sink, int level);
+/** Get the lowest severity a sink receives. */
+int GetSinkLevel(struct DisplaySink *sink);
+/** Keep (ENABLE) or strip (DISABLE) color codes in a sink's messages. */
+int SetSinkColor(struct DisplaySink *sink, int c);
+/** Get a sink's color setting. */
+int GetSinkColor(struct DisplaySink *sink);
+/** Return the number of messages a socket sink has dropped. */
+unsigned long GetSinkDropped(struct DisplaySink *sink);
+
+/**
+ * Set the number of sub-second digits in the trace timestamp. `p` is one of
+ * the values in the `TimestampPrecision` enum.
+ *
+ *      @code
+ *      SetTimestampPrecision(MICROSECONDS);  // [12:00:00.123456][...]
+ *      @endcode
+ */
+int SetTimestampPrecision(int p);
+/** Get trace timestamp precision. */
+int GetTimestampPrecision();
+
+/**
+ * Select the clock used for the trace timestamp. `c` is one of the values in
+ * the `TimestampClock` enum. MONOTONIC and TSC report wall-clock time anchored
+ * at the moment they are selected, but are not affected by later changes to
+ * the system clock. Selecting TSC calibrates the counter, which takes about
+ * 10ms; platforms without one use MONOTONIC instead.
+ *
+ * The formatted `HH:MM:SS` part is cached per thread and only rebuilt when the
+ * second changes, so timestamps cost one clock read per message.
+ */
+int SetTimestampClock(int c);
+/** Get trace timestamp clock. */
+int GetTimestampClock();
+
 /**
  * Set destination stream (file descriptor). For example, the default is 
  * `stdout` for STANDARD printing, and `stderr` for WARNINGs and ERRORs. 
@@ -195,7 +620,7 @@ int SetStream(int streamType, FILE *newStream);
  * enumerated options in the `PrintType` enum.
  */
 FILE *GetStream(int streamType);
-FILE *stream;  ///< Use Set/GetStream() to access this file descriptor.
+extern FILE *stream;  ///< Use Set/GetStream() to access this file descriptor.
 
 /**
  * Enable or disable Matlab mexPrintf printing when using Display in Matlab.
@@ -215,16 +640,120 @@ int GetMatlabMexPrintf();
 
 
 /** 
- * Acquire mutex lock for printing to console. If for some reason you want to
- * manage your own Display mutex, this function lets you acquire the console
- * print lock.
+ * Acquire the Display output locks, e.g. to print several lines that must
+ * not be interleaved with other threads' output. Other threads block when
+ * they print until the matching `DisplayUnlock()`; the calling thread keeps
+ * printing normally. Calls nest.
+ *
+ * In asynchronous mode the calling thread's queued messages are written out
+ * first, its messages inside the lock are written directly, and the writer
+ * thread waits, so other threads' messages come after the group. Do not
+ * change the asynchronous mode while holding the lock.
+ *
+ * Without this, each stream has its own lock, so threads printing to
+ * different streams (stdout and stderr, or different files) do not wait for
+ * each other.
  */
 int DisplayLock();
-/** Release mutex lock for printing to console. */
+/**
+ * Release the output locks taken by the calling thread's `DisplayLock()`.
+ * Returns -1 if the calling thread does not hold them.
+ */
 int DisplayUnlock();
 
 
 
+/**
+ * Enable or disable asynchronous mode. Disabled by default.
+ *
+ * In asynchronous mode every thread formats its messages into its own
+ * lock-free ring buffer and a dedicated writer thread drains the rings to the
+ * configured streams, so `Display()` callers never wait on the console mutex.
+ * Messages from one thread keep their order; messages from different threads
+ * may be written in a different order than they were logged.
+ *
+ *      @code
+ *      SetAsyncBackpressure(DROP_OLDEST);
+ *      SetAsync(ENABLE);
+ *      @endcode
+ *
+ * `DisplayFile()` always writes synchronously, because the caller owns and may
+ * close the file as soon as the call returns. Disabling asynchronous mode, or
+ * calling `CloseDisplay()`, writes out everything queued and joins the writer.
+ *
+ * @note Not recommended with `-DMATLAB`, since `mexPrintf` would be called from
+ *       the writer thread.
+ */
+int SetAsync(int a);
+/** Get asynchronous mode setting. */
+int GetAsync();
+
+/**
+ * Choose how the stream of a PrintType (STANDARD, WARNING or ERROR) is
+ * buffered. `policy` is one of the values in the `BufferPolicy` enum.
+ *
+ * By default (STDIO_BUFFERED) every record goes through the FILE's stdio
+ * buffer, so a pipe receives many small writes and a terminal pays for a
+ * flush on every line. With any other policy, records bypass stdio and are
+ * written to the stream's file descriptor directly:
+ *
+ * - UNBUFFERED writes every record as soon as it is printed.
+ * - LINE_BUFFERED holds text until a record ends with a newline (only
+ *   relevant with `SetAutoNewline(DISABLE)`).
+ * - BATCHED holds records until `bytes` are pending, the oldest has waited
+ *   `milliseconds`, or a WARNING or ERROR message is printed. 0 selects the
+ *   defaults, 64 KiB and 50 ms.
+ *
+ * Threads printing at the same time are group-committed: while one thread
+ * writes, the others add their records to the next batch, which then goes out
+ * in a single `writev(2)`. The number of system calls grows with the number
+ * of batches, not lines.
+ *
+ *      @code
+ *      SetStreamBuffering(STANDARD, BATCHED, 256 << 10, 100);
+ *      @endcode
+ *
+ * `DisplayFlush()`, `SetStream()` and `CloseDisplay()` write out what is
+ * pending, and so does the crash handler. Buffered streams bypass
+ * asynchronous mode and `DisplayLock()`, like memory-mapped and rotating
+ * files.
+ *
+ * @note Anything else written to the same FILE (`printf()`, `DisplayFile()`)
+ *       still goes through stdio and may come out of order. Returns -1 with
+ *       `-DNOFPRINTF` or `-DMATLAB`, which need the FILE.
+ */
+int SetStreamBuffering(int streamType, int policy, size_t bytes,
+    unsigned int milliseconds);
+/** Get the buffering policy of a PrintType's stream. */
+int GetStreamBuffering(int streamType);
+
+/**
+ * Set what happens when a thread's ring is full. `b` is one of the values in
+ * the `Backpressure` enum. Set this before enabling asynchronous mode.
+ */
+int SetAsyncBackpressure(int b);
+/** Get asynchronous backpressure policy. */
+int GetAsyncBackpressure();
+
+/**
+ * Set the size in bytes of each thread's ring buffer (default 64 KiB). Rounded
+ * up to a power of two. Only rings created after the call are affected.
+ */
+int SetAsyncRingSize(size_t bytes);
+/** Get the size of newly created ring buffers. */
+size_t GetAsyncRingSize();
+
+/** Return the number of messages discarded by a dropping backpressure policy. */
+unsigned long GetAsyncDropped();
+
+/**
+ * Block until all queued asynchronous output has been written, then flush the
+ * configured streams.
+ */
+int DisplayFlush();
+
+
+
 /**
  * Initialize the Display utility in the current process. This function must be
  * called in any process where you wish to use the Display utility (prior to
@@ -255,8 +784,8 @@ int DisplayUnlock();
  *      @endcode
  */
 #define Display(format, ...) \
-    if (verbose) \
-        __Display(__FUNCTION__, STANDARD, NULL, RESET, format, ##__VA_ARGS__)
+    __DISPLAY_CALL(LEVEL_STANDARD, verbose, STANDARD, NULL, RESET, format, \
+        ##__VA_ARGS__)
 //
 // Additional note for the above macro: the two ##'s preceding the __VA_ARGS__
 // are GCC-specific and allow zero variadic inputs in a macro. Without the ##
@@ -274,7 +803,8 @@ int DisplayUnlock();
  *      @endcode
  */
 #define DisplayWarning(format, ...) \
-    __Display(__FUNCTION__, WARNING, NULL, BOLD YELLOW, format, ##__VA_ARGS__)
+    __DISPLAY_CALL(LEVEL_WARNING, 1, WARNING, NULL, BOLD YELLOW, format, \
+        ##__VA_ARGS__)
 
 /**
  * Print an error to console regardless of verbosity.
@@ -284,7 +814,8 @@ int DisplayUnlock();
  *      @endcode
  */
 #define DisplayError(format, ...) \
-    __Display(__FUNCTION__, ERROR, NULL, BOLD RED, format, ##__VA_ARGS__)
+    __DISPLAY_CALL(LEVEL_ERROR, 1, ERROR, NULL, BOLD RED, format, \
+        ##__VA_ARGS__)
 
 /** 
  * Print in a custom color.
@@ -299,8 +830,257 @@ int DisplayUnlock();
  * found <a href="https://en.wikipedia.org/wiki/ANSI_escape_code#Colors">here</a>.
  */
 #define DisplayColor(color, format, ...) \
-    if (verbose) \
-        __Display(__FUNCTION__, STANDARD, NULL, color, format, ##__VA_ARGS__)
+    __DISPLAY_CALL(LEVEL_STANDARD, verbose, STANDARD, NULL, color, format, \
+        ##__VA_ARGS__)
+
+/**
+ * Print a fine-grained tracing message, tagged `[TRACE]`. Obeys verbosity, and
+ * is not printed unless the display level of the calling file is LEVEL_TRACE.
+ *
+ *      @code
+ *      DisplayTrace("Entering state %d", state);
+ *      @endcode
+ */
+#define DisplayTrace(format, ...) \
+    __DISPLAY_CALL(LEVEL_TRACE, verbose, STANDARD, NULL, FAINT, format, \
+        ##__VA_ARGS__)
+
+/**
+ * Print a debugging message, tagged `[DEBUG]`. Obeys verbosity, and is not
+ * printed unless the display level of the calling file is LEVEL_DEBUG or lower.
+ */
+#define DisplayDebug(format, ...) \
+    __DISPLAY_CALL(LEVEL_DEBUG, verbose, STANDARD, NULL, CYAN, format, \
+        ##__VA_ARGS__)
+
+/**
+ * Print an informational message, tagged `[INFO]`. Obeys verbosity, and is
+ * printed at the default display level.
+ */
+#define DisplayInfo(format, ...) \
+    __DISPLAY_CALL(LEVEL_INFO, verbose, STANDARD, NULL, GREEN, format, \
+        ##__VA_ARGS__)
+
+/**
+ * Print a message with typed key-value fields. Obeys verbosity. The fields
+ * become members of the JSON object or logfmt line in structured output (see
+ * `SetOutputFormat()`), and are appended as `key=value` in text output.
+ *
+ *      @code
+ *      DisplayKV("request done", KV_STR("path", path), KV_INT("status", 200),
+ *          KV_FLOAT("ms", elapsed), KV_BOOL("cached", hit));
+ *      @endcode
+ *
+ * The message is printed as it is, not used as a format string.
+ */
+#define DisplayKV(message, ...) do { \
+    __DISPLAY_SITE(__displaySite, LEVEL_STANDARD, message); \
+    if (verbose && __DISPLAY_ENABLED(__displaySite)) \
+    { \
+        const struct DisplayField __displayFields[] = { __VA_ARGS__ }; \
+        __DisplayFields(&__displaySite, STANDARD, RESET, message, \
+            __displayFields, \
+            sizeof(__displayFields) / sizeof(__displayFields[0])); \
+    } \
+} while (0)
+
+/** Integer field for `DisplayKV()`. */
+#define KV_INT(key, value)   { key, FIELD_INT, (long long)(value), 0, NULL }
+/** Floating point field for `DisplayKV()`. */
+#define KV_FLOAT(key, value) { key, FIELD_FLOAT, 0, (double)(value), NULL }
+/** String field for `DisplayKV()`. NULL is printed as null. */
+#define KV_STR(key, value)   { key, FIELD_STRING, 0, 0, (value) }
+/** Boolean field for `DisplayKV()`. */
+#define KV_BOOL(key, value)  { key, FIELD_BOOL, !!(value), 0, NULL }
+
+/**
+ * Print `length` bytes at `buffer` as a single message: a caption, then one
+ * line per 16 bytes laid out like `hexdump -C`. Obeys verbosity.
+ *
+ *      @code
+ *      DisplayHex(packet, 20);
+ *      @endcode
+ *
+ *      [12:00:00][FileName][FunctionName] 20 bytes
+ *      00000000  45 00 00 14 1c 46 40 00  40 06 00 00 7f 00 00 01  |E....F@.@.......|
+ *      00000010  7f 00 00 01                                       |....|
+ *
+ * The whole dump is one record, written with one lock and one header however
+ * long it is, and is not limited by `SetMaxMessageLength()`. Bytes are
+ * converted with SSE2 or AVX2 instructions where available. In structured
+ * output the bytes become a `bytes` field of plain hex digits.
+ */
+#define DisplayHex(buffer, length) do { \
+    __DISPLAY_SITE(__displaySite, LEVEL_STANDARD, "%zu bytes"); \
+    if (verbose && __DISPLAY_ENABLED(__displaySite)) \
+        __DisplayHex(&__displaySite, STANDARD, RESET, buffer, length, NULL); \
+} while (0)
+
+/** `DisplayHex()` with a caption of your own: `format` and its arguments. */
+#define DisplayHexDump(buffer, length, format, ...) do { \
+    __DISPLAY_SITE(__displaySite, LEVEL_STANDARD, format); \
+    if (verbose && __DISPLAY_ENABLED(__displaySite)) \
+        __DisplayHex(&__displaySite, STANDARD, RESET, buffer, length, \
+            format, ##__VA_ARGS__); \
+} while (0)
+
+/**
+ * Print only every `n`th call from this line (the 1st, the n+1st, ...). Obeys
+ * verbosity. Each printed message ends with the number of calls suppressed
+ * since the previous one.
+ *
+ *      @code
+ *      for (int i = 0; i < 1000000; i++)
+ *          DisplayEveryN(1000, "Processed %d items", i);
+ *      @endcode
+ *
+ * The check is a single atomic increment on a counter owned by the call site,
+ * done before any formatting or locking. An `n` of 0 or less suppresses every
+ * call. `n` is evaluated twice.
+ */
+#define DisplayEveryN(n, format, ...) do { \
+    static unsigned long __displayCount; \
+    __DISPLAY_LIMITED((n) > 0 && __atomic_fetch_add(&__displayCount, 1, \
+        __ATOMIC_RELAXED) % (n) == 0, format, ##__VA_ARGS__); \
+} while (0)
+
+/**
+ * Print at most `perSecond` messages per second from this line, allowing
+ * short bursts of up to `perSecond` messages. Obeys verbosity. Each printed
+ * message ends with the number of calls suppressed since the previous one.
+ *
+ *      @code
+ *      DisplayRateLimited(10, "Dropped packet from %s", address);
+ *      @endcode
+ *
+ * The check is lock-free and done before any formatting or locking.
+ */
+#define DisplayRateLimited(perSecond, format, ...) do { \
+    static unsigned long long __displayRate; \
+    __DISPLAY_LIMITED(__DisplayRateAllow(&__displayRate, perSecond), format, \
+        ##__VA_ARGS__); \
+} while (0)
+
+/**
+ * Print only the first call from this line. Obeys verbosity.
+ *
+ *      @code
+ *      DisplayOnce("Falling back to software rendering.");
+ *      @endcode
+ */
+#define DisplayOnce(format, ...) do { \
+    static int __displayDone; \
+    __DISPLAY_LIMITED(!__atomic_exchange_n(&__displayDone, 1, \
+        __ATOMIC_RELAXED), format, ##__VA_ARGS__); \
+} while (0)
+
+/**
+ * Coalesce repeated messages: a message identical to the last one written to
+ * its stream, from the same call site and within `milliseconds` of it, is
+ * counted instead of written. The count is printed as a single line,
+ *
+ *      [12:00:00][FileName][FunctionName][ERROR] last message repeated 4182 times
+ *
+ * as soon as a different message arrives or the window closes. 0 disables
+ * coalescing (the default).
+ *
+ *      @code
+ *      SetCoalesceWindow(1000);
+ *      @endcode
+ *
+ * Messages are identified by their call site and a hash of their format and
+ * formatted text, without the header, so there is no string comparison. They
+ * are still formatted, but skip the lock and the write.
+ */
+int SetCoalesceWindow(unsigned int milliseconds);
+/** Get the coalescing window in milliseconds, 0 if disabled. */
+unsigned int GetCoalesceWindow();
+
+/**
+ * Keep the last `messages` messages that were not printed (rounded up to a
+ * power of two) in memory: a flight recorder. 0 stops recording (the
+ * default).
+ *
+ *      @code
+ *      SetHistorySize(1024);
+ *      SetVerbose(DISABLE);
+ *      Display("Connecting to %s", host);  // not printed, but kept
+ *      DisplayError("Connection failed.");  // printed after the history
+ *      @endcode
+ *
+ * The plain Display macros (`Display()`, `DisplayColor()`, `DisplayTrace()`,
+ * `DisplayDebug()`, `DisplayInfo()`, and the others when disabled) record
+ * their message when verbosity or the display level of their file keeps it
+ * from being printed. Recorded messages are written where ERROR messages go
+ * (mapped, rotating or buffered, if set), oldest first, in front of the next `DisplayError()`, by
+ * `DisplayDumpHistory()`, and by the crash handler (see `SetCrashHandler()`).
+ * Each is written once.
+ *
+ * Recording takes no lock and normally does no formatting: arguments are
+ * stored raw, as in binary output, and formatted when the history is written.
+ * Messages longer than a slot (about 200 bytes of text or arguments) are cut.
+ */
+int SetHistorySize(size_t messages);
+/** Get the number of messages kept, 0 if not recording. */
+size_t GetHistorySize();
+/**
+ * Write the messages kept by `SetHistorySize()` to the ERROR stream and
+ * forget them. Returns how many were written.
+ */
+int DisplayDumpHistory();
+
+/* Remove calls below DISPLAY_MIN_LEVEL. Their arguments are still type checked
+ * but never evaluated, and no code is generated for them. */
+#if DISPLAY_MIN_LEVEL > LEVEL_TRACE
+#undef  DisplayTrace
+#define DisplayTrace(format, ...) __DISPLAY_DISCARD(format, ##__VA_ARGS__)
+#endif
+#if DISPLAY_MIN_LEVEL > LEVEL_DEBUG
+#undef  DisplayDebug
+#define DisplayDebug(format, ...) __DISPLAY_DISCARD(format, ##__VA_ARGS__)
+#endif
+#if DISPLAY_MIN_LEVEL > LEVEL_INFO
+#undef  DisplayInfo
+#define DisplayInfo(format, ...) __DISPLAY_DISCARD(format, ##__VA_ARGS__)
+#endif
+#if DISPLAY_MIN_LEVEL > LEVEL_STANDARD
+#undef  Display
+#define Display(format, ...) __DISPLAY_DISCARD(format, ##__VA_ARGS__)
+#undef DisplayKV
+#define DisplayKV(message, ...) do { \
+    if (0) { \
+        const struct DisplayField __displayFields[] = { __VA_ARGS__ }; \
+        (void)__displayFields; (void)(message); \
+    } \
+} while (0)
+#undef  DisplayColor
+#define DisplayColor(color, format, ...) \
+    __DISPLAY_DISCARD(format, ##__VA_ARGS__)
+#undef  DisplayEveryN
+#define DisplayEveryN(n, format, ...) __DISPLAY_DISCARD(format, ##__VA_ARGS__)
+#undef  DisplayRateLimited
+#define DisplayRateLimited(perSecond, format, ...) \
+    __DISPLAY_DISCARD(format, ##__VA_ARGS__)
+#undef  DisplayHex
+#define DisplayHex(buffer, length) do { \
+    if (0) { (void)(buffer); (void)(length); } \
+} while (0)
+#undef  DisplayHexDump
+#define DisplayHexDump(buffer, length, format, ...) do { \
+    if (0) { (void)(buffer); (void)(length); } \
+    __DISPLAY_DISCARD(format, ##__VA_ARGS__); \
+} while (0)
+#undef  DisplayOnce
+#define DisplayOnce(format, ...) __DISPLAY_DISCARD(format, ##__VA_ARGS__)
+#endif
+#if DISPLAY_MIN_LEVEL > LEVEL_WARNING
+#undef  DisplayWarning
+#define DisplayWarning(format, ...) __DISPLAY_DISCARD(format, ##__VA_ARGS__)
+#endif
+#if DISPLAY_MIN_LEVEL > LEVEL_ERROR
+#undef  DisplayError
+#define DisplayError(format, ...) __DISPLAY_DISCARD(format, ##__VA_ARGS__)
+#endif
 
 /**
  * Print directly to a file descriptor.
@@ -320,8 +1100,194 @@ int DisplayUnlock();
  *      DisplayFile(logFile, "Process booted (%d).", 6);
  *      @endcode
  */
-#define DisplayFile(fd, format, ...) \
-    __Display(__FUNCTION__, CUSTOM, fd, RESET, format, ##__VA_ARGS__)
+#define DisplayFile(fd, format, ...) do { \
+    __DISPLAY_SITE(__displaySite, LEVEL_STANDARD, format); \
+    __DisplayAt(&__displaySite, CUSTOM, fd, RESET, format, ##__VA_ARGS__); \
+} while (0)
+
+
+
+/**
+ * Print a message from a signal handler, or when the process is in a state
+ * where nothing else can be trusted. Always printed to the ERROR stream with
+ * a single write(2), tagged `[EMERGENCY]`, and never colored, queued or sent
+ * to sinks.
+ *
+ *      @code
+ *      void onSignal(int signal)
+ *      {
+ *          DisplayEmergency("Received signal %d", signal);
+ *      }
+ *      @endcode
+ *
+ * Unlike the other macros this takes no lock, allocates nothing and avoids
+ * `localtime()` and `vsnprintf()`, so it is async-signal-safe. The message is
+ * formatted into a fixed buffer on the stack (at most 1 KiB) by a small
+ * formatter of its own: flags `-` and `0`, width and precision, and `d i u o
+ * x X c s p`. Floating point numbers are printed in fixed-point notation.
+ */
+#define DisplayEmergency(format, ...) \
+    __DisplayEmergency(__FUNCTION__, format, ##__VA_ARGS__)
+
+/**
+ * Install (ENABLE) or remove (DISABLE) a handler for SIGSEGV, SIGBUS, SIGFPE,
+ * SIGILL and SIGABRT. Disabled by default.
+ *
+ * When the process crashes, the handler writes out everything Display still
+ * has buffered (the stdio buffers of its streams, sinks and rotating files,
+ * and records queued in asynchronous mode) with async-signal-safe `write(2)`
+ * calls, prints an emergency line naming the signal and then passes the
+ * signal on to the handler installed before it. Without it, buffered lines
+ * are lost with the process.
+ *
+ * Stack overflows are handled on an alternate stack, set up for the thread
+ * that enables the handler.
+ *
+ * @note Reading another FILE's buffer requires glibc. Elsewhere only queued
+ *       asynchronous records are written out.
+ */
+int SetCrashHandler(int c);
+/** Get whether the crash handler is installed. */
+int GetCrashHandler();
+
+
+
+/**
+ * Logging telemetry, as returned by `DisplayGetStats()`. Counts are totals
+ * since the process started, over all threads.
+ */
+struct DisplayStats {
+    unsigned long long messages[LEVEL_ERROR + 1]; /**< printed, by level */
+    unsigned long long bytes[CUSTOM + 1];  /**< text output, by PrintType */
+    unsigned long long truncated;   /**< messages cut to fit their buffer */
+    unsigned long long suppressed;  /**< rate limited or coalesced */
+    unsigned long long dropped;     /**< lost by async mode or socket sinks */
+    unsigned long long lockWaitNs;  /**< time spent waiting for stream locks */
+    unsigned long long writeNs;     /**< time spent writing to streams */
+};
+
+/**
+ * Collect telemetry (ENABLE) or not (DISABLE). Disabled by default.
+ *
+ * Each thread counts into its own cache-line-aligned block, so enabling
+ * statistics adds no contention between threads, only a few additions and,
+ * for the timings, two clock reads per write. Only contended lock waits are
+ * timed. `dropped` is always available.
+ */
+int SetStats(int s);
+/** Get whether telemetry is collected. */
+int GetStats();
+
+/** Fill in `stats` with the totals so far. */
+int DisplayGetStats(struct DisplayStats *stats);
+
+/**
+ * Print the totals so far to `stream` as a single line of `key=value` pairs:
+ *
+ *      [12:00:00][FileName] stats: messages_trace=0 ... write_us=120
+ */
+int DisplayPrintStats(FILE *stream);
+
+/**
+ * Print the statistics to `stream` every `seconds` seconds, from a background
+ * thread. A NULL stream or 0 seconds stops it.
+ *
+ *      @code
+ *      SetStats(ENABLE);
+ *      SetStatsDump(stderr, 60);
+ *      @endcode
+ */
+int SetStatsDump(FILE *stream, unsigned int seconds);
+
+
+
+/**
+ * Time the rest of the enclosing block and add the duration to the latency
+ * histogram of `name`, a string literal. Nothing is printed per measurement;
+ * see `DisplayPrintTimers()`.
+ *
+ *      @code
+ *      void parse(const char *text)
+ *      {
+ *          DisplayTimeScope("parse");
+ *          ...
+ *      }   // measured here, on every return path
+ *      @endcode
+ *
+ * Recording costs two reads of the monotonic clock and a few relaxed atomic
+ * additions: no lock, no allocation and no formatting.
+ */
+#define DisplayTimeScope(name) \
+    __DISPLAY_TIMER(__DISPLAY_UNIQUE(__displayTimer), name); \
+    struct DisplayTimerScope __DISPLAY_UNIQUE(__displayScope) \
+        __attribute__((cleanup(__DisplayTimerScopeEnd), unused)) = \
+        { &__DISPLAY_UNIQUE(__displayTimer), __DisplayTimerNow() }
+
+/**
+ * Start timing a region that is not a block, under `name` (a string literal).
+ * Pass the result to `DisplayTimerStop()`.
+ *
+ *      @code
+ *      struct DisplayTimerScope t = DisplayTimerStart("query");
+ *      runQuery();
+ *      DisplayTimerStop(t);
+ *      @endcode
+ */
+#define DisplayTimerStart(name) ({ \
+    __DISPLAY_TIMER(__displayTimer, name); \
+    (struct DisplayTimerScope){ &__displayTimer, __DisplayTimerNow() }; })
+
+/** Stop a timer started with `DisplayTimerStart()` and record the duration. */
+#define DisplayTimerStop(scope) \
+    __DisplayTimerRecord((scope).timer, __DisplayTimerNow() - (scope).start)
+
+/**
+ * Print one row per timer name, with the number of measurements and the
+ * minimum, median, 99th percentile and maximum duration:
+ *
+ *      [12:00:00][FileName] timers:
+ *      name                          count        min        p50        p99        max
+ *      parse                          1000      812ns     1.02us     4.61us     17.3us
+ *
+ * Percentiles come from log-linear buckets and are within about 6% of the true
+ * value; the minimum and maximum are exact. Timers sharing a name are merged.
+ * `CloseDisplay()` prints this table to the STANDARD stream when verbosity is
+ * enabled and something was timed.
+ */
+int DisplayPrintTimers(FILE *stream);
+
+/** Clear the measurements of every timer. */
+int DisplayResetTimers();
+
+
+
+/**
+ * Switch to deferred-formatting binary output, or back to text output when
+ * `newStream` is NULL. Disabled by default.
+ *
+ * In binary mode the Display macros, except `DisplayFile()`, no longer format
+ * their messages. Each call writes a small
+ * record holding the call-site id, the timestamp and the raw argument bytes to
+ * `newStream`. The format string, file and function of a call site are written
+ * once, the first time it is used. The `display-decode` tool (see `tools/`)
+ * turns the stream back into the usual text:
+ *
+ *      @code
+ *      SetBinaryStream(fopen("trace.bin", "wb"));
+ *      Display("x = %d", 76);
+ *      @endcode
+ *
+ *      $ display-decode trace.bin
+ *      [12:00:00][FileName][FunctionName] x = 76
+ *
+ * Calls whose format cannot be deferred (`%n`, `%m`, wide characters or
+ * positional arguments) are formatted immediately and stored as text.
+ * `DisplayFile()` is unaffected. The stream is written in the byte order and
+ * type sizes of the logging machine, so decode it on a compatible host.
+ */
+int SetBinaryStream(FILE *newStream);
+/** Return the binary output stream, or NULL in text mode. */
+FILE *GetBinaryStream();
 
 
 
@@ -336,10 +1302,193 @@ int CloseDisplay();
 ///////////////////////////////////////////////////////////////////////////////
 
 /** Do not call this function, use `InitializeDisplay()` instead. */
-int __InitializeDisplay(char *filenameRaw, int argc, char *argv[]);
+int __InitializeDisplay(const char *filenameRaw, int argc, char *argv[]);
+
+/**
+ * Call-site descriptor. Every Display macro expansion defines one static
+ * instance, so information that never changes between calls is available to
+ * the library without being passed (or written out) on every message.
+ */
+struct DisplaySite {
+    const char *file;       ///< Source file of the call (`__FILE__`).
+    const char *function;   ///< Calling function (`__FUNCTION__`).
+    const char *format;     ///< Format string, or NULL if not a constant.
+    int         line;       ///< Source line of the call (`__LINE__`).
+    int         level;      ///< Severity, one of the LEVEL_ values.
+    const int  *threshold;  ///< Display level of the source file, the fixed
+                            ///< threshold of an enabled site, or NULL if the
+                            ///< site is disabled.
+    void       *binary;     ///< Internal, binary output registration.
+    unsigned long suppressed;  ///< Calls dropped by rate limiting.
+    int         state;      ///< One of the SiteState values, in effect.
+    int         preset;     ///< State given by `SetSiteState()`.
+};
+
+/** Number of histogram buckets of a timer. */
+#define DISPLAY_TIMER_BUCKETS 368
+
+/** Timer of one DisplayTimeScope() or DisplayTimerStart() expansion. */
+struct DisplayTimer {
+    const char          *name;
+    int                  listed;  ///< Internal, registered for printing.
+    unsigned long long   count;   ///< Number of measurements.
+    unsigned long long   total;   ///< Sum of all durations, in ns.
+    unsigned long long   min;     ///< Shortest duration plus one, 0 if none.
+    unsigned long long   max;     ///< Longest duration.
+    struct DisplayTimer *next;    ///< Internal, list of used timers.
+    unsigned long long   buckets[DISPLAY_TIMER_BUCKETS];
+};
+
+/** A running measurement: its timer and start time. */
+struct DisplayTimerScope {
+    struct DisplayTimer *timer;
+    long long            start;
+};
+
+#define __DISPLAY_CONCAT_(a, b) a##b
+#define __DISPLAY_CONCAT(a, b)  __DISPLAY_CONCAT_(a, b)
+#define __DISPLAY_UNIQUE(name)  __DISPLAY_CONCAT(name, __LINE__)
+
+/** Define the static timer `variable` for timer `name`. */
+#define __DISPLAY_TIMER(variable, name) \
+    static struct DisplayTimer variable = { name, 0, 0, 0, 0, 0, NULL, { 0 } }
+
+/** Do not call this function. Monotonic time in nanoseconds. */
+long long __DisplayTimerNow();
+/** Do not call this function, use `DisplayTimerStop()` instead. */
+void __DisplayTimerRecord(struct DisplayTimer *timer, long long ns);
+/** Do not call this function. Ends a `DisplayTimeScope()`. */
+void __DisplayTimerScopeEnd(struct DisplayTimerScope *scope);
+
+/** Threshold of call sites that have not been used yet. */
+extern int __displayUnresolved;
+/** Messages that are not printed are recorded. Use `SetHistorySize()`. */
+extern int __displayHistory;
+
+/**
+ * Define the static call-site descriptor `name` for the current line. All
+ * descriptors go to the `display_sites` section, where `SetSiteState()` finds
+ * them; the alignment keeps the section a plain array.
+ */
+#define __DISPLAY_SITE(name, level, format) \
+    static struct DisplaySite name \
+        __attribute__((section("display_sites"), used, aligned(8))) = { \
+        __FILE__, __FUNCTION__, \
+        __builtin_constant_p(format) ? (format) : NULL, __LINE__, level, \
+        &__displayUnresolved, NULL, 0, SITE_DEFAULT, SITE_DEFAULT }
+
+/** Do not call this function. Registers the call sites of one module. */
+void __DisplayRegisterSites(struct DisplaySite *start, struct DisplaySite *stop);
+
+/* Bounds of the `display_sites` section of the module (program or shared
+ * library) being built, defined by the linker. */
+extern struct DisplaySite __start_display_sites
+    __attribute__((weak, visibility("hidden")));
+extern struct DisplaySite __stop_display_sites
+    __attribute__((weak, visibility("hidden")));
+
+/* Every file that includes this header registers its module's call sites at
+ * startup. The library ignores all but the first registration of a module. */
+#ifndef DISPLAY_NO_SITE_REGISTRY
+static void __attribute__((constructor, used)) __displayRegisterModule(void)
+{
+    if (&__start_display_sites != &__stop_display_sites)
+        __DisplayRegisterSites(&__start_display_sites, &__stop_display_sites);
+}
+#endif
+
+/**
+ * True if the site's level passes its threshold: the site's own pointer, then
+ * the slot it points at, both relaxed loads. A disabled site has no slot and
+ * stops after the first.
+ */
+static inline int __DisplayEnabled(const struct DisplaySite *site)
+{
+    const int *threshold = __atomic_load_n(&site->threshold, __ATOMIC_RELAXED);
+    return threshold != NULL &&
+           site->level >= __atomic_load_n(threshold, __ATOMIC_RELAXED);
+}
+#define __DISPLAY_ENABLED(site) __DisplayEnabled(&(site))
+
+/** Shared body of the Display macros. */
+#define __DISPLAY_CALL(level, condition, type, fd, color, format, ...) do { \
+    __DISPLAY_SITE(__displaySite, level, format); \
+    if ((condition) && __DISPLAY_ENABLED(__displaySite)) \
+        __DisplayAt(&__displaySite, type, fd, color, format, ##__VA_ARGS__); \
+    else if (__builtin_expect( \
+                 __atomic_load_n(&__displayHistory, __ATOMIC_RELAXED), 0)) \
+        __DisplayRemember(&__displaySite, format, ##__VA_ARGS__); \
+} while (0)
+
+/** Shared body of the rate-limited macros. `allow` is evaluated last. */
+#define __DISPLAY_LIMITED(allow, format, ...) do { \
+    __DISPLAY_SITE(__displaySite, LEVEL_STANDARD, format); \
+    if (verbose && __DISPLAY_ENABLED(__displaySite)) \
+    { \
+        if (allow) \
+            __DisplayAt(&__displaySite, STANDARD, NULL, RESET, format, \
+                ##__VA_ARGS__); \
+        else \
+            __atomic_add_fetch(&__displaySite.suppressed, 1, \
+                __ATOMIC_RELAXED); \
+    } \
+} while (0)
+
+/** One `DisplayKV()` field. Use the KV_ macros to fill it in. */
+struct DisplayField {
+    const char *key;   ///< Field name.
+    int         type;  ///< One of the FieldType values.
+    long long   i;     ///< FIELD_INT and FIELD_BOOL value.
+    double      d;     ///< FIELD_FLOAT value.
+    const char *s;     ///< FIELD_STRING value.
+};
+
+/** Do not call this function, use `DisplayKV()` instead. */
+void __DisplayFields(struct DisplaySite *site, int type, const char *color,
+    const char *message, const struct DisplayField *fields, int count);
+
+/** Do not call this function, use `DisplayHex()` instead. */
+void __DisplayHex(struct DisplaySite *site, int type, const char *color,
+    const void *buffer, size_t length, const char *format, ...)
+    __attribute__((format(printf, 6, 7)));
+
+/** Do not call this function. Records a message for `SetHistorySize()`. */
+void __DisplayRemember(struct DisplaySite *site, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/** Do not call this function, use `DisplayEmergency()` instead. */
+void __DisplayEmergency(const char *function, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/** Do not call this function, use `DisplayRateLimited()` instead. */
+int __DisplayRateAllow(unsigned long long *state, unsigned long perSecond);
+
+/**
+ * Do not call this function. `vsnprintf()` as messages are formatted, by the
+ * engine chosen with `SetFastFormat()`; used by the benchmark.
+ */
+int __DisplayVformat(char *buffer, size_t size, const char *format,
+    va_list args);
+
+/** Expansion of calls removed by DISPLAY_MIN_LEVEL. */
+#define __DISPLAY_DISCARD(format, ...) do { \
+    if (0) printf(format, ##__VA_ARGS__); \
+} while (0)
 
 /** Do not call this function, use `Display()` instead. */
+void __DisplayAt(struct DisplaySite *site, int type, FILE *fd,
+    const char *color, const char *format, ...)
+    __attribute__((format(printf, 5, 6)));
+
+/** 
+ * Do not call this function, use `Display()` instead. Kept for programs built
+ * against older versions of this header.
+ */
 void __Display(const char *function, int type, FILE *fd, char *color, \
     char *format, ...);
 
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
 #endif  // end of include guard
\ No newline at end of file
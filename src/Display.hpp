@@ -0,0 +1,702 @@
+/**
+ * @file
+ * @brief Type-safe C++17 front end of the Display utility.
+ *
+ * Include this header instead of Display.h in C++ code. The Display macros
+ * keep their names and behavior, but their format string is parsed at compile
+ * time and each argument is checked against its conversion:
+ *
+ *      @code
+ *      Display("Loaded %d records from %s", count, path);  // path may be a
+ *                                                          // std::string
+ *      Display("Loaded %d records", path);  // error: %d needs an integer
+ *      @endcode
+ *
+ * Each call site gets a formatter generated for its format: literal text is
+ * copied, plain `%d %i %u %x %X %o %c %s` are converted without printf, and
+ * only conversions with flags, width or precision (and floating point) go
+ * through snprintf(), one conversion at a time. The message then takes the
+ * same path as in C: same streams, lock, header, levels and options, so C and
+ * C++ output in one program stays consistent. In binary output, and for
+ * messages only recorded for `SetHistorySize()`, the arguments are passed on
+ * unformatted instead when each has exactly the type printf() expects;
+ * otherwise those messages are formatted in full first.
+ *
+ * Differences from the C macros:
+ *
+ *  - The format must be a string literal.
+ *  - `%s` also takes `std::string` and `std::string_view`.
+ *  - Integers print at their own width, so length modifiers are optional
+ *    (`%d` of a `long` is fine); `hh` and `h` still cut as in printf.
+ *  - `%f %e %g %a` also take integers.
+ *  - `%n`, positional arguments (`%1$d`) and wide characters are rejected.
+ *
+ * `DisplayKV()`, `DisplayHex()` and `DisplayFile()` are unchanged.
+ */
+
+#ifndef __ESPA_DISPLAY_HPP__
+#define __ESPA_DISPLAY_HPP__
+
+#include "Display.h"
+
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace display {
+namespace detail {
+
+constexpr int maxSpecs = 32;  // conversions per format, like binary output
+
+
+
+// Compile-time format parsing.
+
+// What a conversion takes from the argument list.
+enum class Kind : unsigned char {
+    None,      // "%%" and "%m": nothing
+    Signed,    // d i
+    Unsigned,  // u o x X
+    Char,      // c
+    String,    // s
+    Float,     // f F e E g G a A
+    Pointer    // p
+};
+
+enum Length { LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_J, LEN_Z, LEN_T,
+              LEN_BIGL };
+
+enum Error { OK, TOO_MANY, POSITIONAL, UNSUPPORTED, TRUNCATED };
+
+struct Spec {
+    std::size_t literal;        // start of the text before the conversion
+    std::size_t start;          // the '%'
+    std::size_t lengthStart;    // length modifier, or conversion if none
+    std::size_t end;            // one past the conversion
+    char        conversion;
+    int         length;         // Length
+    Kind        kind;
+    bool        plain;          // no flags, width or precision
+    bool        starWidth;      // width is taken from an int argument
+    bool        starPrecision;  // precision is taken from an int argument
+};
+
+struct Format {
+    Spec        specs[maxSpecs];
+    int         count;           // conversions
+    std::size_t tail;            // start of the text after the last one
+    Kind        args[3 * maxSpecs];  // kind of each argument, Signed for '*'
+    int         star[3 * maxSpecs];  // 1 if the argument is a '*' value
+    int         lengths[3 * maxSpecs];  // Length of each argument
+    int         argCount;
+    Error       error;
+};
+
+constexpr bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+constexpr Format parse(std::string_view text)
+{
+    Format      format{};
+    std::size_t i = 0;
+    std::size_t literal = 0;
+    while (i < text.size())
+    {
+        if (text[i] != '%') { i++; continue; }
+        if (format.count == maxSpecs) { format.error = TOO_MANY; return format; }
+
+        Spec spec{};
+        spec.literal = literal;
+        spec.start   = i++;
+
+        std::size_t digits = i;
+        while (digits < text.size() && isDigit(text[digits])) digits++;
+        if (digits < text.size() && text[digits] == '$' && digits != i)
+        {
+            format.error = POSITIONAL;
+            return format;
+        }
+
+        // Flags, width and precision.
+        std::size_t flags = i;
+        while (i < text.size() && (text[i] == '-' || text[i] == '+' ||
+               text[i] == ' ' || text[i] == '#' || text[i] == '0' ||
+               text[i] == '\'' || text[i] == 'I'))
+            i++;
+        if (i < text.size() && text[i] == '*') { spec.starWidth = true; i++; }
+        else while (i < text.size() && isDigit(text[i])) i++;
+        if (i < text.size() && text[i] == '.')
+        {
+            i++;
+            if (i < text.size() && text[i] == '*')
+            {
+                spec.starPrecision = true;
+                i++;
+            }
+            else while (i < text.size() && isDigit(text[i])) i++;
+        }
+        spec.plain = (i == flags);
+
+        // Length modifier.
+        spec.lengthStart = i;
+        char first  = (i < text.size()) ? text[i] : '\0';
+        char second = (i + 1 < text.size()) ? text[i + 1] : '\0';
+        switch (first)
+        {
+            case 'h': spec.length = (second == 'h') ? LEN_HH : LEN_H; break;
+            case 'l': spec.length = (second == 'l') ? LEN_LL : LEN_L; break;
+            case 'q': spec.length = LEN_LL;   break;
+            case 'L': spec.length = LEN_BIGL; break;
+            case 'j': spec.length = LEN_J;    break;
+            case 'z':
+            case 'Z': spec.length = LEN_Z;    break;
+            case 't': spec.length = LEN_T;    break;
+            default:  spec.length = LEN_NONE; break;
+        }
+        if (spec.length == LEN_HH || (spec.length == LEN_LL && first == 'l'))
+            i += 2;
+        else if (spec.length != LEN_NONE)
+            i++;
+
+        // Conversion.
+        if (i >= text.size()) { format.error = TRUNCATED; return format; }
+        spec.conversion = text[i++];
+        spec.end        = i;
+        switch (spec.conversion)
+        {
+            case '%': case 'm':
+                spec.kind = Kind::None;
+                break;
+            case 'd': case 'i':
+                spec.kind = Kind::Signed;
+                break;
+            case 'u': case 'o': case 'x': case 'X':
+                spec.kind = Kind::Unsigned;
+                break;
+            case 'c':
+                spec.kind = Kind::Char;
+                if (spec.length != LEN_NONE) format.error = UNSUPPORTED;
+                break;
+            case 's':
+                spec.kind = Kind::String;
+                if (spec.length != LEN_NONE) format.error = UNSUPPORTED;
+                break;
+            case 'f': case 'F': case 'e': case 'E':
+            case 'g': case 'G': case 'a': case 'A':
+                spec.kind = Kind::Float;
+                break;
+            case 'p':
+                spec.kind = Kind::Pointer;
+                break;
+            default:  // %n, %C, %S and unknown conversions
+                format.error = UNSUPPORTED;
+                return format;
+        }
+
+        if (spec.starWidth)
+        {
+            format.star[format.argCount]   = 1;
+            format.args[format.argCount++] = Kind::Signed;
+        }
+        if (spec.starPrecision)
+        {
+            format.star[format.argCount]   = 1;
+            format.args[format.argCount++] = Kind::Signed;
+        }
+        if (spec.kind != Kind::None)
+        {
+            format.lengths[format.argCount] = spec.length;
+            format.args[format.argCount++]  = spec.kind;
+        }
+
+        format.specs[format.count++] = spec;
+        literal = i;
+    }
+    format.tail = literal;
+    return format;
+}
+
+// The parsed format of call site `F`, whose text() returns its format.
+template <class F>
+inline constexpr Format parsed = parse(F::text());
+
+
+
+// Compile-time argument checking.
+
+template <class T>
+using Bare = std::remove_cv_t<std::remove_reference_t<T>>;
+
+template <class T>
+inline constexpr bool isInteger =
+    std::is_integral_v<Bare<T>> || std::is_enum_v<Bare<T>>;
+
+template <class T>
+inline constexpr bool isString =
+    std::is_same_v<std::decay_t<Bare<T>>, char *> ||
+    std::is_same_v<std::decay_t<Bare<T>>, const char *> ||
+    std::is_same_v<Bare<T>, std::string> ||
+    std::is_same_v<Bare<T>, std::string_view>;
+
+template <class T>
+inline constexpr bool isPointer =
+    std::is_pointer_v<std::decay_t<Bare<T>>> || std::is_null_pointer_v<Bare<T>>;
+
+template <Kind K, int Star, class T>
+constexpr bool checkArgument()
+{
+    if constexpr (Star)
+        static_assert(isInteger<T>,
+            "Display: a '*' width or precision needs an integer argument");
+    else if constexpr (K == Kind::Signed || K == Kind::Unsigned)
+        static_assert(isInteger<T>,
+            "Display: %d %i %u %o %x %X need an integer argument");
+    else if constexpr (K == Kind::Char)
+        static_assert(isInteger<T>, "Display: %c needs a character argument");
+    else if constexpr (K == Kind::String)
+        static_assert(isString<T>,
+            "Display: %s needs a char *, std::string or std::string_view");
+    else if constexpr (K == Kind::Float)
+        static_assert(std::is_arithmetic_v<Bare<T>>,
+            "Display: %f %e %g %a need a number");
+    else if constexpr (K == Kind::Pointer)
+        static_assert(isPointer<T>, "Display: %p needs a pointer");
+    return true;
+}
+
+template <class F, class... Args, std::size_t... I>
+constexpr bool checkArguments(std::index_sequence<I...>)
+{
+    return (checkArgument<parsed<F>.args[I], parsed<F>.star[I], Args>() && ...);
+}
+
+template <class F, class... Args>
+constexpr bool check()
+{
+    constexpr const Format &format = parsed<F>;
+    static_assert(format.error != TOO_MANY,
+        "Display: more than 32 conversions in the format");
+    static_assert(format.error != POSITIONAL,
+        "Display: positional arguments (%1$d) are not supported");
+    static_assert(format.error != UNSUPPORTED,
+        "Display: unsupported conversion (%n, wide characters or unknown)");
+    static_assert(format.error != TRUNCATED,
+        "Display: the format ends in the middle of a conversion");
+    if constexpr (format.error == OK)
+    {
+        static_assert(format.argCount == sizeof...(Args),
+            "Display: the number of arguments does not match the format");
+        if constexpr (format.argCount == sizeof...(Args))
+            return checkArguments<F, Args...>(
+                std::index_sequence_for<Args...>());
+    }
+    return true;
+}
+
+// Arguments printf() would read as they are: the type a conversion with
+// `Length` expects once promoted, with no widening or conversion by us.
+template <int Length>
+using SignedOf =
+    std::conditional_t<Length == LEN_L,  long,
+    std::conditional_t<Length == LEN_LL, long long,
+    std::conditional_t<Length == LEN_J,  std::intmax_t,
+    std::conditional_t<Length == LEN_Z,  std::make_signed_t<std::size_t>,
+    std::conditional_t<Length == LEN_T,  std::ptrdiff_t, int>>>>>;
+
+template <class T, bool = std::is_integral_v<T>>
+struct Promoted { using type = void; };
+template <class T>
+struct Promoted<T, true> { using type = decltype(+std::declval<T>()); };
+
+template <class T, class To>
+inline constexpr bool promotesTo =
+    std::is_same_v<typename Promoted<T>::type, To>;
+
+template <Kind K, int Star, int Length, class T>
+constexpr bool passableArgument()
+{
+    using D = std::decay_t<Bare<T>>;
+    if constexpr (Star)
+        return promotesTo<D, int>;
+    else if constexpr (K == Kind::Signed)
+        return promotesTo<D, SignedOf<Length>>;
+    else if constexpr (K == Kind::Unsigned)
+        return promotesTo<D, std::make_unsigned_t<SignedOf<Length>>>;
+    else if constexpr (K == Kind::Char)
+        return promotesTo<D, int>;
+    else if constexpr (K == Kind::String)
+        return std::is_same_v<D, char *> || std::is_same_v<D, const char *>;
+    else if constexpr (K == Kind::Float && Length == LEN_BIGL)
+        return std::is_same_v<D, long double>;
+    else if constexpr (K == Kind::Float)
+        return std::is_same_v<D, double> || std::is_same_v<D, float>;
+    else
+        return std::is_pointer_v<D>;
+}
+
+template <class F, class... Args, std::size_t... I>
+constexpr bool passableArguments(std::index_sequence<I...>)
+{
+    constexpr const Format &format = parsed<F>;
+    return (passableArgument<format.args[I], format.star[I],
+        format.lengths[I], Args>() && ...);
+}
+
+// True if the arguments can go to the C functions with the format as it is.
+template <class F, class... Args>
+constexpr bool passable()
+{
+    if constexpr (parsed<F>.error == OK &&
+                  parsed<F>.argCount == sizeof...(Args))
+        return passableArguments<F, Args...>(
+            std::index_sequence_for<Args...>());
+    else
+        return false;
+}
+
+
+
+// Runtime formatting.
+
+// Message text: on the stack, moving to the heap when it outgrows it.
+class Buffer {
+  public:
+    Buffer() : data_(local_), length_(0), capacity_(sizeof(local_)) {}
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+
+    const char *data() const { return data_; }
+    std::size_t size() const { return length_; }
+
+    // Room for `length` more bytes and a NUL.
+    char *reserve(std::size_t length)
+    {
+        if (length_ + length + 1 > capacity_)
+        {
+            std::size_t capacity = 2 * capacity_;
+            while (capacity < length_ + length + 1) capacity *= 2;
+            std::unique_ptr<char[]> grown(new char[capacity]);
+            std::memcpy(grown.get(), data_, length_);
+            heap_     = std::move(grown);
+            data_     = heap_.get();
+            capacity_ = capacity;
+        }
+        return data_ + length_;
+    }
+    void commit(std::size_t length) { length_ += length; }
+    std::size_t room() const { return capacity_ - length_; }
+
+    void append(const char *text, std::size_t length)
+    {
+        std::memcpy(reserve(length), text, length);
+        length_ += length;
+    }
+
+  private:
+    char                    local_[2 * BUFFLEN];
+    std::unique_ptr<char[]> heap_;
+    char                   *data_;
+    std::size_t             length_;
+    std::size_t             capacity_;
+};
+
+// snprintf() of one conversion, `text`, with its '*' values and argument.
+template <class... Values>
+inline void formatPrintf(Buffer &out, const char *text, Values... values)
+{
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wformat-nonliteral"
+    std::size_t room   = out.room();
+    int         length = std::snprintf(out.reserve(0), room, text, values...);
+    if (length < 0) return;
+    if (static_cast<std::size_t>(length) >= room)
+        std::snprintf(out.reserve(length), length + 1, text, values...);
+    #pragma GCC diagnostic pop
+    out.commit(length);
+}
+
+template <int Stars, class Value>
+inline void formatStars(Buffer &out, const char *text, const int *star,
+    Value value)
+{
+    if constexpr (Stars == 0) formatPrintf(out, text, value);
+    else if constexpr (Stars == 1) formatPrintf(out, text, star[0], value);
+    else formatPrintf(out, text, star[0], star[1], value);
+}
+
+// The text of conversion `S` of `F` for snprintf(), with the length modifier
+// replaced by the one of the value actually passed: `ll` for integers, `L`
+// for long double, none otherwise.
+struct SpecText {
+    char text[48];
+};
+
+template <class F, int S, bool Wide>
+constexpr SpecText specText()
+{
+    constexpr Spec         spec = parsed<F>.specs[S];
+    constexpr std::string_view format = F::text();
+    SpecText    result{};
+    std::size_t length = 0;
+    for (std::size_t i = spec.start; i < spec.lengthStart && length < 44; i++)
+        result.text[length++] = format[i];
+    if constexpr (spec.kind == Kind::Signed || spec.kind == Kind::Unsigned)
+    {
+        result.text[length++] = 'l';
+        result.text[length++] = 'l';
+    }
+    else if constexpr (spec.kind == Kind::Float)
+    {
+        if (Wide) result.text[length++] = 'L';
+    }
+    result.text[length] = spec.conversion;
+    return result;
+}
+
+template <class F, int S, bool Wide>
+inline constexpr SpecText specTextOf = specText<F, S, Wide>();
+
+// Integer conversions: the value as printf would see it, widened.
+template <int Length, class T>
+constexpr long long signedValue(T value)
+{
+    if constexpr (std::is_enum_v<T>)
+        return signedValue<Length>(static_cast<std::underlying_type_t<T>>(value));
+    else if constexpr (Length == LEN_HH) return static_cast<signed char>(value);
+    else if constexpr (Length == LEN_H)  return static_cast<short>(value);
+    else return static_cast<long long>(value);
+}
+
+template <int Length, class T>
+constexpr unsigned long long unsignedValue(T value)
+{
+    if constexpr (std::is_enum_v<T>)
+        return unsignedValue<Length>(
+            static_cast<std::underlying_type_t<T>>(value));
+    else if constexpr (Length == LEN_HH) return static_cast<unsigned char>(value);
+    else if constexpr (Length == LEN_H)  return static_cast<unsigned short>(value);
+    else if constexpr (std::is_same_v<T, bool>) return value;
+    else return static_cast<std::make_unsigned_t<T>>(value);
+}
+
+template <class T>
+inline int starValue(const T &value) { return static_cast<int>(value); }
+
+inline std::string_view stringValue(const char *value)
+{
+    return (value != nullptr) ? std::string_view(value) : "(null)";
+}
+inline std::string_view stringValue(const std::string &value) { return value; }
+inline std::string_view stringValue(std::string_view value) { return value; }
+
+inline void appendInteger(Buffer &out, unsigned long long value, bool negative,
+    int base, bool upper)
+{
+    char *start = out.reserve(24);
+    char *next  = start;
+    if (negative) *next++ = '-';
+    next = std::to_chars(next, start + 24, value, base).ptr;
+    if (upper)
+        for (char *c = start; c < next; c++)
+            if (*c >= 'a' && *c <= 'f') *c = static_cast<char>(*c - 'a' + 'A');
+    out.commit(static_cast<std::size_t>(next - start));
+}
+
+// Conversion `S` of `F` with its '*' values and argument.
+template <class F, int S, class T>
+inline void formatOne(Buffer &out, const int *star, const T &value)
+{
+    constexpr Spec spec  = parsed<F>.specs[S];
+    constexpr int  stars = spec.starWidth + spec.starPrecision;
+
+    if constexpr (spec.kind == Kind::Signed)
+    {
+        long long number = signedValue<spec.length>(value);
+        if constexpr (spec.plain)
+            appendInteger(out, number < 0 ?
+                0ULL - static_cast<unsigned long long>(number) :
+                static_cast<unsigned long long>(number), number < 0, 10, false);
+        else
+            formatStars<stars>(out, specTextOf<F, S, false>.text, star, number);
+    }
+    else if constexpr (spec.kind == Kind::Unsigned)
+    {
+        unsigned long long number = unsignedValue<spec.length>(value);
+        constexpr int base = (spec.conversion == 'u') ? 10 :
+                             (spec.conversion == 'o') ? 8 : 16;
+        if constexpr (spec.plain)
+            appendInteger(out, number, false, base, spec.conversion == 'X');
+        else
+            formatStars<stars>(out, specTextOf<F, S, false>.text, star, number);
+    }
+    else if constexpr (spec.kind == Kind::Char)
+    {
+        int character = static_cast<unsigned char>(value);
+        if constexpr (spec.plain)
+        {
+            char c = static_cast<char>(character);
+            out.append(&c, 1);
+        }
+        else
+            formatStars<stars>(out, specTextOf<F, S, false>.text, star,
+                character);
+    }
+    else if constexpr (spec.kind == Kind::String)
+    {
+        std::string_view text = stringValue(value);
+        if constexpr (spec.plain)
+            out.append(text.data(), text.size());
+        else
+        {
+            std::string copy(text);  // snprintf() needs it terminated
+            formatStars<stars>(out, specTextOf<F, S, false>.text, star,
+                copy.c_str());
+        }
+    }
+    else if constexpr (spec.kind == Kind::Float)
+    {
+        if constexpr (spec.length == LEN_BIGL ||
+                      std::is_same_v<T, long double>)
+            formatStars<stars>(out, specTextOf<F, S, true>.text, star,
+                static_cast<long double>(value));
+        else
+            formatStars<stars>(out, specTextOf<F, S, false>.text, star,
+                static_cast<double>(value));
+    }
+    else if constexpr (spec.kind == Kind::Pointer)
+        formatStars<stars>(out, specTextOf<F, S, false>.text, star,
+            static_cast<const void *>(value));
+}
+
+// Literal text and conversions from conversion `S` on, taking arguments from
+// `A` on.
+template <class F, int S, std::size_t A, class Tuple>
+inline void formatFrom(Buffer &out, const Tuple &args, int error)
+{
+    constexpr const Format &format = parsed<F>;
+    constexpr std::string_view text = F::text();
+    if constexpr (S == format.count)
+        out.append(text.data() + format.tail, text.size() - format.tail);
+    else
+    {
+        constexpr Spec spec = format.specs[S];
+        out.append(text.data() + spec.literal, spec.start - spec.literal);
+
+        int star[2] = { 0, 0 };
+        if constexpr (spec.starWidth)
+            star[0] = starValue(std::get<A>(args));
+        if constexpr (spec.starPrecision)
+            star[spec.starWidth] = starValue(std::get<A + spec.starWidth>(args));
+        constexpr std::size_t value = A + spec.starWidth + spec.starPrecision;
+
+        if constexpr (spec.conversion == '%')
+            out.append("%", 1);
+        else if constexpr (spec.conversion == 'm')
+        {
+            errno = error;  // of the caller, not of earlier conversions
+            formatPrintf(out, specTextOf<F, S, false>.text, 0);
+        }
+        else
+            formatOne<F, S>(out, star, std::get<value>(args));
+
+        formatFrom<F, S + 1, value + (spec.kind != Kind::None)>(out, args,
+            error);
+    }
+}
+
+// The message of call site `F` with `args`.
+template <class F, class... Args>
+inline void format(Buffer &out, const Args &... args)
+{
+    int error = errno;
+    formatFrom<F, 0, 0>(out, std::forward_as_tuple(args...), error);
+}
+
+// Don't call these functions. Use the Display macros instead! Binary output
+// and the history record passable arguments without formatting them; for
+// anything else the message is formatted here and passed on as a string.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat-security"
+template <class F, class... Args>
+inline void print(DisplaySite *site, int type, FILE *fd, const char *color,
+    const Args &... args)
+{
+    static_assert(check<F, Args...>());
+    if constexpr (passable<F, Args...>())
+        if (GetBinaryStream() != nullptr)
+        {
+            __DisplayAt(site, type, fd, color, F::text().data(), args...);
+            return;
+        }
+    Buffer body;
+    format<F>(body, args...);
+    __DisplayAt(site, type, fd, color, "%.*s", static_cast<int>(body.size()),
+        body.data());
+}
+
+template <class F, class... Args>
+inline void remember(DisplaySite *site, const Args &... args)
+{
+    static_assert(check<F, Args...>());
+    if constexpr (passable<F, Args...>())
+        __DisplayRemember(site, F::text().data(), args...);
+    else
+    {
+        Buffer body;
+        format<F>(body, args...);
+        __DisplayRemember(site, "%.*s", static_cast<int>(body.size()),
+            body.data());
+    }
+}
+#pragma GCC diagnostic pop
+
+}  // namespace detail
+}  // namespace display
+
+
+
+// The Display macros, with the format checked and formatted by the functions
+// above. `__DisplayFormat` gives them the format as a constant expression.
+#define __DISPLAY_FORMAT(format) \
+    struct __DisplayFormat { \
+        static constexpr std::string_view text() { return format; } \
+    }
+
+#undef __DISPLAY_CALL
+#define __DISPLAY_CALL(level, condition, type, fd, color, format, ...) do { \
+    __DISPLAY_FORMAT(format); \
+    __DISPLAY_SITE(__displaySite, level, format); \
+    if ((condition) && __DISPLAY_ENABLED(__displaySite)) \
+        ::display::detail::print<__DisplayFormat>(&__displaySite, type, fd, \
+            color, ##__VA_ARGS__); \
+    else if (__builtin_expect( \
+                 __atomic_load_n(&__displayHistory, __ATOMIC_RELAXED), 0)) \
+        ::display::detail::remember<__DisplayFormat>(&__displaySite, \
+            ##__VA_ARGS__); \
+} while (0)
+
+#undef __DISPLAY_LIMITED
+#define __DISPLAY_LIMITED(allow, format, ...) do { \
+    __DISPLAY_FORMAT(format); \
+    __DISPLAY_SITE(__displaySite, LEVEL_STANDARD, format); \
+    if (verbose && __DISPLAY_ENABLED(__displaySite)) \
+    { \
+        if (allow) \
+            ::display::detail::print<__DisplayFormat>(&__displaySite, \
+                STANDARD, NULL, RESET, ##__VA_ARGS__); \
+        else \
+            __atomic_add_fetch(&__displaySite.suppressed, 1, \
+                __ATOMIC_RELAXED); \
+    } \
+} while (0)
+
+#endif  // end of include guard
@@ -0,0 +1,505 @@
+#include "DisplayPrivate.h"
+
+#include <sched.h>
+#include <stdint.h>
+#include <errno.h>
+
+// Asynchronous output. Every producer thread formats its records into its own
+// single-producer/single-consumer ring, so Display() calls never touch the
+// console mutex. A dedicated writer thread drains all rings to their streams.
+//
+// Records are variable length and aligned to RECORD_ALIGN bytes. A record that
+// would straddle the end of the ring is preceded by a padding record (stream
+// NULL) that fills the remaining space, so payloads are always contiguous.
+
+#define RECORD_ALIGN     16
+#define MIN_RING_SIZE    4096
+#define IDLE_WAIT_NSEC   10000000  // writer re-checks the rings every 10ms
+#define FLUSH_POLL_USEC  100       // DisplayFlush() polling interval
+#define MAX_DIRTY        8         // streams remembered for the idle fflush()
+
+struct RecordHeader {
+    uint32_t  size;    // total bytes occupied in the ring, header included
+    uint32_t  length;  // payload bytes following the header
+    FILE     *stream;  // destination, NULL for padding
+};
+
+struct AsyncRing {
+    unsigned char    *data;
+    size_t            capacity;  // power of two
+    int               orphaned;  // owning thread has exited
+    struct AsyncRing *next;
+
+    // Producer and consumer indices live on separate cache lines. Both only
+    // ever increase; the byte offset is `index & (capacity-1)`.
+    size_t head __attribute__((aligned(64)));
+    size_t tail __attribute__((aligned(64)));
+};
+
+// Variables
+int                  asyncMode     = DISABLE;  // Display() hands off to writer
+static int           backpressure  = BLOCK;    // what to do when a ring is full
+static size_t        ringSize      = 65536;    // bytes per thread ring
+static unsigned long droppedCount  = 0;        // records lost to backpressure
+
+static struct AsyncRing *rings;         // every registered ring
+static pthread_mutex_t   ringListLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t     ringKey;       // marks a ring orphaned on thread exit
+static pthread_once_t    ringKeyOnce  = PTHREAD_ONCE_INIT;
+static __thread struct AsyncRing *localRing;
+
+static pthread_t       writer;
+static pthread_mutex_t writerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  writerWake = PTHREAD_COND_INITIALIZER;
+static int             writerSleeping;  // writer is (about to be) waiting
+static int             writerBusy;      // writer holds popped records
+static int             writerStop;      // ask writer to drain and exit
+static int             pushing;         // producers inside asyncPush()
+
+
+
+// Choose how producers behave when their ring is full. Blocking is default.
+int GetAsyncBackpressure() { return backpressure; }
+int SetAsyncBackpressure(int b)
+{
+    if (b == BLOCK || b == DROP_NEWEST || b == DROP_OLDEST)
+        __atomic_store_n(&backpressure, b, __ATOMIC_RELAXED);
+    else
+    {
+        fprintf(stderr, "ERROR: Invalid backpressure value.\n");
+        exit(1);
+    }
+    return 0;
+}
+
+
+// Set the per-thread ring size. Rounded up to a power of two, and only applies
+// to rings created after the call (i.e. threads that have not logged yet).
+size_t GetAsyncRingSize() { return ringSize; }
+int SetAsyncRingSize(size_t bytes)
+{
+    size_t size = MIN_RING_SIZE;
+    while (size < bytes) size <<= 1;
+    ringSize = size;
+    return 0;
+}
+
+
+// Number of records discarded by DROP_NEWEST or DROP_OLDEST.
+unsigned long GetAsyncDropped()
+{
+    return __atomic_load_n(&droppedCount, __ATOMIC_RELAXED);
+}
+
+
+
+static void ringOrphan(void *ring)
+{
+    __atomic_store_n(&((struct AsyncRing *)ring)->orphaned, 1, __ATOMIC_RELEASE);
+}
+
+static void ringKeyCreate() { pthread_key_create(&ringKey, ringOrphan); }
+
+// Allocate and register the calling thread's ring.
+static struct AsyncRing *ringCreate()
+{
+    struct AsyncRing *ring = calloc(1, sizeof(*ring));
+    if (ring == NULL) return NULL;
+    ring->capacity = ringSize;
+    ring->data     = malloc(ring->capacity);
+    if (ring->data == NULL)
+    {
+        free(ring);
+        return NULL;
+    }
+
+    pthread_once(&ringKeyOnce, ringKeyCreate);
+    pthread_setspecific(ringKey, ring);
+
+    pthread_mutex_lock(&ringListLock);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&ringListLock);
+    return ring;
+}
+
+static inline size_t recordSize(size_t length)
+{
+    size_t size = sizeof(struct RecordHeader) + length;
+    return (size + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+}
+
+static void writerSignal()
+{
+    pthread_mutex_lock(&writerLock);
+    pthread_cond_signal(&writerWake);
+    pthread_mutex_unlock(&writerLock);
+}
+
+// Discard the oldest record in `ring`. Only used with DROP_OLDEST, where the
+// producer and the writer both advance `tail` with compare-and-swap.
+static void ringDropOldest(struct AsyncRing *ring)
+{
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    if (tail == head) return;
+
+    struct RecordHeader header;
+    memcpy(&header, ring->data + (tail & (ring->capacity - 1)), sizeof(header));
+    if (__atomic_compare_exchange_n(&ring->tail, &tail, tail + header.size, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) && header.stream != NULL)
+        __atomic_add_fetch(&droppedCount, 1, __ATOMIC_RELAXED);
+}
+
+// Queue a record in the calling thread's ring.
+static void ringPush(FILE *stream, const char *buffer, size_t length)
+{
+    struct AsyncRing *ring = localRing;
+    if (ring == NULL && (ring = localRing = ringCreate()) == NULL)
+    {
+        // Out of memory: fall back to a synchronous write.
+        dlockedWrite(stream, buffer, length);
+        return;
+    }
+
+    size_t need = recordSize(length);
+    if (need > ring->capacity / 2)
+    {
+        // Too large to ever queue. Keep ordering with this thread's earlier
+        // records by draining them first.
+        asyncFlush();
+        dlockedWrite(stream, buffer, length);
+        return;
+    }
+
+    size_t mask = ring->capacity - 1;
+    size_t head = ring->head;
+    for (;;)
+    {
+        size_t tail  = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        size_t room  = ring->capacity - (head & mask);
+        size_t total = need + (room < need ? room : 0);
+        if (ring->capacity - (head - tail) >= total)
+            break;
+
+        int policy = __atomic_load_n(&backpressure, __ATOMIC_RELAXED);
+        if (policy == DROP_NEWEST)
+        {
+            __atomic_add_fetch(&droppedCount, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        if (policy == DROP_OLDEST)
+            ringDropOldest(ring);
+        else
+        {
+            writerSignal();
+            sched_yield();
+        }
+    }
+
+    struct RecordHeader header;
+    size_t room = ring->capacity - (head & mask);
+    if (room < need)
+    {
+        header.size   = room;
+        header.length = 0;
+        header.stream = NULL;
+        memcpy(ring->data + (head & mask), &header, sizeof(header));
+        head += room;
+    }
+    header.size   = need;
+    header.length = length;
+    header.stream = stream;
+    memcpy(ring->data + (head & mask), &header, sizeof(header));
+    memcpy(ring->data + (head & mask) + sizeof(header), buffer, length);
+    __atomic_store_n(&ring->head, head + need, __ATOMIC_RELEASE);
+
+    // Pairs with the writer publishing `writerSleeping` before its final check
+    // of the rings, so one side always sees the other.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&writerSleeping, __ATOMIC_RELAXED))
+        writerSignal();
+}
+
+// Hand a fully formatted record to the writer thread.
+void asyncPush(FILE *stream, const char *buffer, size_t length)
+{
+    // asyncStop() waits for producers already past this point before it
+    // stops the writer; later ones write synchronously.
+    __atomic_add_fetch(&pushing, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&asyncMode, __ATOMIC_SEQ_CST))
+    {
+        __atomic_sub_fetch(&pushing, 1, __ATOMIC_RELEASE);
+        dlockedWrite(stream, buffer, length);
+        return;
+    }
+    ringPush(stream, buffer, length);
+    __atomic_sub_fetch(&pushing, 1, __ATOMIC_RELEASE);
+}
+
+
+
+// Remember streams written since the writer was last idle.
+static void markDirty(FILE **dirty, int *count, FILE *stream)
+{
+    for (int i = 0; i < *count; i++)
+        if (dirty[i] == stream) return;
+    if (*count < MAX_DIRTY)
+        dirty[(*count)++] = stream;
+    else
+        fflush(stream);
+}
+
+// Write out everything currently queued in `ring`. Returns records written.
+static int ringDrain(struct AsyncRing *ring, unsigned char *scratch,
+    size_t scratchSize, FILE **dirty, int *dirtyCount)
+{
+    size_t mask    = ring->capacity - 1;
+    int    written = 0;
+
+    for (;;)
+    {
+        size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail == head) break;
+
+        struct RecordHeader header;
+        memcpy(&header, ring->data + (tail & mask), sizeof(header));
+
+        if (__atomic_load_n(&backpressure, __ATOMIC_RELAXED) != DROP_OLDEST)
+        {
+            // Only this thread moves `tail`, so the record is stable. The
+            // stream's lock keeps it out of a DisplayLock() group.
+            if (header.stream != NULL)
+            {
+                dlockedWrite(header.stream, (char *)ring->data + (tail & mask)
+                    + sizeof(header), header.length);
+                markDirty(dirty, dirtyCount, header.stream);
+                written++;
+            }
+            __atomic_store_n(&ring->tail, tail + header.size, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        // The producer may discard the record under us: copy it out first and
+        // only use the copy if the tail did not move in the meantime.
+        if (header.size < sizeof(header) || header.size > ring->capacity ||
+            header.length > header.size - sizeof(header))
+            continue;
+        if (header.length > scratchSize)
+        {
+            // No memory for a copy: drop it, as the policy allows.
+            if (__atomic_compare_exchange_n(&ring->tail, &tail,
+                    tail + header.size, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+                && header.stream != NULL)
+                __atomic_add_fetch(&droppedCount, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        memcpy(scratch, ring->data + (tail & mask) + sizeof(header),
+            header.length);
+        if (!__atomic_compare_exchange_n(&ring->tail, &tail, tail + header.size,
+                0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            continue;
+        if (header.stream != NULL)
+        {
+            dlockedWrite(header.stream, (char *)scratch, header.length);
+            markDirty(dirty, dirtyCount, header.stream);
+            written++;
+        }
+    }
+    return written;
+}
+
+// True if any ring holds unwritten records.
+static int ringsPending()
+{
+    int pending = 0;
+    pthread_mutex_lock(&ringListLock);
+    for (struct AsyncRing *ring = rings; ring != NULL && !pending; ring = ring->next)
+        pending = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) !=
+                  __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    pthread_mutex_unlock(&ringListLock);
+    return pending;
+}
+
+// Free rings whose threads have exited and whose contents have been written.
+static void ringsReap()
+{
+    pthread_mutex_lock(&ringListLock);
+    struct AsyncRing **link = &rings;
+    while (*link != NULL)
+    {
+        struct AsyncRing *ring = *link;
+        if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) ==
+            __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+        {
+            *link = ring->next;
+            free(ring->data);
+            free(ring);
+        }
+        else
+            link = &ring->next;
+    }
+    pthread_mutex_unlock(&ringListLock);
+}
+
+static void *writerMain(void *unused)
+{
+    (void)unused;
+    unsigned char *scratch = malloc(ringSize);
+    size_t scratchSize = (scratch != NULL) ? ringSize : 0;
+    FILE *dirty[MAX_DIRTY];
+    int dirtyCount = 0;
+
+    for (;;)
+    {
+        __atomic_store_n(&writerBusy, 1, __ATOMIC_SEQ_CST);
+        int written = 0;
+
+        // Rings are only unlinked by this thread, so walking the list without
+        // the lock is safe; new rings are pushed at the head.
+        pthread_mutex_lock(&ringListLock);
+        struct AsyncRing *ring = rings;
+        pthread_mutex_unlock(&ringListLock);
+        for (; ring != NULL; ring = ring->next)
+        {
+            // Keep the old buffer if a larger one cannot be had.
+            unsigned char *larger;
+            if (ring->capacity > scratchSize &&
+                (larger = malloc(ring->capacity)) != NULL)
+            {
+                free(scratch);
+                scratch     = larger;
+                scratchSize = ring->capacity;
+            }
+            written += ringDrain(ring, scratch, scratchSize, dirty, &dirtyCount);
+        }
+
+        if (written > 0) continue;
+
+        // Idle: push buffered output out before going to sleep.
+        for (int i = 0; i < dirtyCount; i++)
+            fflush(dirty[i]);
+        dirtyCount = 0;
+        ringsReap();
+        __atomic_store_n(&writerBusy, 0, __ATOMIC_SEQ_CST);
+
+        pthread_mutex_lock(&writerLock);
+        __atomic_store_n(&writerSleeping, 1, __ATOMIC_SEQ_CST);
+        if (!ringsPending())
+        {
+            if (__atomic_load_n(&writerStop, __ATOMIC_ACQUIRE))
+            {
+                pthread_mutex_unlock(&writerLock);
+                break;
+            }
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += IDLE_WAIT_NSEC;
+            if (deadline.tv_nsec >= 1000000000L)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&writerWake, &writerLock, &deadline);
+        }
+        __atomic_store_n(&writerSleeping, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&writerLock);
+    }
+
+    free(scratch);
+    return NULL;
+}
+
+
+
+// Switch asynchronous mode on or off. Turning it off drains and joins the
+// writer thread.
+int GetAsync() { return asyncMode; }
+int SetAsync(int a)
+{
+    if (a != ENABLE && a != DISABLE)
+    {
+        fprintf(stderr, "ERROR: Invalid async value.\n");
+        exit(1);
+    }
+    if (a == asyncMode) return 0;
+
+    if (a == ENABLE)
+    {
+        __atomic_store_n(&writerStop, 0, __ATOMIC_RELEASE);
+        if (pthread_create(&writer, NULL, writerMain, NULL) != 0)
+            return -1;
+        __atomic_store_n(&asyncMode, ENABLE, __ATOMIC_RELEASE);
+    }
+    else
+        asyncStop();
+    return 0;
+}
+
+// Stop accepting records, write out everything queued and join the writer.
+void asyncStop()
+{
+    if (!asyncMode) return;
+    __atomic_store_n(&asyncMode, DISABLE, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&pushing, __ATOMIC_ACQUIRE) > 0)
+        sched_yield();
+    __atomic_store_n(&writerStop, 1, __ATOMIC_RELEASE);
+    writerSignal();
+    pthread_join(writer, NULL);
+}
+
+// Wait until the writer has written everything queued so far. A thread inside
+// DisplayLock() does not wait: the writer may be waiting for its locks.
+void asyncFlush()
+{
+    if (!__atomic_load_n(&asyncMode, __ATOMIC_ACQUIRE) || displayLocked())
+        return;
+    while (ringsPending() || __atomic_load_n(&writerBusy, __ATOMIC_SEQ_CST))
+    {
+        writerSignal();
+        usleep(FLUSH_POLL_USEC);
+    }
+}
+
+// Block until the writer has written everything queued so far.
+int DisplayFlush()
+{
+    if (coalesceOn()) coalesceFlush();
+    asyncFlush();
+    buffersFlush();
+    for (int i = STANDARD; i <= ERROR; i++)
+        if (streams[i] != NULL) fflush(streams[i]);
+    return 0;
+}
+
+
+// Write out every queued record with write(2), for the crash handler. Takes
+// no lock and changes nothing, so records the writer thread is handling at
+// the same moment may come out twice.
+void asyncCrashDrain()
+{
+    if (!__atomic_load_n(&asyncMode, __ATOMIC_ACQUIRE)) return;
+    for (struct AsyncRing *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+         ring != NULL; ring = ring->next)
+    {
+        size_t mask = ring->capacity - 1;
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        while (tail != head)
+        {
+            struct RecordHeader header;
+            memcpy(&header, ring->data + (tail & mask), sizeof(header));
+            if (header.size < sizeof(header) || header.size > head - tail)
+                break;  // overwritten under us
+            if (header.stream != NULL)
+            {
+                crashFlushStream(header.stream);
+                crashWrite(fileno(header.stream), (char *)ring->data +
+                    (tail & mask) + sizeof(header), header.length);
+            }
+            tail += header.size;
+        }
+    }
+}
@@ -0,0 +1,461 @@
+#include "DisplayPrivate.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Deferred-formatting binary output. Instead of running vsnprintf() on the
+// caller's thread, a message is stored as its call-site id, timestamp and raw
+// argument bytes. The format string, file and function of each call site are
+// written once, when the site is first used, and display-decode reassembles
+// the text offline. See DisplayPrivate.h for the stream layout.
+
+#define MAX_SITE_ARGS  32    // arguments (including '*') a deferred site may take
+
+// What we know about a call site once it has been registered.
+struct BinarySite {
+    struct DisplaySite *site;
+    uint32_t            id;
+    const char         *format;    // format the site was registered with
+    int                 deferred;  // arguments can be captured raw
+    int                 count;
+    unsigned char       arg[MAX_SITE_ARGS];     // FormatArg per argument
+    unsigned char       length[MAX_SITE_ARGS];  // FormatLength per argument
+    int                 limit[MAX_SITE_ARGS];   // %s precision, -1 none, -2 '*'
+    struct BinarySite  *next;
+};
+
+// Bytes gathered under binaryLock, written once it is released: writing takes
+// a stream lock, which a thread inside DisplayLock() holds while it may be
+// waiting for binaryLock to register a site.
+struct Pending {
+    char   *data;
+    size_t  length;
+    size_t  capacity;
+    int     failed;  // out of memory, the contents are incomplete
+};
+
+// Variables
+FILE                     *binaryStream;  // NULL in text mode
+static struct BinarySite *binarySites;   // every registered site
+static uint32_t           nextSiteId = 1;
+static pthread_mutex_t    binaryLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+static void putU8(struct DisplayRecord *record, uint8_t value)
+{
+    recordAppend(record, (const char *)&value, sizeof(value));
+}
+
+static void putU16(struct DisplayRecord *record, uint16_t value)
+{
+    recordAppend(record, (const char *)&value, sizeof(value));
+}
+
+static void putU32(struct DisplayRecord *record, uint32_t value)
+{
+    recordAppend(record, (const char *)&value, sizeof(value));
+}
+
+static void putU64(struct DisplayRecord *record, uint64_t value)
+{
+    recordAppend(record, (const char *)&value, sizeof(value));
+}
+
+static int recordFits(struct DisplayRecord *record, size_t bytes)
+{
+    return record->length + bytes <= record->capacity;
+}
+
+
+static void pendingAppend(struct Pending *pending, const char *data,
+    size_t length)
+{
+    if (pending->failed) return;
+    if (pending->length + length > pending->capacity)
+    {
+        size_t capacity = (pending->capacity > 0) ? 2 * pending->capacity : 4096;
+        while (capacity < pending->length + length) capacity *= 2;
+        char *grown = realloc(pending->data, capacity);
+        if (grown == NULL)
+        {
+            pending->failed = 1;
+            return;
+        }
+        pending->data     = grown;
+        pending->capacity = capacity;
+    }
+    memcpy(pending->data + pending->length, data, length);
+    pending->length += length;
+}
+
+// Write out and release what was gathered, once binaryLock is released. A
+// header (`locked`) bypasses the asynchronous queue.
+static void pendingWrite(struct Pending *pending, FILE *stream, int locked)
+{
+    if (stream != NULL && pending->length > 0 && !pending->failed)
+    {
+        if (locked) dlockedWrite(stream, pending->data, pending->length);
+        else        dsubmit(stream, pending->data, pending->length);
+    }
+    free(pending->data);
+}
+
+// Gather the definition of `binary`. Called with binaryLock held.
+static void binaryDefine(const struct BinarySite *binary,
+    struct Pending *pending)
+{
+    char                 storage[32];
+    struct DisplayRecord record;
+    struct DisplaySite  *site = binary->site;
+    size_t fileLength     = strlen(site->file);
+    size_t functionLength = strlen(site->function);
+    size_t formatLength   = strlen(binary->format);
+
+    if (fileLength > UINT16_MAX)     fileLength = UINT16_MAX;
+    if (functionLength > UINT16_MAX) functionLength = UINT16_MAX;
+
+    recordInit(&record, storage, sizeof(storage));
+    putU8(&record, TAG_SITE);
+    putU32(&record, binary->id);
+    putU32(&record, (uint32_t)site->line);
+    putU16(&record, (uint16_t)fileLength);
+    putU16(&record, (uint16_t)functionLength);
+    putU32(&record, (uint32_t)formatLength);
+    pendingAppend(pending, record.data, record.length);
+    pendingAppend(pending, site->file, fileLength);
+    pendingAppend(pending, site->function, functionLength);
+    pendingAppend(pending, binary->format, formatLength);
+}
+
+// Gather the definitions of every site registered since id `from`. Called
+// with binaryLock held.
+static void binaryDefineFrom(uint32_t from, struct Pending *pending)
+{
+    for (struct BinarySite *binary = binarySites;
+         binary != NULL && binary->id >= from; binary = binary->next)
+        binaryDefine(binary, pending);
+}
+
+
+// Parse the format of a site the first time it is used and publish its
+// definition. Returns NULL if out of memory.
+static struct BinarySite *binaryRegister(struct DisplaySite *site,
+    const char *format)
+{
+    pthread_mutex_lock(&binaryLock);
+
+    struct BinarySite *binary = site->binary;
+    if (binary != NULL)
+    {
+        pthread_mutex_unlock(&binaryLock);
+        return binary;  // another thread won the race
+    }
+
+    binary = calloc(1, sizeof(*binary));
+    if (binary == NULL)
+    {
+        pthread_mutex_unlock(&binaryLock);
+        return NULL;
+    }
+    binary->site     = site;
+    binary->id       = nextSiteId++;
+    binary->format   = format;
+    binary->deferred = 1;
+
+    const char        *cursor = format;
+    struct FormatSpec  spec;
+    while (binary->deferred && formatNext(&cursor, &spec))
+    {
+        int needed = 1 + spec.starWidth + spec.starPrecision;
+        if (spec.arg == ARG_UNSUPPORTED || binary->count + needed > MAX_SITE_ARGS)
+        {
+            binary->deferred = 0;
+            break;
+        }
+        if (spec.starWidth || spec.starPrecision)
+        {
+            for (int i = 0; i < spec.starWidth + spec.starPrecision; i++)
+            {
+                binary->arg[binary->count]   = ARG_INT;
+                binary->limit[binary->count] = -1;
+                binary->count++;
+            }
+        }
+
+        int limit = -1;
+        if (spec.arg == ARG_STRING)
+        {
+            const char *dot = memchr(spec.start, '.', spec.lengthStart - spec.start);
+            if (dot != NULL)
+                limit = spec.starPrecision ? -2 : atoi(dot + 1);
+        }
+        binary->arg[binary->count]    = spec.arg;
+        binary->length[binary->count] = spec.length;
+        binary->limit[binary->count]  = limit;
+        binary->count++;
+    }
+
+    binary->next = binarySites;
+    binarySites  = binary;
+    struct Pending definition = { 0 };
+    FILE          *stream     = binaryStream;
+    if (stream != NULL)
+        binaryDefine(binary, &definition);
+
+    __atomic_store_n(&site->binary, binary, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&binaryLock);
+    pendingWrite(&definition, stream, 0);
+    return binary;
+}
+
+
+// Append the raw arguments of a deferred site. Returns 0 if they do not fit.
+static int binaryPackArgs(struct DisplayRecord *record,
+    const struct BinarySite *binary, va_list args)
+{
+    int lastInt = 0;  // most recent '*' value, for "%.*s"
+
+    for (int i = 0; i < binary->count; i++)
+    {
+        switch (binary->arg[i])
+        {
+            case ARG_INT:
+            {
+                int32_t value = va_arg(args, int);
+                if (!recordFits(record, sizeof(value))) return 0;
+                putU32(record, (uint32_t)value);
+                lastInt = value;
+                break;
+            }
+            case ARG_WIDE:
+            {
+                uint64_t value;
+                switch (binary->length[i])
+                {
+                    case LEN_L:  value = (uint64_t)va_arg(args, long);      break;
+                    case LEN_J:  value = (uint64_t)va_arg(args, intmax_t);  break;
+                    case LEN_Z:  value = (uint64_t)va_arg(args, size_t);    break;
+                    case LEN_T:  value = (uint64_t)va_arg(args, ptrdiff_t); break;
+                    default:     value = (uint64_t)va_arg(args, long long); break;
+                }
+                if (!recordFits(record, sizeof(value))) return 0;
+                putU64(record, value);
+                break;
+            }
+            case ARG_DOUBLE:
+            {
+                double value = va_arg(args, double);
+                if (!recordFits(record, sizeof(value))) return 0;
+                recordAppend(record, (const char *)&value, sizeof(value));
+                break;
+            }
+            case ARG_LDOUBLE:
+            {
+                long double value = va_arg(args, long double);
+                if (!recordFits(record, sizeof(value))) return 0;
+                recordAppend(record, (const char *)&value, sizeof(value));
+                break;
+            }
+            case ARG_POINTER:
+            {
+                uint64_t value = (uintptr_t)va_arg(args, void *);
+                if (!recordFits(record, sizeof(value))) return 0;
+                putU64(record, value);
+                break;
+            }
+            case ARG_STRING:
+            {
+                const char *value = va_arg(args, const char *);
+                if (value == NULL)
+                {
+                    if (!recordFits(record, sizeof(uint32_t))) return 0;
+                    putU32(record, BINARY_NULL);
+                    break;
+                }
+
+                // Honour "%.Ns" so unterminated buffers are not over-read.
+                int    limit  = (binary->limit[i] == -2) ? lastInt : binary->limit[i];
+                size_t length = (limit >= 0) ? strnlen(value, limit) : strlen(value);
+                if (!recordFits(record, sizeof(uint32_t) + length)) return 0;
+                putU32(record, (uint32_t)length);
+                recordAppend(record, value, length);
+                break;
+            }
+        }
+    }
+    return 1;
+}
+
+
+// Append the raw arguments of a message from `site` to `record`, laid out as
+// in a binary message, for the flight recorder. Returns 0 if the site cannot
+// be deferred or the arguments do not fit; `record` is then incomplete.
+int binaryCapture(struct DisplayRecord *record, struct DisplaySite *site,
+    const char *format, va_list args)
+{
+    struct BinarySite *binary = __atomic_load_n(&site->binary,
+        __ATOMIC_ACQUIRE);
+    if (binary == NULL && (binary = binaryRegister(site, format)) == NULL)
+        return 0;
+    if (!binary->deferred || binary->format != format) return 0;
+
+    va_list copy;
+    va_copy(copy, args);
+    int fits = binaryPackArgs(record, binary, copy);
+    va_end(copy);
+    return fits;
+}
+
+
+static struct BinarySite *binaryLookup(struct DisplaySite *site,
+    const char *format)
+{
+    if (site == NULL) return NULL;
+    struct BinarySite *binary = __atomic_load_n(&site->binary,
+        __ATOMIC_ACQUIRE);
+    return (binary != NULL) ? binary : binaryRegister(site, format);
+}
+
+// Start a TAG_TEXT record in `record`. Returns where its text length goes,
+// to be filled in once the text that follows is appended.
+static size_t textHeader(struct DisplayRecord *record,
+    const struct BinarySite *binary, const char *function, int level,
+    long long now)
+{
+    size_t functionLength = strlen(function);
+    if (functionLength > UINT16_MAX) functionLength = UINT16_MAX;
+    putU8(record, TAG_TEXT);
+    putU32(record, binary != NULL ? binary->id : 0);
+    putU8(record, (uint8_t)level);
+    putU64(record, (uint64_t)now);
+    putU16(record, (uint16_t)functionLength);
+    size_t lengthAt = record->length;
+    putU32(record, 0);
+    recordAppend(record, function, functionLength);
+    return lengthAt;
+}
+
+static void textLength(struct DisplayRecord *record, size_t lengthAt,
+    size_t start)
+{
+    uint32_t length = (uint32_t)(record->length - start);
+    memcpy(record->data + lengthAt, &length, sizeof(length));
+}
+
+
+// Write one message in binary form. `site` is NULL for calls made through
+// the legacy __Display() entry point.
+void binaryWrite(struct DisplaySite *site, const char *function, int level,
+    const char *format, va_list args)
+{
+    FILE     *stream = __atomic_load_n(&binaryStream, __ATOMIC_ACQUIRE);
+    long long now    = timestampNow();
+
+    struct BinarySite *binary = binaryLookup(site, format);
+
+    char                 storage[RECORD_SIZE];
+    struct DisplayRecord record;
+    recordInit(&record, storage, sizeof(storage));
+
+    // A site reused with a different (non-literal) format cannot be deferred.
+    if (binary != NULL && binary->deferred && binary->format == format)
+    {
+        va_list copy;
+        va_copy(copy, args);
+        putU8(&record, TAG_MESSAGE);
+        putU32(&record, binary->id);
+        putU8(&record, (uint8_t)level);
+        putU64(&record, (uint64_t)now);
+        putU32(&record, 0);  // argument length, patched below
+        size_t start = record.length;
+        int    fits  = binaryPackArgs(&record, binary, copy);
+        va_end(copy);
+
+        if (fits)
+        {
+            uint32_t length = (uint32_t)(record.length - start);
+            memcpy(record.data + start - sizeof(length), &length, sizeof(length));
+            dsubmit(stream, record.data, record.length);
+            return;
+        }
+        recordInit(&record, storage, sizeof(storage));
+    }
+
+    // Format now and store the text.
+    size_t lengthAt = textHeader(&record, binary, function, level, now);
+    size_t start    = record.length;
+    recordVappendf(&record, recordLimit(), format, args);
+    textLength(&record, lengthAt, start);
+    dsubmit(stream, record.data, record.length);
+    recordDone(&record);
+}
+
+// Start a message that is written as text, such as one with fields or a dump,
+// which are never deferred: its text is appended to `record` after this, then
+// binaryTextSubmit() writes it. Returns where its length goes.
+size_t binaryTextStart(struct DisplayRecord *record, struct DisplaySite *site,
+    const char *function, int level, const char *format)
+{
+    return textHeader(record, binaryLookup(site, format), function, level,
+        timestampNow());
+}
+
+// Write a record started by binaryTextStart(), whose text begins at `start`.
+void binaryTextSubmit(struct DisplayRecord *record, size_t lengthAt,
+    size_t start)
+{
+    textLength(record, lengthAt, start);
+    dsubmit(__atomic_load_n(&binaryStream, __ATOMIC_ACQUIRE), record->data,
+        record->length);
+}
+
+
+
+// Switch between binary and text output. Starting a binary stream writes the
+// stream header and the definitions of all call sites seen so far.
+FILE *GetBinaryStream() { return binaryStream; }
+int SetBinaryStream(FILE *newStream)
+{
+    pthread_mutex_lock(&binaryLock);
+    __atomic_store_n(&binaryStream, NULL, __ATOMIC_RELEASE);
+
+    struct Pending start = { 0 };
+    uint32_t       from  = nextSiteId;
+    if (newStream != NULL)
+    {
+        char                 storage[RECORD_SIZE];
+        struct DisplayRecord record;
+        size_t fileLength = strlen(file);
+
+        recordInit(&record, storage, sizeof(storage));
+        recordAppend(&record, BINARY_MAGIC, strlen(BINARY_MAGIC));
+        putU32(&record, BINARY_ENDIAN);
+        putU8(&record, BINARY_VERSION);
+        putU8(&record, (uint8_t)GetTimestampPrecision());
+        putU16(&record, (uint16_t)fileLength);
+        recordAppend(&record, file, fileLength);
+        pendingAppend(&start, record.data, record.length);
+        binaryDefineFrom(0, &start);
+    }
+    pthread_mutex_unlock(&binaryLock);
+
+    // Records queued for the previous stream must be written before the
+    // caller can close it.
+    if (asyncMode) DisplayFlush();
+    if (newStream == NULL) return 0;
+
+    // The header must come first, so it bypasses the asynchronous queue and
+    // is written before any other thread can see the new stream. Sites first
+    // used meanwhile saw no stream; their definitions follow, and the decoder
+    // reads definitions before messages wherever they are.
+    pendingWrite(&start, newStream, 1);
+
+    struct Pending late = { 0 };
+    pthread_mutex_lock(&binaryLock);
+    __atomic_store_n(&binaryStream, newStream, __ATOMIC_RELEASE);
+    binaryDefineFrom(from, &late);
+    pthread_mutex_unlock(&binaryLock);
+    pendingWrite(&late, newStream, 0);
+    return 0;
+}
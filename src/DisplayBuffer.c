@@ -0,0 +1,349 @@
+#include "DisplayPrivate.h"
+
+#include <errno.h>
+#include <semaphore.h>
+#include <sys/uio.h>
+
+// Explicit buffering of the PrintType streams. With a policy other than
+// STDIO_BUFFERED, records bypass the FILE's stdio buffer and go straight to
+// its file descriptor.
+//
+// Writes are group-committed. Producers copy their record into the pending
+// buffer under a short lock. When a commit is due, the first producer to
+// notice becomes the leader: it takes the pending buffer (swapping in the
+// spare) and writes it, together with its own record, in a single writev(2)
+// with the lock released. Producers arriving meanwhile append to the new
+// pending buffer and ask the leader to go round again, so under load the
+// number of system calls follows the number of batches, not lines.
+//
+// A background thread commits batches whose oldest byte is older than the
+// latency limit.
+
+#define BUFFER_DEFAULT_BYTES  65536  // BATCHED size threshold if 0 is given
+#define BUFFER_DEFAULT_MSEC   50     // BATCHED latency limit if 0 is given
+#define BUFFER_IDLE_MSEC      1000   // flusher check when nothing is batched
+#define NSEC_PER_MSEC         1000000LL
+
+struct StreamBuffer {
+    pthread_mutex_t lock;
+    pthread_cond_t  committed;  // a commit finished
+    int             policy;
+    int             fd;         // where the pending bytes go
+    size_t          limit;      // BATCHED: commit at this many pending bytes
+    long long       latency;    // BATCHED: commit bytes older than this (ns)
+    char           *pending;    // bytes not written yet
+    char           *spare;      // written by the leader, outside the lock
+    size_t          length;     // of `pending`
+    size_t          capacity;   // of `pending` and `spare`
+    long long       oldest;     // when `pending` got its first byte
+    int             committing; // a leader is writing
+    int             again;      // a commit was asked for during the last one
+};
+
+// Variables
+static struct StreamBuffer buffers[3] = {
+    [0 ... 2] = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                  STDIO_BUFFERED, -1, 0, 0, NULL, NULL, 0, 0, 0, 0, 0 }
+};
+static pthread_mutex_t flusherLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t       flusherThread;
+static sem_t           flusherWake;
+static int             flusherRunning;
+static int             flusherStop;
+
+
+
+// Write every byte of `vector`, retrying after interruptions and short writes.
+static void writeAll(int fd, struct iovec *vector, int count)
+{
+    long long start = statsOn() ? statsClock() : 0;
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, vector, count);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) break;
+        while (count > 0 && (size_t)written >= vector->iov_len)
+        {
+            written -= (ssize_t)vector->iov_len;
+            vector++;
+            count--;
+        }
+        if (count > 0)
+        {
+            vector->iov_base = (char *)vector->iov_base + written;
+            vector->iov_len -= (size_t)written;
+        }
+    }
+    if (start != 0) statsWrite(statsClock() - start);
+}
+
+// Write out the pending bytes, and `record` after them, as the leader. Called
+// with the lock held and no commit running; returns with the lock held. Keeps
+// going while other producers ask for another commit.
+static void bufferCommit(struct StreamBuffer *buffer, const char *record,
+    size_t length)
+{
+    buffer->committing = 1;
+    do
+    {
+        char  *data  = buffer->pending;
+        size_t count = buffer->length;
+        int    fd    = buffer->fd;
+        buffer->pending = buffer->spare;
+        buffer->spare   = data;
+        buffer->length  = 0;
+        buffer->again   = 0;
+        pthread_mutex_unlock(&buffer->lock);
+
+        struct iovec vector[2] = {
+            { data, count }, { (char *)record, length }
+        };
+        writeAll(fd, vector, 2);
+        record = NULL;
+        length = 0;
+
+        pthread_mutex_lock(&buffer->lock);
+    } while (buffer->again && buffer->length > 0);
+    buffer->again      = 0;
+    buffer->committing = 0;
+    pthread_cond_broadcast(&buffer->committed);
+}
+
+// Commit whatever is pending, waiting for a running commit first. Called with
+// the lock held.
+static void bufferDrain(struct StreamBuffer *buffer)
+{
+    while (buffer->committing)
+        pthread_cond_wait(&buffer->committed, &buffer->lock);
+    if (buffer->length > 0) bufferCommit(buffer, NULL, 0);
+}
+
+
+// Write a finished record of PrintType `type` according to its policy.
+// `urgent` (WARNING and ERROR messages) commits a batch at once.
+void bufferWrite(int type, const char *record, size_t length, int urgent)
+{
+    struct StreamBuffer *buffer = &buffers[type];
+    pthread_mutex_lock(&buffer->lock);
+
+    FILE *stream = streams[type];
+    if (buffer->policy == STDIO_BUFFERED || stream == NULL)
+    {
+        // Policy changed since the caller looked.
+        pthread_mutex_unlock(&buffer->lock);
+        dsubmit(stream, record, length);
+        return;
+    }
+    int fd = fileno(stream);
+    if (fd != buffer->fd)
+    {
+        bufferDrain(buffer);
+        buffer->fd = fd;
+    }
+
+    // Make room: wait for a running commit, or write everything out now.
+    while (buffer->length + length > buffer->capacity)
+    {
+        if (!buffer->committing)
+        {
+            bufferCommit(buffer, record, length);
+            pthread_mutex_unlock(&buffer->lock);
+            return;
+        }
+        pthread_cond_wait(&buffer->committed, &buffer->lock);
+    }
+
+    int due = (buffer->policy == UNBUFFERED || urgent ||
+               (buffer->policy == LINE_BUFFERED && length > 0 &&
+                record[length - 1] == '\n') ||
+               (buffer->policy == BATCHED &&
+                buffer->length + length >= buffer->limit));
+    if (due && !buffer->committing)
+    {
+        // Leader: the record goes out with the batch, without a copy.
+        bufferCommit(buffer, record, length);
+        pthread_mutex_unlock(&buffer->lock);
+        return;
+    }
+
+    if (buffer->length == 0) buffer->oldest = statsClock();
+    memcpy(buffer->pending + buffer->length, record, length);
+    buffer->length += length;
+    if (due) buffer->again = 1;  // the running leader takes it
+    pthread_mutex_unlock(&buffer->lock);
+}
+
+
+
+// Commit every batch older than its latency limit; return how long the
+// flusher may sleep.
+static long long flusherPass()
+{
+    long long now  = statsClock();
+    long long wait = BUFFER_IDLE_MSEC * NSEC_PER_MSEC;
+    for (int i = STANDARD; i <= ERROR; i++)
+    {
+        struct StreamBuffer *buffer = &buffers[i];
+        pthread_mutex_lock(&buffer->lock);
+        if (buffer->policy == BATCHED)
+        {
+            if (buffer->length == 0 || buffer->committing)
+                wait = (buffer->latency < wait) ? buffer->latency : wait;
+            else if (now - buffer->oldest >= buffer->latency)
+                bufferCommit(buffer, NULL, 0);
+            else if (buffer->oldest + buffer->latency - now < wait)
+                wait = buffer->oldest + buffer->latency - now;
+        }
+        pthread_mutex_unlock(&buffer->lock);
+    }
+    return wait;
+}
+
+static void *flusherMain(void *unused)
+{
+    (void)unused;
+    while (!__atomic_load_n(&flusherStop, __ATOMIC_ACQUIRE))
+    {
+        long long wait = flusherPass();
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec  += wait / 1000000000LL;
+        deadline.tv_nsec += wait % 1000000000LL;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        sem_timedwait(&flusherWake, &deadline);
+    }
+    return NULL;
+}
+
+// Start the latency flusher if it is not running.
+static void flusherStart()
+{
+    pthread_mutex_lock(&flusherLock);
+    if (!flusherRunning)
+    {
+        __atomic_store_n(&flusherStop, 0, __ATOMIC_RELEASE);
+        sem_init(&flusherWake, 0, 0);
+        if (pthread_create(&flusherThread, NULL, flusherMain, NULL) == 0)
+            flusherRunning = 1;
+        else
+            sem_destroy(&flusherWake);
+    }
+    pthread_mutex_unlock(&flusherLock);
+}
+
+
+
+// Choose how each PrintType's stream is buffered. STDIO_BUFFERED by default.
+int GetStreamBuffering(int streamType)
+{
+    if (streamType >= STANDARD && streamType <= ERROR)
+        return __atomic_load_n(&buffers[streamType].policy, __ATOMIC_RELAXED);
+    else
+        return STDIO_BUFFERED;
+}
+int SetStreamBuffering(int streamType, int policy, size_t bytes,
+    unsigned int milliseconds)
+{
+    if (streamType < STANDARD || streamType > ERROR)
+    {
+        fprintf(stderr, "ERROR: Invalid stream type. See PrintType enum.\n");
+        exit(1);
+    }
+    if (policy != STDIO_BUFFERED && policy != UNBUFFERED &&
+        policy != LINE_BUFFERED && policy != BATCHED)
+    {
+        fprintf(stderr, "ERROR: Invalid buffering policy value.\n");
+        exit(1);
+    }
+    #if defined(NOFPRINTF) || defined(MATLAB)
+    // Output must go through printf() or mexPrintf(), not a descriptor.
+    if (policy != STDIO_BUFFERED) return -1;
+    #endif
+
+    if (bytes == 0)        bytes        = BUFFER_DEFAULT_BYTES;
+    if (milliseconds == 0) milliseconds = BUFFER_DEFAULT_MSEC;
+
+    // Both buffers hold a full batch plus the records that arrive while it is
+    // being written.
+    size_t capacity = (policy == STDIO_BUFFERED) ? 0 : 2 * bytes;
+    char  *pending  = (capacity > 0) ? malloc(capacity) : NULL;
+    char  *spare    = (capacity > 0) ? malloc(capacity) : NULL;
+    if (capacity > 0 && (pending == NULL || spare == NULL))
+    {
+        free(pending);
+        free(spare);
+        return -1;
+    }
+
+    struct StreamBuffer *buffer = &buffers[streamType];
+    pthread_mutex_lock(&buffer->lock);
+    bufferDrain(buffer);
+    if (streams[streamType] != NULL) fflush(streams[streamType]);
+
+    free(buffer->pending);
+    free(buffer->spare);
+    buffer->pending  = pending;
+    buffer->spare    = spare;
+    buffer->capacity = capacity;
+    buffer->limit    = bytes;
+    buffer->latency  = (long long)milliseconds * NSEC_PER_MSEC;
+    buffer->fd       = -1;
+    __atomic_store_n(&buffer->policy, policy, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&buffer->lock);
+
+    if (policy == BATCHED)
+    {
+        flusherStart();
+        sem_post(&flusherWake);  // pick up the new latency
+    }
+    return 0;
+}
+
+
+// Write out every batch (DisplayFlush()).
+void buffersFlush()
+{
+    for (int i = STANDARD; i <= ERROR; i++)
+    {
+        struct StreamBuffer *buffer = &buffers[i];
+        if (__atomic_load_n(&buffer->policy, __ATOMIC_RELAXED) ==
+            STDIO_BUFFERED)
+            continue;
+        pthread_mutex_lock(&buffer->lock);
+        bufferDrain(buffer);
+        pthread_mutex_unlock(&buffer->lock);
+    }
+}
+
+// Write out every batch and stop the latency flusher (CloseDisplay()).
+void buffersStop()
+{
+    pthread_mutex_lock(&flusherLock);
+    if (flusherRunning)
+    {
+        __atomic_store_n(&flusherStop, 1, __ATOMIC_RELEASE);
+        sem_post(&flusherWake);
+        pthread_join(flusherThread, NULL);
+        sem_destroy(&flusherWake);
+        flusherRunning = 0;
+    }
+    pthread_mutex_unlock(&flusherLock);
+    buffersFlush();
+}
+
+// Write out pending batches with write(2), for the crash handler. Takes no
+// lock; a batch being committed at the same moment is left to its leader.
+void buffersCrashFlush()
+{
+    for (int i = STANDARD; i <= ERROR; i++)
+    {
+        struct StreamBuffer *buffer = &buffers[i];
+        if (buffer->policy != STDIO_BUFFERED && buffer->fd >= 0 &&
+            buffer->pending != NULL)
+            crashWrite(buffer->fd, buffer->pending, buffer->length);
+    }
+}
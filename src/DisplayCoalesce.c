@@ -0,0 +1,234 @@
+#include "DisplayPrivate.h"
+
+#include <semaphore.h>
+#include <stdint.h>
+
+// Coalescing of repeated messages. Each PrintType remembers the last message
+// written to it: its call site and a hash of its format pointer and formatted
+// body. A message from the same site with the same hash, inside the window
+// opened by the one written, is only counted. The count is printed as "last
+// message repeated N times" before the next different message, or by a
+// background thread once the window closes.
+//
+// Messages are never compared as strings. Two different bodies with the same
+// 64-bit hash from the same call site would be taken for repeats; that is as
+// likely as a random collision.
+
+#define COALESCE_IDLE_MSEC 1000  // thread check when nothing is counted
+#define NSEC_PER_MSEC      1000000LL
+
+struct Coalescer {
+    pthread_mutex_t           lock;
+    const struct DisplaySite *site;     // last message written, NULL if none
+    unsigned long long        hash;
+    long long                 opened;   // when it was written
+    unsigned long             repeats;  // identical messages not written since
+    const char               *function; // of the last message, for the summary
+    int                       level;
+    const char               *color;
+};
+
+// A count taken from a Coalescer, printed once its lock is released: the
+// summary takes a stream lock, which a thread inside DisplayLock() holds
+// while it waits for the Coalescer.
+struct Repeats {
+    unsigned long  count;
+    const char    *function;
+    int            level;
+    const char    *color;
+};
+
+// Variables
+unsigned int            coalesceWindow;  // milliseconds, 0 when disabled
+static struct Coalescer coalescers[3] = {
+    [0 ... 2] = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, NULL, 0, NULL }
+};
+static pthread_mutex_t  coalesceLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t        coalesceThread;
+static sem_t            coalesceWake;     // initialized once, never destroyed
+static int              coalesceReady;
+static int              coalesceRunning;
+static int              coalesceStopping;
+static int              coalesceIdle;     // thread sleeps COALESCE_IDLE_MSEC
+
+
+
+// 64-bit hash of `length` bytes, eight at a time.
+static unsigned long long hashBytes(unsigned long long hash, const char *data,
+    size_t length)
+{
+    const unsigned long long prime = 0x9e3779b97f4a7c15ULL;
+    for (; length >= 8; data += 8, length -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+    }
+    uint64_t last = 0;
+    memcpy(&last, data, length);
+    hash = (hash ^ last ^ ((uint64_t)length << 56)) * prime;
+    return hash ^ (hash >> 32);
+}
+
+// Take the pending count of `coalescer`. Called with its lock held.
+static struct Repeats coalesceTake(struct Coalescer *coalescer)
+{
+    struct Repeats repeats = { coalescer->repeats, coalescer->function,
+        coalescer->level, coalescer->color };
+    coalescer->repeats = 0;
+    return repeats;
+}
+
+// Print a count taken by coalesceTake(), if any. Called without the lock.
+static void coalesceEmit(const struct Repeats *repeats, int type)
+{
+    if (repeats->count == 0) return;
+    displayRepeats(type, repeats->function, repeats->level, repeats->color,
+        repeats->count);
+}
+
+
+// Decide whether a message about to be written to PrintType `type` repeats
+// the last one. Returns 1 if it was counted instead and must not be written.
+// `body` is the formatted message without its header.
+int coalesceRepeat(int type, const struct DisplaySite *site,
+    const char *function, int level, const char *color, const char *format,
+    const char *body, size_t length)
+{
+    unsigned long long hash = hashBytes((uintptr_t)format, body, length);
+    long long window = (long long)__atomic_load_n(&coalesceWindow,
+        __ATOMIC_RELAXED) * NSEC_PER_MSEC;
+    long long now    = statsClock();
+
+    struct Coalescer *coalescer = &coalescers[type];
+    pthread_mutex_lock(&coalescer->lock);
+    if (coalescer->site == site && coalescer->hash == hash &&
+        now - coalescer->opened < window)
+    {
+        coalescer->repeats++;
+        pthread_mutex_unlock(&coalescer->lock);
+        return 1;
+    }
+
+    struct Repeats repeats = coalesceTake(coalescer);
+    coalescer->site     = site;
+    coalescer->hash     = hash;
+    coalescer->opened   = now;
+    coalescer->function = function;
+    coalescer->level    = level;
+    coalescer->color    = color;
+    pthread_mutex_unlock(&coalescer->lock);
+    coalesceEmit(&repeats, type);
+
+    // A window opened: an idle thread would only look in a second.
+    if (__atomic_exchange_n(&coalesceIdle, 0, __ATOMIC_ACQ_REL))
+        sem_post(&coalesceWake);
+    return 0;
+}
+
+// Print every pending count whose window has closed, or all of them if `all`.
+// Returns how long until the next window closes.
+static long long coalescePass(int all)
+{
+    long long window = (long long)__atomic_load_n(&coalesceWindow,
+        __ATOMIC_RELAXED) * NSEC_PER_MSEC;
+    long long now    = statsClock();
+    long long wait   = COALESCE_IDLE_MSEC * NSEC_PER_MSEC;
+    for (int i = STANDARD; i <= ERROR; i++)
+    {
+        struct Coalescer *coalescer = &coalescers[i];
+        struct Repeats    repeats   = { 0, NULL, 0, NULL };
+        pthread_mutex_lock(&coalescer->lock);
+        long long left = coalescer->opened + window - now;
+        if (coalescer->repeats > 0 && (all || left <= 0))
+        {
+            repeats = coalesceTake(coalescer);
+            coalescer->site = NULL;  // the window is over
+        }
+        else if (coalescer->repeats > 0 && left < wait)
+            wait = left;
+        else if (coalescer->site != NULL && window > 0 && window < wait)
+            wait = window;
+        pthread_mutex_unlock(&coalescer->lock);
+        coalesceEmit(&repeats, i);
+    }
+    return wait;
+}
+
+static void *coalesceMain(void *unused)
+{
+    (void)unused;
+    while (!__atomic_load_n(&coalesceStopping, __ATOMIC_ACQUIRE))
+    {
+        long long wait = coalescePass(0);
+        if (wait == COALESCE_IDLE_MSEC * NSEC_PER_MSEC)
+            __atomic_store_n(&coalesceIdle, 1, __ATOMIC_RELEASE);
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec  += wait / 1000000000LL;
+        deadline.tv_nsec += wait % 1000000000LL;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        sem_timedwait(&coalesceWake, &deadline);
+        __atomic_store_n(&coalesceIdle, 0, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+
+// Coalesce repeated messages within `milliseconds`, or not (0, the default).
+unsigned int GetCoalesceWindow() { return coalesceWindow; }
+int SetCoalesceWindow(unsigned int milliseconds)
+{
+    pthread_mutex_lock(&coalesceLock);
+    __atomic_store_n(&coalesceWindow, milliseconds, __ATOMIC_RELAXED);
+    if (milliseconds > 0 && !coalesceRunning)
+    {
+        __atomic_store_n(&coalesceStopping, 0, __ATOMIC_RELEASE);
+        if (!coalesceReady)
+        {
+            sem_init(&coalesceWake, 0, 0);
+            coalesceReady = 1;
+        }
+        if (pthread_create(&coalesceThread, NULL, coalesceMain, NULL) == 0)
+            coalesceRunning = 1;
+        else
+        {
+            __atomic_store_n(&coalesceWindow, 0, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&coalesceLock);
+            return -1;
+        }
+    }
+    else if (coalesceRunning)
+        sem_post(&coalesceWake);  // pick up the new window
+    pthread_mutex_unlock(&coalesceLock);
+
+    if (milliseconds == 0) coalesceStop();
+    return 0;
+}
+
+// Print every pending count now (DisplayFlush()).
+void coalesceFlush()
+{
+    coalescePass(1);
+}
+
+// Print pending counts and stop the thread (CloseDisplay()).
+void coalesceStop()
+{
+    pthread_mutex_lock(&coalesceLock);
+    if (coalesceRunning)
+    {
+        __atomic_store_n(&coalesceStopping, 1, __ATOMIC_RELEASE);
+        sem_post(&coalesceWake);
+        pthread_join(coalesceThread, NULL);
+        __atomic_store_n(&coalesceIdle, 0, __ATOMIC_RELEASE);
+        coalesceRunning = 0;
+    }
+    pthread_mutex_unlock(&coalesceLock);
+    coalescePass(1);
+}
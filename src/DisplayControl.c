@@ -0,0 +1,253 @@
+#include "DisplayPrivate.h"
+
+#include <ctype.h>
+#include <fnmatch.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+
+// Call-site registry. Every Display macro places its static DisplaySite in the
+// `display_sites` linker section, and each module (the program and any shared
+// library built with Display.h) registers the bounds of its section at
+// startup. That gives us every call site, used or not, to enable or disable
+// by pattern while the process runs.
+//
+// The control file is polled by a background thread, like the flushing done
+// for rotating files, and applied whenever its size, time or inode changes.
+// Its lines are kept as rules on top of the state each site was given by
+// SetSiteState(), so either can change without undoing the other, and a site
+// only ever moves straight from its old state to its new one.
+
+#define MAX_MODULES      32   // programs and libraries with call sites
+#define CONTROL_POLL_SEC 1    // how often the control file is checked
+#define CONTROL_LINE     512  // longest control file line
+
+struct SiteModule {
+    struct DisplaySite *start;
+    struct DisplaySite *stop;
+};
+
+struct ControlRule {
+    char *pattern;
+    int   state;
+};
+
+// Variables
+static struct SiteModule modules[MAX_MODULES];
+static int               moduleCount;
+static pthread_mutex_t   controlLock = PTHREAD_MUTEX_INITIALIZER;
+static char             *controlPath;   // watched file, NULL if none
+static pthread_t         controlThread;
+static sem_t             controlWake;
+static int               controlStopping;
+static struct ControlRule *rules;      // lines of the control file, in order
+static int               ruleCount;
+
+static const char *stateNames[] = { "off", "on", "default" };
+
+
+
+// Called by the constructor in Display.h, once per file of each module.
+void __DisplayRegisterSites(struct DisplaySite *start, struct DisplaySite *stop)
+{
+    pthread_mutex_lock(&controlLock);
+    int known = 0;
+    for (int i = 0; i < moduleCount; i++)
+        if (modules[i].start == start) known = 1;
+    if (!known && moduleCount < MAX_MODULES)
+        modules[moduleCount++] = (struct SiteModule){ start, stop };
+    pthread_mutex_unlock(&controlLock);
+}
+
+
+static const char *siteBasename(const struct DisplaySite *site)
+{
+    const char *slash = strrchr(site->file, '/');
+    return (slash != NULL) ? slash + 1 : site->file;
+}
+
+static int siteMatches(const struct DisplaySite *site, const char *pattern)
+{
+    char where[BUFFLEN];
+    snprintf(where, sizeof(where), "%s:%d", siteBasename(site), site->line);
+    return fnmatch(pattern, siteBasename(site), 0) == 0 ||
+           fnmatch(pattern, site->file, 0) == 0 ||
+           fnmatch(pattern, where, 0) == 0 ||
+           fnmatch(pattern, site->function, 0) == 0;
+}
+
+// State a site should be in: its SetSiteState() state, then every matching
+// control file line in order. Called with controlLock held.
+static int siteState(const struct DisplaySite *site)
+{
+    int state = site->preset;
+    for (int i = 0; i < ruleCount; i++)
+        if (siteMatches(site, rules[i].pattern)) state = rules[i].state;
+    return state;
+}
+
+// Give every site matching `pattern` (every site if it is NULL) the state
+// `preset` from SetSiteState(), or keep its own if `preset` is negative, and
+// put it in the state that results. Called with controlLock held.
+static int applyState(const char *pattern, int preset)
+{
+    int changed = 0;
+    for (int i = 0; i < moduleCount; i++)
+        for (struct DisplaySite *site = modules[i].start;
+             site < modules[i].stop; site++)
+            if (pattern == NULL || siteMatches(site, pattern))
+            {
+                if (preset >= 0) site->preset = preset;
+                changed += levelSiteState(site, siteState(site));
+            }
+    return changed;
+}
+
+
+// Enable, disable or restore the call sites matching a glob `pattern`.
+int SetSiteState(const char *pattern, int state)
+{
+    if (state != SITE_ENABLED && state != SITE_DISABLED &&
+        state != SITE_DEFAULT)
+    {
+        fprintf(stderr, "ERROR: Invalid site state value.\n");
+        exit(1);
+    }
+    if (pattern == NULL) return 0;
+
+    pthread_mutex_lock(&controlLock);
+    int changed = applyState(pattern, state);
+    pthread_mutex_unlock(&controlLock);
+    return changed;
+}
+
+
+// Print one line per known call site.
+int DisplayListSites(FILE *stream)
+{
+    pthread_mutex_lock(&controlLock);
+    for (int i = 0; i < moduleCount; i++)
+        for (struct DisplaySite *site = modules[i].start;
+             site < modules[i].stop; site++)
+            fprintf(stream, "%s:%d %s [%s] %s \"%s\"\n", siteBasename(site),
+                site->line, site->function, levelName(site->level),
+                stateNames[site->state],
+                (site->format != NULL) ? site->format : "");
+    pthread_mutex_unlock(&controlLock);
+    return 0;
+}
+
+
+
+// Read the control file into rules, then move every site to the state they
+// give it. Lines that cannot be understood are reported and skipped.
+static void controlApply(const char *path)
+{
+    FILE *control = fopen(path, "r");
+    if (control == NULL) return;
+
+    struct ControlRule *parsed = NULL;
+    int  count = 0, capacity = 0;
+    char text[CONTROL_LINE];
+    int  number = 0;
+    while (fgets(text, sizeof(text), control) != NULL)
+    {
+        number++;
+        char *comment = strchr(text, '#');
+        if (comment != NULL) *comment = '\0';
+
+        char pattern[CONTROL_LINE], word[16], extra;
+        int  fields = sscanf(text, "%511s %15s %c", pattern, word, &extra);
+        if (fields <= 0) continue;  // blank
+
+        int state = -1;
+        for (int s = SITE_DISABLED; s <= SITE_DEFAULT; s++)
+            if (fields == 2 && strcmp(word, stateNames[s]) == 0) state = s;
+        if (state < 0)
+        {
+            fprintf(stderr, "WARNING: %s:%d: expected a pattern and on, off "
+                "or default.\n", path, number);
+            continue;
+        }
+
+        if (count == capacity)
+        {
+            int grown = (capacity > 0) ? 2 * capacity : 16;
+            struct ControlRule *more = realloc(parsed, grown * sizeof(*more));
+            if (more == NULL) break;
+            parsed = more;
+            capacity = grown;
+        }
+        if ((parsed[count].pattern = strdup(pattern)) == NULL) break;
+        parsed[count++].state = state;
+    }
+    fclose(control);
+
+    pthread_mutex_lock(&controlLock);
+    struct ControlRule *old = rules;
+    int oldCount = ruleCount;
+    rules = parsed;
+    ruleCount = count;
+    applyState(NULL, -1);
+    pthread_mutex_unlock(&controlLock);
+
+    for (int i = 0; i < oldCount; i++) free(old[i].pattern);
+    free(old);
+}
+
+static void *controlMain(void *arg)
+{
+    const char *path = arg;
+    struct stat seen = { 0 };
+
+    while (!__atomic_load_n(&controlStopping, __ATOMIC_ACQUIRE))
+    {
+        struct stat info;
+        if (stat(path, &info) == 0 &&
+            (info.st_mtim.tv_sec  != seen.st_mtim.tv_sec ||
+             info.st_mtim.tv_nsec != seen.st_mtim.tv_nsec ||
+             info.st_size != seen.st_size || info.st_ino != seen.st_ino))
+        {
+            seen = info;
+            controlApply(path);
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += CONTROL_POLL_SEC;
+        sem_timedwait(&controlWake, &deadline);
+    }
+    return NULL;
+}
+
+
+// Watch a control file, or stop watching with NULL.
+const char *GetSiteControlFile() { return controlPath; }
+int SetSiteControlFile(const char *path)
+{
+    controlStop();
+    if (path == NULL) return 0;
+
+    if ((controlPath = strdup(path)) == NULL) return -1;
+    __atomic_store_n(&controlStopping, 0, __ATOMIC_RELEASE);
+    sem_init(&controlWake, 0, 0);
+    if (pthread_create(&controlThread, NULL, controlMain, controlPath) != 0)
+    {
+        sem_destroy(&controlWake);
+        free(controlPath);
+        controlPath = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Stop the control file thread, if running.
+void controlStop()
+{
+    if (controlPath == NULL) return;
+    __atomic_store_n(&controlStopping, 1, __ATOMIC_RELEASE);
+    sem_post(&controlWake);
+    pthread_join(controlThread, NULL);
+    sem_destroy(&controlWake);
+    free(controlPath);
+    controlPath = NULL;
+}
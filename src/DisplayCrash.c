@@ -0,0 +1,461 @@
+#include "DisplayPrivate.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+
+// Crash handling and emergency output. Everything here may run inside a
+// signal handler, so it only uses async-signal-safe calls: write(2) on file
+// descriptors, no locks, no allocation, no stdio and no localtime().
+//
+// On a fatal signal the handler writes out what is still buffered: the stdio
+// buffers of every stream Display knows about (read directly, glibc only),
+// then the records queued for the asynchronous writer and the messages kept
+// by the flight recorder. It then hands the signal on to whatever handler was
+// installed before, normally the default action that ends the process.
+//
+// DisplayEmergency() formats with its own small printf into a fixed-size
+// buffer on the stack, so it can be called from any signal handler and from
+// several threads at once.
+
+#define EMERGENCY_SIZE  1024             // longest emergency line
+#define CRASH_STACK     (64 * 1024)      // alternate stack for stack overflows
+
+static const int crashSignals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+static const char *crashNames[] = {
+    "SIGSEGV", "SIGBUS", "SIGFPE", "SIGILL", "SIGABRT"
+};
+#define CRASH_SIGNALS (int)(sizeof(crashSignals) / sizeof(crashSignals[0]))
+
+// Variables
+static int              crashHandler = DISABLE;
+static struct sigaction crashPrevious[CRASH_SIGNALS];
+static char            *crashStack;
+
+
+
+// Write all of `buffer` to `fd`, retrying after interruptions.
+void crashWrite(int fd, const char *buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, buffer, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return;
+        buffer += written;
+        length -= (size_t)written;
+    }
+}
+
+// Write out and discard whatever `stream` holds in its stdio buffer, without
+// taking its lock. Only possible where the FILE layout is known (glibc).
+void crashFlushStream(FILE *stream)
+{
+    #ifdef __GLIBC__
+    if (stream == NULL) return;
+    char *base = stream->_IO_write_base;
+    char *end  = stream->_IO_write_ptr;
+    if (base != NULL && end > base)
+    {
+        crashWrite(fileno(stream), base, (size_t)(end - base));
+        stream->_IO_write_ptr = base;
+    }
+    #else
+    (void)stream;
+    #endif
+}
+
+
+
+// Append to a fixed buffer, keeping room for "\n".
+struct EmergencyLine {
+    char   data[EMERGENCY_SIZE];
+    size_t length;
+};
+
+static void lineAppend(struct EmergencyLine *line, const char *text,
+    size_t length)
+{
+    size_t room = sizeof(line->data) - 1 - line->length;
+    if (length > room) length = room;
+    memcpy(line->data + line->length, text, length);
+    line->length += length;
+}
+
+static void lineString(struct EmergencyLine *line, const char *text)
+{
+    lineAppend(line, text, strlen(text));
+}
+
+// Append `value` in `base`, padded to `width` with spaces or zeros.
+static void lineNumber(struct EmergencyLine *line, unsigned long long value,
+    int negative, int base, int upper, int width, int zero, int left)
+{
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char  text[24];
+    char *end   = text + sizeof(text);
+    char *start = end;
+    do
+    {
+        *--start = digits[value % (unsigned)base];
+        value   /= (unsigned)base;
+    } while (value != 0);
+
+    int length  = (int)(end - start) + negative;
+    int padding = (width > length) ? width - length : 0;
+    if (negative && zero) lineAppend(line, "-", 1);
+    for (int i = 0; !left && i < padding; i++)
+        lineAppend(line, zero ? "0" : " ", 1);
+    if (negative && !zero) lineAppend(line, "-", 1);
+    lineAppend(line, start, (size_t)(end - start));
+    for (int i = 0; left && i < padding; i++)
+        lineAppend(line, " ", 1);
+}
+
+// Fixed-point rendering of a double with `precision` decimals (at most 9):
+// good enough for an emergency, and needs no locale or libm.
+static void lineDouble(struct EmergencyLine *line, double value, int precision)
+{
+    if (value != value)                    { lineString(line, "nan"); return; }
+    if (value > 1e18 || value < -1e18)     { lineString(line, "<big>"); return; }
+    if (precision > 9) precision = 9;
+
+    unsigned long long scale = 1;
+    for (int i = 0; i < precision; i++) scale *= 10;
+    int negative = value < 0;
+    if (negative) value = -value;
+
+    unsigned long long whole = (unsigned long long)value;
+    unsigned long long part  =
+        (unsigned long long)((value - (double)whole) * (double)scale + 0.5);
+    if (part >= scale) { whole++; part -= scale; }
+
+    lineNumber(line, whole, negative, 10, 0, 0, 0, 0);
+    if (precision > 0)
+    {
+        lineAppend(line, ".", 1);
+        lineNumber(line, part, 0, 10, 0, precision, 1, 0);
+    }
+}
+
+// Where lineFormat() takes its arguments from: a va_list, or arguments
+// recorded by the flight recorder (see binaryCapture()).
+struct LineArgs {
+    va_list    *list;    // NULL when reading `data`
+    const char *data;
+    size_t      length;  // left in `data`
+};
+
+// Next recorded argument of `size` bytes, or zeros once they run out.
+static void argTake(struct LineArgs *args, void *out, size_t size)
+{
+    memset(out, 0, size);
+    if (args->length < size) { args->length = 0; return; }
+    memcpy(out, args->data, size);
+    args->data   += size;
+    args->length -= size;
+}
+
+static long long argSigned(struct LineArgs *args, int wide)
+{
+    if (args->list != NULL)
+        return wide ? va_arg(*args->list, long long) : va_arg(*args->list, int);
+    int32_t narrow;
+    int64_t value;
+    if (wide) { argTake(args, &value, sizeof(value)); return value; }
+    argTake(args, &narrow, sizeof(narrow));
+    return narrow;
+}
+
+static unsigned long long argUnsigned(struct LineArgs *args, int wide)
+{
+    if (args->list != NULL)
+        return wide ? va_arg(*args->list, unsigned long long) :
+            va_arg(*args->list, unsigned);
+    uint32_t narrow;
+    uint64_t value;
+    if (wide) { argTake(args, &value, sizeof(value)); return value; }
+    argTake(args, &narrow, sizeof(narrow));
+    return narrow;
+}
+
+static double argDouble(struct LineArgs *args, int extended)
+{
+    if (args->list != NULL)
+        return extended ? (double)va_arg(*args->list, long double) :
+            va_arg(*args->list, double);
+    long double large;
+    double      value;
+    if (extended) { argTake(args, &large, sizeof(large)); return (double)large; }
+    argTake(args, &value, sizeof(value));
+    return value;
+}
+
+static unsigned long long argPointer(struct LineArgs *args)
+{
+    if (args->list != NULL)
+        return (uintptr_t)va_arg(*args->list, void *);
+    uint64_t value;
+    argTake(args, &value, sizeof(value));
+    return value;
+}
+
+// A string argument and its length. Recorded strings are not terminated.
+static const char *argString(struct LineArgs *args, size_t *length)
+{
+    const char *text;
+    if (args->list != NULL)
+    {
+        text = va_arg(*args->list, const char *);
+        if (text == NULL) text = "(null)";
+        *length = strlen(text);
+        return text;
+    }
+    uint32_t size;
+    argTake(args, &size, sizeof(size));
+    if (size == BINARY_NULL) { *length = 6; return "(null)"; }
+    if (size > args->length) size = (uint32_t)args->length;
+    text = args->data;
+    args->data   += size;
+    args->length -= size;
+    *length = size;
+    return text;
+}
+
+// Minimal printf: flags '-' and '0', width, precision, the usual length
+// modifiers and d i u o x X c s p f e g. Anything else is copied as it is.
+static void lineFormat(struct EmergencyLine *line, const char *format,
+    struct LineArgs *args)
+{
+    const char       *cursor = format;
+    struct FormatSpec spec;
+    while (formatNext(&cursor, &spec))
+    {
+        // Literal text before the specification, with "%%" collapsed.
+        for (const char *c = format; c < spec.start; c++)
+        {
+            lineAppend(line, c, 1);
+            if (*c == '%') c++;
+        }
+        format = spec.end;
+
+        int left = 0, zero = 0, width = 0, precision = -1;
+        const char *p = spec.start + 1;
+        for (; *p == '-' || *p == '0' || *p == '+' || *p == ' ' || *p == '#';
+             p++)
+        {
+            if (*p == '-') left = 1;
+            if (*p == '0') zero = 1;
+        }
+        if (spec.starWidth) { width = (int)argSigned(args, 0); p++; }
+        else while (*p >= '0' && *p <= '9') width = width * 10 + (*p++ - '0');
+        if (*p == '.')
+        {
+            p++;
+            precision = 0;
+            if (spec.starPrecision) precision = (int)argSigned(args, 0);
+            else while (*p >= '0' && *p <= '9')
+                precision = precision * 10 + (*p++ - '0');
+        }
+        if (width < 0) { left = 1; width = -width; }
+        if (left) zero = 0;
+
+        int wide = spec.length != LEN_NONE && spec.length != LEN_H &&
+                   spec.length != LEN_HH;
+        switch (spec.arg == ARG_UNSUPPORTED ? 0 : spec.conversion)
+        {
+            case 'd': case 'i':
+            {
+                long long value = argSigned(args, wide);
+                unsigned long long magnitude = (value < 0) ?
+                    -(unsigned long long)value : (unsigned long long)value;
+                lineNumber(line, magnitude, value < 0, 10, 0, width, zero,
+                    left);
+                break;
+            }
+            case 'u': case 'o': case 'x': case 'X':
+            {
+                unsigned long long value = argUnsigned(args, wide);
+                int base = (spec.conversion == 'u') ? 10 :
+                           (spec.conversion == 'o') ? 8 : 16;
+                lineNumber(line, value, 0, base, spec.conversion == 'X', width,
+                    zero, left);
+                break;
+            }
+            case 'c':
+            {
+                char c = (char)argSigned(args, 0);
+                lineAppend(line, &c, 1);
+                break;
+            }
+            case 's':
+            {
+                size_t      length;
+                const char *text = argString(args, &length);
+                if (precision >= 0 && (size_t)precision < length)
+                    length = (size_t)precision;
+                int padding = (width > (int)length) ? width - (int)length : 0;
+                for (int i = 0; !left && i < padding; i++) lineAppend(line, " ", 1);
+                lineAppend(line, text, length);
+                for (int i = 0; left && i < padding; i++) lineAppend(line, " ", 1);
+                break;
+            }
+            case 'p':
+                lineAppend(line, "0x", 2);
+                lineNumber(line, argPointer(args), 0, 16, 0, 0, 0, 0);
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+                lineDouble(line, argDouble(args, spec.arg == ARG_LDOUBLE),
+                    precision < 0 ? 6 : precision);
+                break;
+            default:
+                // Cannot be formatted safely; show the specification instead.
+                lineAppend(line, spec.start, (size_t)(spec.end - spec.start));
+                return;
+        }
+    }
+    for (const char *c = format; *c != '\0'; c++)
+    {
+        lineAppend(line, c, 1);
+        if (*c == '%' && c[1] == '%') c++;
+    }
+}
+
+// Format and write one emergency line to the error stream.
+static void emergencyWrite(const char *function, const char *format,
+    va_list args)
+{
+    struct EmergencyLine line;
+    char                 timestamp[TIMESTAMP_SIZE];
+    line.length = 0;
+
+    size_t length = timestampFormatSafe(timestamp);
+    lineAppend(&line, "[", 1);
+    lineAppend(&line, timestamp, length);
+    lineAppend(&line, "][", 2);
+    lineString(&line, file);
+    lineAppend(&line, "][", 2);
+    lineString(&line, function);
+    lineAppend(&line, "][EMERGENCY] ", 13);
+    va_list copy;  // a va_list parameter cannot be passed on by address
+    va_copy(copy, args);
+    struct LineArgs source = { &copy, NULL, 0 };
+    lineFormat(&line, format, &source);
+    va_end(copy);
+    line.data[line.length++] = '\n';
+
+    FILE *stream = streams[ERROR];
+    crashWrite((stream != NULL) ? fileno(stream) : STDERR_FILENO, line.data,
+        line.length);
+}
+
+// Write one message kept by the flight recorder, recorded at `ns`. `data` is
+// the text of the message if `format` is NULL, its recorded arguments if not.
+void crashReplay(int fd, long long ns, const char *function, int level,
+    const char *format, const char *data, size_t length)
+{
+    struct EmergencyLine line;
+    char                 timestamp[TIMESTAMP_SIZE];
+    line.length = 0;
+
+    const char *tag = levelTag(level);
+    lineAppend(&line, "[", 1);
+    lineAppend(&line, timestamp, timestampFormatSafeAt(ns, timestamp));
+    lineAppend(&line, "][", 2);
+    lineString(&line, file);
+    lineAppend(&line, "][", 2);
+    lineString(&line, function);
+    lineAppend(&line, "]", 1);
+    lineString(&line, tag != NULL ? tag : " ");
+    if (format == NULL)
+        lineAppend(&line, data, length);
+    else
+    {
+        struct LineArgs source = { NULL, data, length };
+        lineFormat(&line, format, &source);
+    }
+    line.data[line.length++] = '\n';
+    crashWrite(fd, line.data, line.length);
+}
+
+// Don't call this function. Use the DisplayEmergency(format, ...) macro!
+void __DisplayEmergency(const char *function, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    emergencyWrite(function, format, args);
+    va_end(args);
+}
+
+
+
+// Write out everything still buffered by Display. Async-signal-safe.
+static void crashDrain()
+{
+    for (int i = STANDARD; i <= ERROR; i++)
+    {
+        crashFlushStream(streams[i]);
+        if (rotatingStreams[i] != NULL) rotatingCrashFlush(rotatingStreams[i]);
+    }
+    crashFlushStream(binaryStream);
+    buffersCrashFlush();
+    sinksCrashFlush();
+    asyncCrashDrain();
+    historyCrashDump();
+}
+
+static void crashHandle(int signal)
+{
+    int index = 0;
+    while (index < CRASH_SIGNALS - 1 && crashSignals[index] != signal) index++;
+
+    crashDrain();
+    __DisplayEmergency("crash", "Caught %s, Display output flushed.",
+        crashNames[index]);
+
+    // Pass the signal on. It is blocked until this handler returns; a fault
+    // that was not raised will simply happen again on return.
+    sigaction(signal, &crashPrevious[index], NULL);
+    raise(signal);
+}
+
+
+// Install or remove the crash handler. Disabled by default.
+int GetCrashHandler() { return crashHandler; }
+int SetCrashHandler(int c)
+{
+    if (c != ENABLE && c != DISABLE)
+    {
+        fprintf(stderr, "ERROR: Invalid crash handler value.\n");
+        exit(1);
+    }
+    if (c == crashHandler) return 0;
+
+    if (c == ENABLE)
+    {
+        // Learn the time zone now; the handler cannot call localtime_r().
+        char timestamp[TIMESTAMP_SIZE];
+        timestampFormat(timestamp);
+
+        // Handle stack overflows on a stack of their own (calling thread).
+        if (crashStack == NULL && (crashStack = malloc(CRASH_STACK)) != NULL)
+        {
+            stack_t stack = { .ss_sp = crashStack, .ss_size = CRASH_STACK };
+            sigaltstack(&stack, NULL);
+        }
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = crashHandle;
+        action.sa_flags   = SA_ONSTACK;
+        sigemptyset(&action.sa_mask);
+        for (int i = 0; i < CRASH_SIGNALS; i++)
+            sigaction(crashSignals[i], &action, &crashPrevious[i]);
+    }
+    else
+        for (int i = 0; i < CRASH_SIGNALS; i++)
+            sigaction(crashSignals[i], &crashPrevious[i], NULL);
+
+    crashHandler = c;
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "DisplayPrivate.h"
+
+// printf format string scanner. Splits a format string into literal text and
+// conversion specifications and classifies the argument each one consumes.
+// Shared by the library and the display-decode tool, so it must not depend on
+// any other part of Display.
+
+
+
+// Find the next conversion specification at or after `*cursor`. Literal text
+// before it (including "%%") is left for the caller to copy from `*cursor` to
+// `spec->start`. Returns 0 at the end of the string.
+int formatNext(const char **cursor, struct FormatSpec *spec)
+{
+    const char *p = *cursor;
+
+    for (;;)
+    {
+        p = strchr(p, '%');
+        if (p == NULL) return 0;
+        if (p[1] != '%') break;
+        p += 2;
+    }
+
+    memset(spec, 0, sizeof(*spec));
+    spec->start = p++;
+
+    // Positional arguments ("%1$d") are not supported.
+    const char *digits = p;
+    while (*digits >= '0' && *digits <= '9') digits++;
+    if (*digits == '$' && digits != p)
+    {
+        spec->arg = ARG_UNSUPPORTED;
+        p = digits + 1;
+    }
+
+    // Flags, width and precision.
+    while (*p && strchr("-+ #0'I", *p)) p++;
+    if (*p == '*') { spec->starWidth = 1; p++; }
+    else while (*p >= '0' && *p <= '9') p++;
+    if (*p == '.')
+    {
+        p++;
+        if (*p == '*') { spec->starPrecision = 1; p++; }
+        else while (*p >= '0' && *p <= '9') p++;
+    }
+
+    // Length modifier.
+    spec->lengthStart = p;
+    switch (*p)
+    {
+        case 'h': spec->length = (p[1] == 'h') ? LEN_HH : LEN_H; break;
+        case 'l': spec->length = (p[1] == 'l') ? LEN_LL : LEN_L; break;
+        case 'q': spec->length = LEN_LL;    break;
+        case 'L': spec->length = LEN_BIGL;  break;
+        case 'j': spec->length = LEN_J;     break;
+        case 'z':
+        case 'Z': spec->length = LEN_Z;     break;
+        case 't': spec->length = LEN_T;     break;
+        default:  spec->length = LEN_NONE;  break;
+    }
+    if (spec->length == LEN_HH || spec->length == LEN_LL) p += (*p == 'q') ? 1 : 2;
+    else if (spec->length != LEN_NONE) p++;
+
+    // Conversion.
+    spec->conversion = *p;
+    if (*p != '\0') p++;
+    spec->end = p;
+    *cursor = p;
+
+    if (spec->arg == ARG_UNSUPPORTED) return 1;
+    switch (spec->conversion)
+    {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+            spec->arg = (spec->length == LEN_NONE || spec->length == LEN_H ||
+                         spec->length == LEN_HH) ? ARG_INT : ARG_WIDE;
+            break;
+        case 'c':
+            spec->arg = (spec->length == LEN_NONE) ? ARG_INT : ARG_UNSUPPORTED;
+            break;
+        case 'f': case 'F': case 'e': case 'E':
+        case 'g': case 'G': case 'a': case 'A':
+            spec->arg = (spec->length == LEN_BIGL) ? ARG_LDOUBLE : ARG_DOUBLE;
+            break;
+        case 's':
+            spec->arg = (spec->length == LEN_NONE) ? ARG_STRING : ARG_UNSUPPORTED;
+            break;
+        case 'p':
+            spec->arg = ARG_POINTER;
+            break;
+        default:  // %n, %m, %C, %S, unknown or truncated specifications
+            spec->arg = ARG_UNSUPPORTED;
+            break;
+    }
+    return 1;
+}
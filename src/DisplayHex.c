@@ -0,0 +1,264 @@
+#include "DisplayPrivate.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define HEX_X86
+#include <immintrin.h>
+#endif
+
+// Hex dumps, laid out like `hexdump -C`:
+//
+//   00000000  48 65 6c 6c 6f 2c 20 77  6f 72 6c 64 21 0a 00 ff  |Hello, world!...|
+//
+// Whole lines are converted 16 bytes at a time with SIMD: nibbles to hex
+// digits, and bytes outside printable ASCII to '.'. With AVX2, two lines are
+// done at once and the digits are moved into their "xx " slots by a shuffle;
+// with SSE2 (every x86-64 processor) the slots are filled from a register of
+// digits. Other processors, and the last partial line, use a table. Lines are
+// written straight into the record, so dumping is bound by memory bandwidth
+// rather than by formatting.
+
+#define HEX_BYTES   16                    // bytes per line
+#define HEX_LINE    79                    // characters per line, with '\n'
+#define HEX_COLUMN  10                    // first hex digit
+#define HEX_ASCII   61                    // first character of the text column
+
+static const char digits[] = "0123456789abcdef";
+
+
+
+// Offset, separators and text column frame of a full line.
+static void lineFrame(char *out, size_t offset)
+{
+    for (int i = 7; i >= 0; i--, offset >>= 4)
+        out[i] = digits[offset & 0xf];
+    out[8] = out[9] = ' ';
+    out[HEX_COLUMN + 24] = ' ';
+    out[HEX_ASCII - 2] = ' ';
+    out[HEX_ASCII - 1] = '|';
+    out[HEX_ASCII + HEX_BYTES] = '|';
+    out[HEX_ASCII + HEX_BYTES + 1] = '\n';
+}
+
+// Column of the digits of byte `i` in a line.
+static inline int byteColumn(int i)
+{
+    return HEX_COLUMN + 3 * i + (i >= 8);
+}
+
+// Any line, possibly partial, one byte at a time.
+static void lineScalar(char *out, const unsigned char *bytes, int count,
+    size_t offset)
+{
+    lineFrame(out, offset);
+    for (int i = 0; i < HEX_BYTES; i++)
+    {
+        char *slot = out + byteColumn(i);
+        slot[0] = (i < count) ? digits[bytes[i] >> 4]  : ' ';
+        slot[1] = (i < count) ? digits[bytes[i] & 0xf] : ' ';
+        slot[2] = ' ';
+        out[HEX_ASCII + i] = (i >= count) ? ' ' :
+            (bytes[i] >= 0x20 && bytes[i] < 0x7f) ? (char)bytes[i] : '.';
+    }
+    out[HEX_ASCII + count] = '|';
+    out[HEX_ASCII + count + 1] = '\n';
+}
+
+#ifdef HEX_X86
+
+// SSE2: 16 bytes to 32 digits and 16 text characters.
+static inline void convertSse2(__m128i bytes, __m128i *first, __m128i *second,
+    __m128i *text)
+{
+    const __m128i low    = _mm_set1_epi8(0x0f);
+    const __m128i nine   = _mm_set1_epi8(9);
+    const __m128i zero   = _mm_set1_epi8('0');
+    const __m128i letter = _mm_set1_epi8('a' - '0' - 10);
+
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), low);
+    __m128i lo = _mm_and_si128(bytes, low);
+    hi = _mm_add_epi8(_mm_add_epi8(hi, zero),
+        _mm_and_si128(_mm_cmpgt_epi8(hi, nine), letter));
+    lo = _mm_add_epi8(_mm_add_epi8(lo, zero),
+        _mm_and_si128(_mm_cmpgt_epi8(lo, nine), letter));
+    *first  = _mm_unpacklo_epi8(hi, lo);
+    *second = _mm_unpackhi_epi8(hi, lo);
+
+    // Printable is 0x20 to 0x7e; as signed bytes, 0x80 and up are negative.
+    __m128i printable = _mm_and_si128(
+        _mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x1f)),
+        _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x7f)));
+    *text = _mm_or_si128(_mm_and_si128(printable, bytes),
+        _mm_andnot_si128(printable, _mm_set1_epi8('.')));
+}
+
+static void linesSse2(char *out, const unsigned char *bytes, size_t lines,
+    size_t offset)
+{
+    for (size_t n = 0; n < lines; n++, out += HEX_LINE, bytes += HEX_BYTES)
+    {
+        __m128i first, second, text;
+        char    hex[32];
+        convertSse2(_mm_loadu_si128((const __m128i *)bytes), &first, &second,
+            &text);
+        _mm_storeu_si128((__m128i *)hex, first);
+        _mm_storeu_si128((__m128i *)(hex + 16), second);
+        _mm_storeu_si128((__m128i *)(out + HEX_ASCII), text);
+
+        lineFrame(out, offset + n * HEX_BYTES);
+        for (int i = 0; i < HEX_BYTES; i++)
+        {
+            char *slot = out + byteColumn(i);
+            memcpy(slot, hex + 2 * i, 2);
+            slot[2] = ' ';
+        }
+    }
+}
+
+// AVX2: two lines per iteration, one per 128-bit lane, with the digits of
+// each half line shuffled into "xx xx ..." order.
+__attribute__((target("avx2")))
+static void linesAvx2(char *out, const unsigned char *bytes, size_t lines,
+    size_t offset)
+{
+    #define Z -128  // shuffle to a zero byte, later a space
+    const __m256i table = _mm256_setr_epi8(
+        '0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f',
+        '0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f');
+    // 8 bytes (16 digits) give 24 characters: 16 from `head`, 8 from `tail`.
+    const __m256i head = _mm256_setr_epi8(
+        0, 1, Z, 2, 3, Z, 4, 5, Z, 6, 7, Z, 8, 9, Z, 10,
+        0, 1, Z, 2, 3, Z, 4, 5, Z, 6, 7, Z, 8, 9, Z, 10);
+    const __m256i tail = _mm256_setr_epi8(
+        11, Z, 12, 13, Z, 14, 15, Z, Z, Z, Z, Z, Z, Z, Z, Z,
+        11, Z, 12, 13, Z, 14, 15, Z, Z, Z, Z, Z, Z, Z, Z, Z);
+    #undef Z
+    const __m256i spaceHead = _mm256_setr_epi8(
+        0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0,
+        0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0);
+    const __m256i spaceTail = _mm256_setr_epi8(
+        0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, 0, 0, 0, 0, 0, 0,
+        0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+
+    size_t n = 0;
+    for (; n + 2 <= lines; n += 2, bytes += 2 * HEX_BYTES)
+    {
+        __m256i v  = _mm256_loadu_si256((const __m256i *)bytes);
+        __m256i hi = _mm256_shuffle_epi8(table,
+            _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+        __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, low));
+        __m256i first  = _mm256_unpacklo_epi8(hi, lo);  // bytes 0-7 of a line
+        __m256i second = _mm256_unpackhi_epi8(hi, lo);  // bytes 8-15
+
+        __m256i firstHead  = _mm256_or_si256(
+            _mm256_shuffle_epi8(first, head), spaceHead);
+        __m256i firstTail  = _mm256_or_si256(
+            _mm256_shuffle_epi8(first, tail), spaceTail);
+        __m256i secondHead = _mm256_or_si256(
+            _mm256_shuffle_epi8(second, head), spaceHead);
+        __m256i secondTail = _mm256_or_si256(
+            _mm256_shuffle_epi8(second, tail), spaceTail);
+
+        __m256i printable = _mm256_and_si256(
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x1f)),
+            _mm256_cmpgt_epi8(_mm256_set1_epi8(0x7f), v));
+        __m256i text = _mm256_blendv_epi8(_mm256_set1_epi8('.'), v, printable);
+
+        for (int lane = 0; lane < 2; lane++)
+        {
+            char *line = out + (n + lane) * HEX_LINE;
+            lineFrame(line, offset + (n + lane) * HEX_BYTES);
+            #define LANE(x) (lane ? _mm256_extracti128_si256(x, 1) : \
+                                    _mm256_castsi256_si128(x))
+            _mm_storeu_si128((__m128i *)(line + HEX_COLUMN), LANE(firstHead));
+            _mm_storel_epi64((__m128i *)(line + HEX_COLUMN + 16),
+                LANE(firstTail));
+            _mm_storeu_si128((__m128i *)(line + HEX_COLUMN + 25),
+                LANE(secondHead));
+            _mm_storel_epi64((__m128i *)(line + HEX_COLUMN + 41),
+                LANE(secondTail));
+            _mm_storeu_si128((__m128i *)(line + HEX_ASCII), LANE(text));
+            #undef LANE
+        }
+    }
+    if (n < lines)
+        linesSse2(out + n * HEX_LINE, bytes, lines - n, offset + n * HEX_BYTES);
+}
+
+#endif
+
+// Write `lines` full lines of `bytes`, starting at `offset`.
+static void hexLines(char *out, const unsigned char *bytes, size_t lines,
+    size_t offset)
+{
+    #ifdef HEX_X86
+    static int avx2 = -1;
+    int use = __atomic_load_n(&avx2, __ATOMIC_RELAXED);
+    if (use < 0)
+    {
+        __builtin_cpu_init();
+        use = __builtin_cpu_supports("avx2") != 0;
+        __atomic_store_n(&avx2, use, __ATOMIC_RELAXED);
+    }
+    if (use) linesAvx2(out, bytes, lines, offset);
+    else      linesSse2(out, bytes, lines, offset);
+    #else
+    for (size_t n = 0; n < lines; n++)
+        lineScalar(out + n * HEX_LINE, bytes + n * HEX_BYTES, HEX_BYTES,
+            offset + n * HEX_BYTES);
+    #endif
+}
+
+
+
+// Append a dump of `data` to `record`, each line preceded by a newline.
+// Stops early if the record cannot grow. Offsets of 4 GiB and more wrap.
+void hexAppend(struct DisplayRecord *record, const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+    size_t lines = (length + HEX_BYTES - 1) / HEX_BYTES;
+    size_t room  = recordReserve(record, lines * HEX_LINE + 1);
+    if (room < lines * HEX_LINE + 1)
+    {
+        lines  = (room > 0) ? (room - 1) / HEX_LINE : 0;
+        length = lines * HEX_BYTES;
+    }
+    if (lines == 0) return;
+
+    // Lines end with '\n'; shift by one so each starts with one instead.
+    char  *out  = record->data + record->length;
+    size_t full = length / HEX_BYTES;
+    *out++ = '\n';
+    hexLines(out, bytes, full, 0);
+    if (full < lines)
+        lineScalar(out + full * HEX_LINE, bytes + full * HEX_BYTES,
+            (int)(length - full * HEX_BYTES), full * HEX_BYTES);
+
+    // The last line is shorter when partial; drop its '\n'.
+    size_t last = (full < lines) ? HEX_ASCII + (length - full * HEX_BYTES) + 1 :
+        HEX_LINE - 1;
+    record->length += (lines - 1) * HEX_LINE + 1 + last;
+    record->data[record->length] = '\0';
+}
+
+// Write `length` bytes of `data` as 2 * `length` hex digits to `out`.
+void hexCompact(char *out, const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+    size_t i = 0;
+    #ifdef HEX_X86
+    for (; i + HEX_BYTES <= length; i += HEX_BYTES)
+    {
+        __m128i first, second, text;
+        convertSse2(_mm_loadu_si128((const __m128i *)(bytes + i)), &first,
+            &second, &text);
+        _mm_storeu_si128((__m128i *)(out + 2 * i), first);
+        _mm_storeu_si128((__m128i *)(out + 2 * i + 16), second);
+    }
+    #endif
+    for (; i < length; i++)
+    {
+        out[2 * i]     = digits[bytes[i] >> 4];
+        out[2 * i + 1] = digits[bytes[i] & 0xf];
+    }
+}
@@ -0,0 +1,370 @@
+#include "DisplayPrivate.h"
+
+#include <stdint.h>
+
+// Flight recorder. Messages that are not printed, because of verbosity or
+// display levels, are kept in a fixed ring of slots in memory instead, and
+// written out before the next error, on a crash or by DisplayDumpHistory().
+//
+// Recording takes no lock. A writer claims the next sequence number with one
+// atomic addition, then its slot with a compare-and-swap: if the slot is busy
+// (a slow writer a whole ring behind, or a dump reading it) the message is
+// counted as lost rather than waited for. Formatting is deferred where binary
+// output could defer it: the slot keeps the raw arguments, packed as
+// DisplayBinary.c does, and the text is only produced by a dump. Other
+// messages are formatted into the slot, cut to its size.
+//
+// A dump consumes the slots it prints, so each message is printed once.
+
+#define HISTORY_SLOT  256  // bytes per slot, including its bookkeeping
+
+enum SlotState { SLOT_EMPTY, SLOT_READY, SLOT_BUSY };
+
+struct HistorySlot {
+    int                       state;     // SlotState
+    int                       level;
+    unsigned long long        sequence;  // position in the ring's history
+    const struct DisplaySite *site;
+    const char               *format;    // NULL if `data` is the message text
+    long long                 ns;
+    unsigned int              length;    // bytes used in `data`
+    char                      data[HISTORY_SLOT - 44];
+};
+
+struct HistoryRing {
+    size_t              mask;  // slots - 1
+    unsigned long long  head;  // next sequence number
+    struct HistoryRing *next;  // older rings, replaced by a resize
+    struct HistorySlot  slots[];
+};
+
+// Variables
+int                        __displayHistory;  // recording enabled
+static struct HistoryRing *history;           // NULL until first enabled
+static unsigned long long  historyLost;       // messages that found a busy slot
+static pthread_mutex_t     historyLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+// Keep a message that was not printed. `site` must have a resolved format.
+void historyRemember(struct DisplaySite *site, const char *format,
+    va_list args)
+{
+    struct HistoryRing *ring = __atomic_load_n(&history, __ATOMIC_ACQUIRE);
+    if (ring == NULL) return;
+
+    unsigned long long sequence =
+        __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    struct HistorySlot *slot = &ring->slots[sequence & ring->mask];
+    int state = __atomic_load_n(&slot->state, __ATOMIC_RELAXED);
+    if (state == SLOT_BUSY ||
+        !__atomic_compare_exchange_n(&slot->state, &state, SLOT_BUSY, 0,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        __atomic_add_fetch(&historyLost, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    slot->site  = site;
+    slot->level = site->level;
+    slot->ns    = timestampNow();
+
+    struct DisplayRecord record;
+    recordInit(&record, slot->data, sizeof(slot->data));
+    if (binaryCapture(&record, site, format, args))
+    {
+        slot->format = format;
+        slot->length = (unsigned int)record.length;
+    }
+    else
+    {
+        va_list copy;
+        va_copy(copy, args);
+        int length = printfFormat(slot->data, sizeof(slot->data), format, copy);
+        va_end(copy);
+        if (length < 0) length = 0;
+        if ((size_t)length >= sizeof(slot->data))
+            length = sizeof(slot->data) - 1;
+        slot->format = NULL;
+        slot->length = (unsigned int)length;
+    }
+
+    slot->sequence = sequence;
+    __atomic_store_n(&slot->state, SLOT_READY, __ATOMIC_RELEASE);
+}
+
+// Don't call this function. Used by the Display macros when not printing.
+void __DisplayRemember(struct DisplaySite *site, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    historyRemember(site, format, args);
+    va_end(args);
+}
+
+
+
+// Print the recorded arguments `data` of a message with `format`, one
+// conversion at a time, as display-decode does.
+#define REPLAY_SPEC(record, text, stars, star, value) \
+    ((stars) == 0 ? recordAppendf(record, text, value) : \
+     (stars) == 1 ? recordAppendf(record, text, star[0], value) : \
+                    recordAppendf(record, text, star[0], star[1], value))
+
+static int take(const char **data, const char *end, void *out, size_t size)
+{
+    if ((size_t)(end - *data) < size) return 0;
+    memcpy(out, *data, size);
+    *data += size;
+    return 1;
+}
+
+static void replayLiteral(struct DisplayRecord *record, const char *start,
+    const char *end)
+{
+    for (const char *p = start; p < end; p++)
+    {
+        recordAppend(record, p, 1);
+        if (p[0] == '%' && p + 1 < end && p[1] == '%') p++;
+    }
+}
+
+static void replay(struct DisplayRecord *record, const char *format,
+    const char *data, size_t length)
+{
+    const char        *end    = data + length;
+    const char        *cursor = format;
+    struct FormatSpec  spec;
+
+    for (;;)
+    {
+        const char *literal = cursor;
+        if (!formatNext(&cursor, &spec))
+        {
+            replayLiteral(record, literal, literal + strlen(literal));
+            return;
+        }
+        replayLiteral(record, literal, spec.start);
+
+        int32_t star[2];
+        int     stars = spec.starWidth + spec.starPrecision;
+        for (int i = 0; i < stars; i++)
+            if (!take(&data, end, &star[i], sizeof(star[i]))) return;
+
+        // 64-bit integers were widened to long long when recorded.
+        char   text[64];
+        size_t head = spec.lengthStart - spec.start;
+        if (head > sizeof(text) - 4) return;
+        memcpy(text, spec.start, head);
+        if (spec.arg == ARG_WIDE)
+        {
+            text[head++] = 'l';
+            text[head++] = 'l';
+            text[head++] = spec.conversion;
+        }
+        else
+        {
+            size_t tail = spec.end - spec.lengthStart;
+            if (head + tail >= sizeof(text)) return;
+            memcpy(text + head, spec.lengthStart, tail);
+            head += tail;
+        }
+        text[head] = '\0';
+
+        switch (spec.arg)
+        {
+            case ARG_INT:
+            {
+                int32_t value;
+                if (!take(&data, end, &value, sizeof(value))) return;
+                REPLAY_SPEC(record, text, stars, star, (int)value);
+                break;
+            }
+            case ARG_WIDE:
+            {
+                int64_t value;
+                if (!take(&data, end, &value, sizeof(value))) return;
+                REPLAY_SPEC(record, text, stars, star, (long long)value);
+                break;
+            }
+            case ARG_DOUBLE:
+            {
+                double value;
+                if (!take(&data, end, &value, sizeof(value))) return;
+                REPLAY_SPEC(record, text, stars, star, value);
+                break;
+            }
+            case ARG_LDOUBLE:
+            {
+                long double value;
+                if (!take(&data, end, &value, sizeof(value))) return;
+                REPLAY_SPEC(record, text, stars, star, value);
+                break;
+            }
+            case ARG_POINTER:
+            {
+                uint64_t value;
+                if (!take(&data, end, &value, sizeof(value))) return;
+                REPLAY_SPEC(record, text, stars, star,
+                    (void *)(uintptr_t)value);
+                break;
+            }
+            case ARG_STRING:
+            {
+                uint32_t size;
+                if (!take(&data, end, &size, sizeof(size))) return;
+                if (size == BINARY_NULL)
+                {
+                    REPLAY_SPEC(record, text, stars, star, (char *)NULL);
+                    break;
+                }
+                if ((size_t)(end - data) < size) return;
+                // Terminate the stored bytes for the original specification.
+                char string[HISTORY_SLOT];
+                memcpy(string, data, size);
+                string[size] = '\0';
+                data += size;
+                REPLAY_SPEC(record, text, stars, star, string);
+                break;
+            }
+            default:
+                return;
+        }
+    }
+}
+
+
+
+// Write out and consume every recorded message, oldest first, to the error
+// stream. Returns the number of messages written.
+size_t historyDump()
+{
+    struct HistoryRing *ring = __atomic_load_n(&history, __ATOMIC_ACQUIRE);
+    if (ring == NULL || GetStream(ERROR) == NULL) return 0;
+
+    pthread_mutex_lock(&historyLock);
+    unsigned long long head  = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    unsigned long long first = (head > ring->mask) ? head - ring->mask - 1 : 0;
+    unsigned long long lost  =
+        __atomic_exchange_n(&historyLost, 0, __ATOMIC_RELAXED);
+
+    char                 storage[RECORD_SIZE];
+    struct DisplayRecord record;
+    char                 timestamp[TIMESTAMP_SIZE];
+    timestampFormat(timestamp);
+    recordInit(&record, storage, sizeof(storage));
+    recordAppendf(&record, "[%s][%s] history of silenced messages", timestamp,
+        file);
+    if (lost > 0) recordAppendf(&record, " (%llu lost)", lost);
+    recordAppend(&record, ":\n", 2);
+
+    size_t count = 0;
+    for (unsigned long long sequence = first; sequence < head; sequence++)
+    {
+        struct HistorySlot *slot = &ring->slots[sequence & ring->mask];
+        int state = SLOT_READY;
+        if (!__atomic_compare_exchange_n(&slot->state, &state, SLOT_BUSY, 0,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            continue;  // empty, or being written
+        if (slot->sequence > sequence)
+        {
+            // Already overwritten by a later message.
+            __atomic_store_n(&slot->state, SLOT_READY, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        const char *tag = levelTag(slot->level);
+        timestampFormatAt(slot->ns, timestamp);
+        recordAppendf(&record, "[%s][%s][%s]%s", timestamp, file,
+            slot->site->function, tag != NULL ? tag : " ");
+        if (slot->format != NULL)
+            replay(&record, slot->format, slot->data, slot->length);
+        else
+            recordAppend(&record, slot->data, slot->length);
+        recordAppend(&record, "\n", 1);
+        count++;
+
+        __atomic_store_n(&slot->state, SLOT_EMPTY, __ATOMIC_RELEASE);
+    }
+
+    // Written without the lock: the write takes a stream lock, which a
+    // thread inside DisplayLock() holds while it waits for this one.
+    pthread_mutex_unlock(&historyLock);
+    if (count > 0)
+        displayWrite(ERROR, NULL, LEVEL_ERROR, record.data, record.length);
+    recordDone(&record);
+    return count;
+}
+
+// Write out recorded messages with write(2), for the crash handler. Takes no
+// lock, and leaves alone slots that are being written.
+void historyCrashDump()
+{
+    struct HistoryRing *ring = __atomic_load_n(&history, __ATOMIC_ACQUIRE);
+    if (ring == NULL) return;
+
+    FILE *stream = streams[ERROR];
+    int   fd     = (stream != NULL) ? fileno(stream) : STDERR_FILENO;
+    unsigned long long head  = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    unsigned long long first = (head > ring->mask) ? head - ring->mask - 1 : 0;
+    for (unsigned long long sequence = first; sequence < head; sequence++)
+    {
+        struct HistorySlot *slot = &ring->slots[sequence & ring->mask];
+        int state = SLOT_READY;
+        if (!__atomic_compare_exchange_n(&slot->state, &state, SLOT_BUSY, 0,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            continue;
+        if (slot->sequence <= sequence)
+            crashReplay(fd, slot->ns, slot->site->function, slot->level,
+                slot->format, slot->data, slot->length);
+        __atomic_store_n(&slot->state, SLOT_EMPTY, __ATOMIC_RELEASE);
+    }
+}
+
+
+
+// Keep the last `messages` silenced messages in memory (rounded up to a power
+// of two), or none (0, the default).
+size_t GetHistorySize()
+{
+    struct HistoryRing *ring = __atomic_load_n(&history, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&__displayHistory, __ATOMIC_RELAXED) ?
+        ring->mask + 1 : 0;
+}
+int SetHistorySize(size_t messages)
+{
+    pthread_mutex_lock(&historyLock);
+    if (messages == 0)
+    {
+        __atomic_store_n(&__displayHistory, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&historyLock);
+        return 0;
+    }
+
+    size_t slots = 1;
+    while (slots < messages) slots *= 2;
+    if (history == NULL || history->mask + 1 != slots)
+    {
+        struct HistoryRing *ring = calloc(1, sizeof(*ring) +
+            slots * sizeof(struct HistorySlot));
+        if (ring == NULL)
+        {
+            pthread_mutex_unlock(&historyLock);
+            return -1;
+        }
+        ring->mask = slots - 1;
+
+        // Writers may still be filling a slot of the old ring, so it is kept.
+        ring->next = history;
+        __atomic_store_n(&history, ring, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&__displayHistory, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&historyLock);
+    return 0;
+}
+
+// Print and forget every message kept by the flight recorder.
+int DisplayDumpHistory()
+{
+    return (int)historyDump();
+}
@@ -0,0 +1,148 @@
+#include "DisplayPrivate.h"
+
+// Runtime severity thresholds. Every source file that logs gets a slot holding
+// its current threshold, and each call site points at the slot of its file
+// once it has been used, so the macros can filter with a single relaxed load.
+// Slots are never moved or freed, which keeps those pointers valid.
+
+#define MAX_FILES 256  // distinct source files with their own threshold
+
+struct FileLevel {
+    char name[32];    // source file basename
+    int  threshold;   // current threshold, read with relaxed atomics
+    int  overridden;  // set explicitly, ignores SetDisplayLevel()
+};
+
+// Variables
+int                     __displayUnresolved = LEVEL_TRACE;  // initial slot
+static int              defaultLevel        = LEVEL_INFO;
+static int              defaultThreshold    = LEVEL_INFO;   // table overflow
+static const int        siteOn              = LEVEL_TRACE;  // SITE_ENABLED
+static struct FileLevel files[MAX_FILES];
+static int              fileCount;
+static pthread_mutex_t  levelLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+static const char *fileBasename(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return (slash != NULL) ? slash + 1 : path;
+}
+
+static int validLevel(int level)
+{
+    return level >= LEVEL_TRACE && level <= LEVEL_ERROR + 1;
+}
+
+// Find the slot for `name`, creating it if needed. Called with levelLock held.
+// Returns NULL when the table is full.
+static struct FileLevel *fileFind(const char *name)
+{
+    for (int i = 0; i < fileCount; i++)
+        if (strncmp(files[i].name, name, sizeof(files[i].name) - 1) == 0)
+            return &files[i];
+
+    if (fileCount == MAX_FILES) return NULL;
+    struct FileLevel *entry = &files[fileCount++];
+    strncpy(entry->name, name, sizeof(entry->name) - 1);
+    __atomic_store_n(&entry->threshold, defaultLevel, __ATOMIC_RELAXED);
+    entry->overridden = 0;
+    return entry;
+}
+
+
+// Set the threshold of every file without its own. Messages below `level`
+// are not printed. The default is LEVEL_INFO, and LEVEL_ERROR + 1 silences
+// everything, errors included.
+int GetDisplayLevel() { return defaultLevel; }
+int SetDisplayLevel(int level)
+{
+    if (!validLevel(level))
+    {
+        fprintf(stderr, "ERROR: Invalid display level.\n");
+        exit(1);
+    }
+
+    pthread_mutex_lock(&levelLock);
+    defaultLevel = level;
+    __atomic_store_n(&defaultThreshold, level, __ATOMIC_RELAXED);
+    for (int i = 0; i < fileCount; i++)
+        if (!files[i].overridden)
+            __atomic_store_n(&files[i].threshold, level, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&levelLock);
+    return 0;
+}
+
+
+// Set the threshold of one source file, given by name or path (only the
+// basename is used).
+int GetFileDisplayLevel(const char *name)
+{
+    pthread_mutex_lock(&levelLock);
+    struct FileLevel *entry = fileFind(fileBasename(name));
+    int level = (entry != NULL) ? entry->threshold : defaultLevel;
+    pthread_mutex_unlock(&levelLock);
+    return level;
+}
+int SetFileDisplayLevel(const char *name, int level)
+{
+    if (!validLevel(level))
+    {
+        fprintf(stderr, "ERROR: Invalid display level.\n");
+        exit(1);
+    }
+
+    pthread_mutex_lock(&levelLock);
+    struct FileLevel *entry = fileFind(fileBasename(name));
+    if (entry != NULL)
+    {
+        entry->overridden = 1;
+        __atomic_store_n(&entry->threshold, level, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&levelLock);
+    return (entry != NULL) ? 0 : -1;
+}
+
+
+// Threshold slot of a site's source file. Called with levelLock held.
+static const int *fileSlot(struct DisplaySite *site)
+{
+    struct FileLevel *entry = fileFind(fileBasename(site->file));
+    return (entry != NULL) ? &entry->threshold : &defaultThreshold;
+}
+
+// Point a call site at the threshold slot of its source file. Returns 1 if
+// the message should be printed.
+int levelResolve(struct DisplaySite *site)
+{
+    pthread_mutex_lock(&levelLock);
+
+    // SetSiteState() got there first; keep its threshold.
+    const int *slot = __atomic_load_n(&site->threshold, __ATOMIC_RELAXED);
+    if (site->state == SITE_DEFAULT)
+    {
+        slot = fileSlot(site);
+        __atomic_store_n(&site->threshold, slot, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&levelLock);
+    return slot != NULL &&
+           site->level >= __atomic_load_n(slot, __ATOMIC_RELAXED);
+}
+
+// Enable, disable or restore a call site by pointing it at a fixed threshold,
+// at none, or back at its file's. Returns 1 if its state changed.
+int levelSiteState(struct DisplaySite *site, int state)
+{
+    pthread_mutex_lock(&levelLock);
+    int changed = (site->state != state);
+    if (changed)
+    {
+        const int *slot = (state == SITE_ENABLED)  ? &siteOn :
+                          (state == SITE_DISABLED) ? NULL : fileSlot(site);
+        site->state = state;
+        __atomic_store_n(&site->threshold, slot, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&levelLock);
+    return changed;
+}
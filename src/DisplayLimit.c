@@ -0,0 +1,37 @@
+#include "DisplayPrivate.h"
+
+// Rate limiting for DisplayRateLimited(). Each call site keeps a single 64-bit
+// word, the "theoretical arrival time" of the generic cell rate algorithm: the
+// moment the site's budget will be fully replenished. A message is allowed if
+// that moment is less than one second away, and pushes it forward by one
+// interval. This allows bursts of up to `perSecond` messages and a steady
+// `perSecond` rate after that, with one compare-and-swap and no lock.
+
+#define NSEC_PER_SEC 1000000000ULL
+
+
+
+// Do not call this function, use `DisplayRateLimited()` instead.
+int __DisplayRateAllow(unsigned long long *state, unsigned long perSecond)
+{
+    if (perSecond == 0) return 0;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    unsigned long long now      = ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+    unsigned long long interval = NSEC_PER_SEC / perSecond;
+    if (interval == 0) interval = 1;
+    unsigned long long burst    = NSEC_PER_SEC - interval;
+
+    unsigned long long arrival = __atomic_load_n(state, __ATOMIC_RELAXED);
+    unsigned long long next;
+    do
+    {
+        unsigned long long base = (arrival > now) ? arrival : now;
+        if (base - now > burst) return 0;
+        next = base + interval;
+    }
+    while (!__atomic_compare_exchange_n(state, &arrival, next, 1,
+               __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return 1;
+}
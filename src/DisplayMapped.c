@@ -0,0 +1,240 @@
+#include "DisplayPrivate.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Memory-mapped log files. Writers reserve space with a fetch-add on the
+// file's write offset and copy their record straight into a shared mapping,
+// so logging a line never makes a system call and never takes a lock. The
+// file grows one chunk at a time: the first writer to reach a chunk extends
+// the file and maps it (and the one after it, so the next writer rarely has
+// to), and the last writer to finish a chunk unmaps it again.
+//
+// Everything written is in the page cache as soon as the copy completes, so it
+// survives a crash of the process. Space reserved by a writer that crashed
+// mid-copy, and the unused end of the last chunk, read back as NUL bytes until
+// the file is closed and trimmed.
+
+#define CHUNKS_PER_BLOCK 1024  // chunk slots allocated together
+#define MAX_BLOCKS       1024  // so at most 1M chunks per file
+#define CHUNK_DONE       ((char *)1)  // chunk fully written and unmapped
+
+struct MappedChunk {
+    char   *map;        // NULL until mapped, CHUNK_DONE once released
+    size_t  committed;  // bytes written so far
+};
+
+struct DisplayMappedFile {
+    int                 fd;
+    size_t              chunkSize;   // multiple of the page size
+    size_t              offset;      // next byte to reserve
+    size_t              start;       // file size when opened
+    int                 failed;      // could not grow the file, drop writes
+    pthread_mutex_t     growLock;    // serializes mapping new chunks
+    struct MappedChunk *blocks[MAX_BLOCKS];
+};
+
+// Variables
+struct DisplayMappedFile *mappedStreams[3];  // per PrintType, NULL if unused
+
+
+
+// Return the slot of chunk `index`, allocating its block if needed.
+static struct MappedChunk *chunkSlot(struct DisplayMappedFile *file,
+    size_t index)
+{
+    size_t block = index / CHUNKS_PER_BLOCK;
+    if (block >= MAX_BLOCKS) return NULL;
+
+    struct MappedChunk *slots = __atomic_load_n(&file->blocks[block],
+        __ATOMIC_ACQUIRE);
+    if (slots == NULL)
+    {
+        struct MappedChunk *fresh = calloc(CHUNKS_PER_BLOCK, sizeof(*fresh));
+        if (fresh == NULL) return NULL;
+        if (__atomic_compare_exchange_n(&file->blocks[block], &slots, fresh, 0,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            slots = fresh;
+        else
+            free(fresh);  // another writer allocated it first
+    }
+    return &slots[index % CHUNKS_PER_BLOCK];
+}
+
+// Extend the file to cover chunk `index` and map it. Called with growLock held.
+static char *chunkMap(struct DisplayMappedFile *file, size_t index)
+{
+    struct MappedChunk *slot = chunkSlot(file, index);
+    if (slot == NULL) return NULL;
+
+    char *map = __atomic_load_n(&slot->map, __ATOMIC_ACQUIRE);
+    if (map != NULL) return map;
+
+    // Allocate the blocks up front: a write to a sparse mapping on a full
+    // disk raises SIGBUS, a failed fallocate just stops the logging.
+    off_t base = (off_t)(index * file->chunkSize);
+    if (posix_fallocate(file->fd, base, (off_t)file->chunkSize) != 0)
+        return NULL;
+    map = mmap(NULL, file->chunkSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+        file->fd, base);
+    if (map == MAP_FAILED) return NULL;
+
+    __atomic_store_n(&slot->map, map, __ATOMIC_RELEASE);
+    return map;
+}
+
+// Return the mapping of chunk `index`, creating it on first use.
+static char *chunkGet(struct DisplayMappedFile *file, size_t index)
+{
+    struct MappedChunk *slot = chunkSlot(file, index);
+    if (slot == NULL) return NULL;
+
+    char *map = __atomic_load_n(&slot->map, __ATOMIC_ACQUIRE);
+    if (map != NULL) return map;
+
+    pthread_mutex_lock(&file->growLock);
+    map = chunkMap(file, index);
+    if (map != NULL)
+        chunkMap(file, index + 1);  // read-ahead for the next writer
+    else
+        __atomic_store_n(&file->failed, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&file->growLock);
+    return map;
+}
+
+// Account for `length` bytes written to chunk `index`, releasing the mapping
+// once the whole chunk has been written.
+static void chunkCommit(struct DisplayMappedFile *file, size_t index,
+    size_t length)
+{
+    struct MappedChunk *slot = chunkSlot(file, index);
+    if (__atomic_add_fetch(&slot->committed, length, __ATOMIC_ACQ_REL) ==
+        file->chunkSize)
+    {
+        char *map = __atomic_exchange_n(&slot->map, CHUNK_DONE,
+            __ATOMIC_ACQ_REL);
+        munmap(map, file->chunkSize);
+    }
+}
+
+
+// Append a finished record to `file`.
+void mappedWrite(struct DisplayMappedFile *file, const char *buffer,
+    size_t length)
+{
+    if (length == 0 || __atomic_load_n(&file->failed, __ATOMIC_RELAXED))
+        return;
+
+    size_t position = __atomic_fetch_add(&file->offset, length,
+        __ATOMIC_RELAXED);
+
+    // A record may straddle chunk boundaries.
+    while (length > 0)
+    {
+        size_t index  = position / file->chunkSize;
+        size_t within = position % file->chunkSize;
+        size_t part   = file->chunkSize - within;
+        if (part > length) part = length;
+
+        char *map = chunkGet(file, index);
+        if (map == NULL) return;
+        memcpy(map + within, buffer, part);
+        chunkCommit(file, index, part);
+
+        position += part;
+        buffer   += part;
+        length   -= part;
+    }
+}
+
+
+
+// Open (or create) a log file for memory-mapped writing. New lines are
+// appended after any existing contents.
+struct DisplayMappedFile *OpenMappedFile(const char *path, size_t chunkSize)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    if (chunkSize == 0) chunkSize = DEFAULT_MAPPED_CHUNK;
+    chunkSize = (chunkSize + page - 1) / page * page;
+
+    struct DisplayMappedFile *file = calloc(1, sizeof(*file));
+    if (file == NULL) return NULL;
+
+    struct stat info;
+    file->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (file->fd < 0 || fstat(file->fd, &info) != 0)
+    {
+        if (file->fd >= 0) close(file->fd);
+        free(file);
+        return NULL;
+    }
+
+    file->chunkSize = chunkSize;
+    file->start     = (size_t)info.st_size;
+    file->offset    = file->start;
+    pthread_mutex_init(&file->growLock, NULL);
+
+    // The existing contents count as written.
+    size_t index = file->start / chunkSize;
+    if (file->start % chunkSize != 0)
+    {
+        struct MappedChunk *slot = chunkSlot(file, index);
+        if (slot != NULL) slot->committed = file->start % chunkSize;
+    }
+    for (size_t i = 0; i < index; i++)
+    {
+        struct MappedChunk *slot = chunkSlot(file, i);
+        if (slot != NULL) slot->map = CHUNK_DONE;
+    }
+    return file;
+}
+
+
+// Unmap and close a file opened with OpenMappedFile(), trimming the unused
+// part of the last chunk. Stop logging to it first (SetMappedStream()).
+int CloseMappedFile(struct DisplayMappedFile *file)
+{
+    if (file == NULL) return -1;
+
+    for (int i = STANDARD; i <= ERROR; i++)
+        if (mappedStreams[i] == file)
+            SetMappedStream(i, NULL);
+
+    for (size_t block = 0; block < MAX_BLOCKS; block++)
+    {
+        struct MappedChunk *slots = file->blocks[block];
+        if (slots == NULL) continue;
+        for (size_t i = 0; i < CHUNKS_PER_BLOCK; i++)
+            if (slots[i].map != NULL && slots[i].map != CHUNK_DONE)
+                munmap(slots[i].map, file->chunkSize);
+        free(slots);
+    }
+
+    int result = ftruncate(file->fd, (off_t)file->offset);
+    close(file->fd);
+    pthread_mutex_destroy(&file->growLock);
+    free(file);
+    return result;
+}
+
+
+// Send one PrintType to a memory-mapped file instead of its FILE* stream.
+// NULL reverts to the stream set with SetStream().
+struct DisplayMappedFile *GetMappedStream(int streamType)
+{
+    if (streamType >= STANDARD && streamType <= ERROR)
+        return __atomic_load_n(&mappedStreams[streamType], __ATOMIC_ACQUIRE);
+    else
+        return NULL;
+}
+int SetMappedStream(int streamType, struct DisplayMappedFile *file)
+{
+    if (streamType < STANDARD || streamType > ERROR)
+    {
+        fprintf(stderr, "ERROR: Invalid stream type. See PrintType enum.");
+        exit(1);
+    }
+    __atomic_store_n(&mappedStreams[streamType], file, __ATOMIC_RELEASE);
+    return 0;
+}
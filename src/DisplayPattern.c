@@ -0,0 +1,259 @@
+#include "DisplayPrivate.h"
+
+// Header layout. A pattern such as "[%T][%P][%f]%t%V" is compiled once, when
+// it is set, into a short list of operations: runs of literal text and the
+// fields between them. Printing a header then just walks the list, copying
+// each piece into the record, with no parsing and no printf.
+//
+// Replaced patterns are never freed, since another thread may still be running
+// one. They are small and rarely changed.
+
+#define DEFAULT_PATTERN "[%T][%P][%f]%t%V"  // the historical header
+
+enum PatternOpKind {
+    OP_TEXT,         // literal text
+    OP_TIME,         // %T
+    OP_FRACTION,     // %m, %u, %n
+    OP_PROGRAM,      // %P
+    OP_FILE,         // %F
+    OP_LINE,         // %l
+    OP_FUNCTION,     // %f
+    OP_LEVEL,        // %L
+    OP_LEVEL_TAG,    // %V
+    OP_THREAD_TAG,   // %t
+    OP_THREAD_ID,    // %i
+    OP_THREAD_NAME   // %N
+};
+
+// What a pattern needs computed before it runs.
+#define NEEDS_TIME   1
+#define NEEDS_THREAD 2
+
+struct PatternOp {
+    unsigned char  kind;
+    unsigned char  digits;  // OP_FRACTION
+    unsigned short length;  // OP_TEXT
+    unsigned int   offset;  // OP_TEXT, into `text`
+};
+
+struct DisplayPattern {
+    const char             *source;  // as passed to SetDisplayPattern()
+    const char             *text;    // literal text of all OP_TEXT ops
+    int                     needs;
+    int                     count;
+    const struct PatternOp *ops;
+};
+
+// Variables
+static struct DisplayPattern *pattern;  // NULL until first used
+
+
+
+// Compile `source`, or return NULL if it contains an unknown field.
+static struct DisplayPattern *patternCompile(const char *source)
+{
+    size_t length = strlen(source);
+
+    // One allocation: the pattern, at most one op per character, the literal
+    // text and a copy of the source.
+    size_t opsSize = (length + 1) * sizeof(struct PatternOp);
+    struct DisplayPattern *compiled = malloc(sizeof(*compiled) + opsSize +
+        2 * (length + 1));
+    if (compiled == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory for display pattern.\n");
+        exit(1);
+    }
+    struct PatternOp *ops  = (struct PatternOp *)(compiled + 1);
+    char             *text = (char *)ops + opsSize;
+    char             *copy = text + length + 1;
+    memcpy(copy, source, length + 1);
+
+    int    count   = 0;
+    int    needs   = 0;
+    size_t written = 0;
+    for (const char *c = source; *c != '\0'; c++)
+    {
+        // Literal character, appended to the current text run.
+        if (*c != '%' || c[1] == '%')
+        {
+            if (count == 0 || ops[count - 1].kind != OP_TEXT)
+                ops[count++] = (struct PatternOp){ OP_TEXT, 0, 0, written };
+            text[written++] = *c;
+            ops[count - 1].length++;
+            if (*c == '%') c++;
+            continue;
+        }
+
+        struct PatternOp op = { OP_TEXT, 0, 0, 0 };
+        switch (*++c)
+        {
+            case 'T': op.kind = OP_TIME;        needs |= NEEDS_TIME;   break;
+            case 'm': op.kind = OP_FRACTION;    op.digits = 3;
+                                                needs |= NEEDS_TIME;   break;
+            case 'u': op.kind = OP_FRACTION;    op.digits = 6;
+                                                needs |= NEEDS_TIME;   break;
+            case 'n': op.kind = OP_FRACTION;    op.digits = 9;
+                                                needs |= NEEDS_TIME;   break;
+            case 'P': op.kind = OP_PROGRAM;                            break;
+            case 'F': op.kind = OP_FILE;                               break;
+            case 'l': op.kind = OP_LINE;                               break;
+            case 'f': op.kind = OP_FUNCTION;                           break;
+            case 'L': op.kind = OP_LEVEL;                              break;
+            case 'V': op.kind = OP_LEVEL_TAG;                          break;
+            case 't': op.kind = OP_THREAD_TAG;                         break;
+            case 'i': op.kind = OP_THREAD_ID;   needs |= NEEDS_THREAD; break;
+            case 'N': op.kind = OP_THREAD_NAME; needs |= NEEDS_THREAD; break;
+            default:
+                free(compiled);
+                return NULL;
+        }
+        ops[count++] = op;
+    }
+
+    text[written]    = '\0';
+    compiled->source = copy;
+    compiled->text   = text;
+    compiled->needs  = needs;
+    compiled->count  = count;
+    compiled->ops    = ops;
+    return compiled;
+}
+
+
+// Set the layout of the trace header. NULL restores the default.
+const char *GetDisplayPattern()
+{
+    struct DisplayPattern *current = __atomic_load_n(&pattern, __ATOMIC_ACQUIRE);
+    return (current != NULL) ? current->source : DEFAULT_PATTERN;
+}
+int SetDisplayPattern(const char *source)
+{
+    struct DisplayPattern *compiled =
+        patternCompile(source != NULL ? source : DEFAULT_PATTERN);
+    if (compiled == NULL)
+    {
+        fprintf(stderr, "ERROR: Invalid display pattern.\n");
+        exit(1);
+    }
+    __atomic_store_n(&pattern, compiled, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+
+// Append `value` in decimal.
+static void appendDecimal(struct DisplayRecord *record, long long value)
+{
+    char  digits[24];
+    char *end   = digits + sizeof(digits);
+    char *start = end;
+    unsigned long long magnitude = (value < 0) ? -(unsigned long long)value :
+        (unsigned long long)value;
+    do
+    {
+        *--start   = '0' + (char)(magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) *--start = '-';
+    recordAppend(record, start, (size_t)(end - start));
+}
+
+// Append the first `count` digits of the sub-second part of `ns`.
+static void appendFraction(struct DisplayRecord *record, long long ns,
+    int count)
+{
+    char      digits[9];
+    long long fraction = ns % 1000000000LL;
+    for (int i = 8; i >= 0; i--)
+    {
+        digits[i] = '0' + (char)(fraction % 10);
+        fraction /= 10;
+    }
+    recordAppend(record, digits, (size_t)count);
+}
+
+
+// Append the trace header of a message to `record`. `site` may be NULL.
+void patternAppend(struct DisplayRecord *record, const struct DisplaySite *site,
+    const char *function, int level)
+{
+    struct DisplayPattern *current = __atomic_load_n(&pattern, __ATOMIC_ACQUIRE);
+    if (current == NULL)
+    {
+        // First message: compile the default, unless another thread beat us.
+        struct DisplayPattern *compiled = patternCompile(DEFAULT_PATTERN);
+        if (__atomic_compare_exchange_n(&pattern, &current, compiled, 0,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            current = compiled;
+        else
+            free(compiled);
+    }
+
+    long long   ns = 0;
+    const char *name = "";
+    int         thread = 0;
+    if (current->needs & NEEDS_TIME)   ns     = timestampNow();
+    if (current->needs & NEEDS_THREAD) thread = threadIdentity(&name);
+
+    for (int i = 0; i < current->count; i++)
+    {
+        const struct PatternOp *op = &current->ops[i];
+        switch (op->kind)
+        {
+            case OP_TEXT:
+                recordAppend(record, current->text + op->offset, op->length);
+                break;
+            case OP_TIME:
+            {
+                char   timestamp[TIMESTAMP_SIZE];
+                size_t length = timestampFormatAt(ns, timestamp);
+                recordAppend(record, timestamp, length);
+                break;
+            }
+            case OP_FRACTION:
+                appendFraction(record, ns, op->digits);
+                break;
+            case OP_PROGRAM:
+                recordAppendString(record, file);
+                break;
+            case OP_FILE:
+            {
+                // Legacy __Display() calls have no site; show the program.
+                const char *path  = (site != NULL) ? site->file : file;
+                const char *slash = strrchr(path, '/');
+                recordAppendString(record, (slash != NULL) ? slash + 1 : path);
+                break;
+            }
+            case OP_LINE:
+                if (site != NULL) appendDecimal(record, site->line);
+                else              recordAppend(record, "?", 1);
+                break;
+            case OP_FUNCTION:
+                recordAppendString(record, function);
+                break;
+            case OP_LEVEL:
+                recordAppendString(record, levelName(level));
+                break;
+            case OP_LEVEL_TAG:
+            {
+                const char *tag = levelTag(level);
+                recordAppendString(record, (tag != NULL) ? tag : " ");
+                break;
+            }
+            case OP_THREAD_TAG:
+            {
+                size_t      length;
+                const char *tag = threadTag(&length);
+                recordAppend(record, tag, length);
+                break;
+            }
+            case OP_THREAD_ID:
+                appendDecimal(record, thread);
+                break;
+            case OP_THREAD_NAME:
+                recordAppendString(record, name);
+                break;
+        }
+    }
+}
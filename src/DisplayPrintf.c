@@ -0,0 +1,704 @@
+#include "DisplayPrivate.h"
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Formatting of messages without vsnprintf(). printfFormat() has the contract
+// of vsnprintf() and handles the conversions messages are made of: d i u o x
+// X c s p f F e E g G and %%, with every flag, width, precision (including
+// '*') and length modifier glibc accepts for them. Integers are converted two
+// digits at a time from a table of digit pairs.
+//
+// Floating-point values are converted exactly: the value is scaled by a power
+// of ten and rounded (ties to even, as glibc does) in 128-bit integer
+// arithmetic, so the digits match glibc's byte for byte. Values whose scaled
+// form does not fit in 128 bits, precisions above MAX_SCALE, infinities, NaNs
+// and long doubles are left to vsnprintf(), as are %a, %n, %m, wide
+// characters, positional arguments and the ' and I flags: on any of those the
+// whole message is formatted again by vsnprintf() from the start.
+
+#define MAX_SCALE   27        // largest power of five in pow5Table
+#define MAX_WIDTH   (1 << 24) // wider fields are left to vsnprintf()
+#define UNSUPPORTED (-2)
+
+typedef unsigned __int128 uint128;
+
+// A message being formatted. Bytes past `size` - 1 are counted, not written.
+struct Output {
+    char   *data;
+    size_t  size;    // including the NUL
+    size_t  length;  // bytes the complete message takes
+};
+
+// One parsed conversion specification.
+struct Conversion {
+    int  left;       // '-'
+    int  plus;       // '+'
+    int  space;      // ' '
+    int  alt;        // '#'
+    int  zero;       // '0'
+    int  width;
+    int  precision;  // -1 if none
+};
+
+static const char digitPairs[201] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+static const uint64_t pow10Table[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static const uint64_t pow5Table[MAX_SCALE + 1] = {
+    1ULL, 5ULL, 25ULL, 125ULL, 625ULL, 3125ULL, 15625ULL, 78125ULL,
+    390625ULL, 1953125ULL, 9765625ULL, 48828125ULL, 244140625ULL,
+    1220703125ULL, 6103515625ULL, 30517578125ULL, 152587890625ULL,
+    762939453125ULL, 3814697265625ULL, 19073486328125ULL, 95367431640625ULL,
+    476837158203125ULL, 2384185791015625ULL, 11920928955078125ULL,
+    59604644775390625ULL, 298023223876953125ULL, 1490116119384765625ULL,
+    7450580596923828125ULL
+};
+
+// Variables
+static int fastFormat = ENABLE;
+
+
+
+// memcpy() of up to 16 bytes as two overlapping loads and stores, without
+// the call: messages are made of short pieces.
+static inline void copy(char *to, const char *from, size_t length)
+{
+    if (length >= 8 && length <= 16)
+    {
+        uint64_t head, tail;
+        memcpy(&head, from, 8);
+        memcpy(&tail, from + length - 8, 8);
+        memcpy(to, &head, 8);
+        memcpy(to + length - 8, &tail, 8);
+    }
+    else if (length >= 4 && length < 8)
+    {
+        uint32_t head, tail;
+        memcpy(&head, from, 4);
+        memcpy(&tail, from + length - 4, 4);
+        memcpy(to, &head, 4);
+        memcpy(to + length - 4, &tail, 4);
+    }
+    else if (length > 0 && length < 4)
+    {
+        to[0]          = from[0];
+        to[length / 2] = from[length / 2];
+        to[length - 1] = from[length - 1];
+    }
+    else if (length > 16)
+        memcpy(to, from, length);
+}
+
+static inline void put(struct Output *out, const char *text, size_t length)
+{
+    if (out->length + 1 < out->size)
+    {
+        size_t room = out->size - 1 - out->length;
+        copy(out->data + out->length, text, (length < room) ? length : room);
+    }
+    out->length += length;
+}
+
+static inline void putFill(struct Output *out, char c, size_t count)
+{
+    if (out->length + 1 < out->size)
+    {
+        size_t room = out->size - 1 - out->length;
+        memset(out->data + out->length, c, (count < room) ? count : room);
+    }
+    out->length += count;
+}
+
+// Write a field of `width`: sign, prefix, `zeros` zeros, then `count` bytes of
+// `text`, padded with spaces (or zeros after the prefix if `zero`). Empty
+// pieces cost no call.
+static void putField(struct Output *out, const struct Conversion *c, int zero,
+    char sign, const char *prefix, size_t prefixLength, size_t zeros,
+    const char *text, size_t count)
+{
+    size_t length = (sign != 0) + prefixLength + zeros + count;
+    size_t pad    = ((size_t)c->width > length) ? c->width - length : 0;
+
+    if (pad > 0 && !c->left && !zero) putFill(out, ' ', pad);
+    if (sign != 0) put(out, &sign, 1);
+    if (prefixLength > 0) put(out, prefix, prefixLength);
+    if (pad > 0 && !c->left && zero) putFill(out, '0', pad);
+    if (zeros > 0) putFill(out, '0', zeros);
+    put(out, text, count);
+    if (pad > 0 && c->left) putFill(out, ' ', pad);
+}
+
+
+// Digits of `value`, written backwards so they end at `end`. Return the first.
+static char *decimal(char *end, uint64_t value)
+{
+    while (value >= 100)
+    {
+        unsigned pair = (unsigned)(value % 100) * 2;
+        value /= 100;
+        end -= 2;
+        memcpy(end, digitPairs + pair, 2);
+    }
+    if (value >= 10)
+    {
+        end -= 2;
+        memcpy(end, digitPairs + value * 2, 2);
+    }
+    else
+        *--end = '0' + value;
+    return end;
+}
+
+// Number of decimal digits of `value`.
+static inline size_t decimalCount(uint64_t value)
+{
+    size_t guess = ((64 - __builtin_clzll(value | 1)) * 1233) >> 12;
+    return guess + (value >= pow10Table[guess]) + (value == 0);
+}
+
+// A plain %d %i or %u with its sign, written in place when it fits, without
+// the field layout of putInteger().
+static inline void putDecimal(struct Output *out, uint64_t value, char sign)
+{
+    size_t count = decimalCount(value) + (sign != 0);
+    if (out->length + count < out->size)
+    {
+        char *start = decimal(out->data + out->length + count, value);
+        if (sign != 0) start[-1] = sign;
+        out->length += count;
+    }
+    else
+    {
+        char  digits[24];
+        char *start = decimal(digits + sizeof(digits), value);
+        if (sign != 0) *--start = sign;
+        put(out, start, digits + sizeof(digits) - start);
+    }
+}
+
+static char *decimalWide(char *end, uint128 value)
+{
+    const uint64_t chunk = pow10Table[19];
+    while (value > UINT64_MAX)
+    {
+        uint128 high  = value / chunk;
+        char   *start = decimal(end, (uint64_t)(value - high * chunk));
+        while (end - start < 19) *--start = '0';
+        end   = start;
+        value = high;
+    }
+    return decimal(end, (uint64_t)value);
+}
+
+static char *hexadecimal(char *end, uint64_t value, int upper)
+{
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    do *--end = digits[value & 15]; while ((value >>= 4) != 0);
+    return end;
+}
+
+static char *octal(char *end, uint64_t value)
+{
+    do *--end = '0' + (value & 7); while ((value >>= 3) != 0);
+    return end;
+}
+
+static void putInteger(struct Output *out, const struct Conversion *c,
+    uint64_t magnitude, char sign, int base, int upper)
+{
+    char  digits[24];
+    char *end   = digits + sizeof(digits);
+    char *start = end;
+    if (magnitude != 0 || c->precision != 0)
+        start = (base == 10) ? decimal(end, magnitude) :
+            (base == 16) ? hexadecimal(end, magnitude, upper) :
+            octal(end, magnitude);
+
+    size_t count = end - start;
+    size_t zeros = ((size_t)c->precision > count && c->precision > 0) ?
+        c->precision - count : 0;
+    int prefixed = (c->alt && base == 16 && magnitude != 0);
+    if (c->alt && base == 8 && zeros == 0 && (count == 0 || *start != '0'))
+        zeros = 1;
+    putField(out, c, c->zero && !c->left && c->precision < 0, sign,
+        upper ? "0X" : "0x", prefixed ? 2 : 0, zeros, start, count);
+}
+
+
+static uint128 power10(int n)
+{
+    return (n <= 19) ? pow10Table[n] : (uint128)pow10Table[19] *
+        pow10Table[n - 19];
+}
+
+// |value| * 10^scale, rounded to an integer with ties to even. Returns 0 if
+// it cannot be computed exactly in 128 bits.
+static int scaled(double value, int scale, uint128 *result)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int      biased   = (bits >> 52) & 0x7ff;
+    uint64_t mantissa = bits & ((1ULL << 52) - 1);
+    int      exponent = -1074;
+    if (biased != 0)
+    {
+        mantissa |= 1ULL << 52;
+        exponent  = biased - 1075;
+    }
+    if (mantissa == 0)
+    {
+        *result = 0;
+        return 1;
+    }
+    if (scale > MAX_SCALE || scale < -MAX_SCALE) return 0;
+
+    // |value| * 10^scale = mantissa * 5^scale * 2^(exponent + scale)
+    uint128 num   = mantissa;
+    uint128 den   = 1;
+    int     shift = exponent + scale;
+    if (scale >= 0)
+        num *= pow5Table[scale];
+    else
+        den = pow5Table[-scale];
+
+    if (shift >= 0)
+    {
+        if (shift >= 127 || (num >> (127 - shift)) != 0) return 0;
+        num <<= shift;
+    }
+    else if (den == 1)
+    {
+        if (-shift >= 127)
+        {
+            *result = 0;  // num < 2^117: less than a half
+            return 1;
+        }
+        uint128 quotient = num >> -shift;
+        uint128 rest     = num - (quotient << -shift);
+        uint128 half     = (uint128)1 << (-shift - 1);
+        if (rest > half || (rest == half && (quotient & 1))) quotient++;
+        *result = quotient;
+        return 1;
+    }
+    else
+    {
+        if (-shift >= 127 || (den >> (127 + shift)) != 0) return 0;
+        den <<= -shift;
+    }
+
+    uint128 quotient = num / den;
+    uint128 rest     = num - quotient * den;
+    if (rest > den - rest || (rest == den - rest && (quotient & 1)))
+        quotient++;
+    *result = quotient;
+    return 1;
+}
+
+// The first `digits` significant digits of |value|, rounded, and the decimal
+// exponent of the first one, as %e shows them. Returns 0 if out of range.
+static int significant(double value, int digits, uint128 *result,
+    int *exponent)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int      biased   = (bits >> 52) & 0x7ff;
+    uint64_t mantissa = bits & ((1ULL << 52) - 1);
+    if (biased == 0 && mantissa == 0)
+    {
+        *result   = 0;
+        *exponent = 0;
+        return 1;
+    }
+
+    // floor(log10(2^n)) is (n * 78913) >> 18. For the largest power of two
+    // not above |value| that is the decimal exponent, or one less.
+    int power = (biased != 0) ? biased - 1023 :
+        -1074 + 63 - __builtin_clzll(mantissa);
+    int k = (power * 78913) >> 18;
+    if (!scaled(value, digits - 1 - k, result)) return 0;
+    if (*result >= power10(digits))
+    {
+        k++;
+        if (!scaled(value, digits - 1 - k, result)) return 0;
+    }
+    *exponent = k;
+    return 1;
+}
+
+// `scaled` as a number with `precision` digits after the point.
+static size_t fixed(char *out, uint128 scaled, int precision, int alt)
+{
+    char  digits[48];
+    char *end   = digits + sizeof(digits);
+    char *start = decimalWide(end, scaled);
+    while (end - start < precision + 1) *--start = '0';
+
+    size_t whole = end - start - precision;
+    memcpy(out, start, whole);
+    size_t length = whole;
+    if (precision > 0 || alt) out[length++] = '.';
+    memcpy(out + length, start + whole, precision);
+    return length + precision;
+}
+
+// `scaled`, which has `precision` + 1 digits, times 10^`exponent`.
+static size_t exponential(char *out, uint128 scaled, int precision,
+    int exponent, int alt, int upper)
+{
+    char  digits[48];
+    char *end   = digits + sizeof(digits);
+    char *start = decimalWide(end, scaled);
+    while (end - start < precision + 1) *--start = '0';
+
+    size_t length = 0;
+    out[length++] = start[0];
+    if (precision > 0 || alt) out[length++] = '.';
+    memcpy(out + length, start + 1, precision);
+    length += precision;
+
+    out[length++] = upper ? 'E' : 'e';
+    out[length++] = (exponent < 0) ? '-' : '+';
+    unsigned magnitude = (exponent < 0) ? -exponent : exponent;
+    char  power[8];
+    char *first = decimal(power + sizeof(power), magnitude);
+    if (magnitude < 10) *--first = '0';
+    memcpy(out + length, first, power + sizeof(power) - first);
+    return length + (power + sizeof(power) - first);
+}
+
+// Drop trailing zeros after the point, and the point if nothing follows (%g).
+static size_t trimZeros(char *out, size_t length)
+{
+    char *point = memchr(out, '.', length);
+    if (point == NULL) return length;
+    char  *mark = memchr(point, 'e', out + length - point);
+    if (mark == NULL) mark = memchr(point, 'E', out + length - point);
+    size_t tail = (mark != NULL) ? (size_t)(out + length - mark) : 0;
+    char  *last = out + length - tail;
+    while (last[-1] == '0') last--;
+    if (last[-1] == '.') last--;
+    memmove(last, out + length - tail, tail);
+    return last - out + tail;
+}
+
+// Returns 0 if `value` is outside the range converted exactly.
+static int putDouble(struct Output *out, const struct Conversion *c,
+    double value, char conversion)
+{
+    int precision = (c->precision < 0) ? 6 : c->precision;
+    int upper     = (conversion >= 'A' && conversion <= 'Z');
+    if (precision > MAX_SCALE) return 0;
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    char sign = (bits >> 63) ? '-' : c->plus ? '+' : c->space ? ' ' : 0;
+
+    char    text[96];
+    size_t  length;
+    uint128 digits;
+    int     exponent;
+    switch (conversion | 0x20)
+    {
+        case 'f':
+            if (!scaled(value, precision, &digits)) return 0;
+            length = fixed(text, digits, precision, c->alt);
+            break;
+        case 'e':
+            if (!significant(value, precision + 1, &digits, &exponent))
+                return 0;
+            length = exponential(text, digits, precision, exponent, c->alt,
+                upper);
+            break;
+        default:  // 'g'
+            if (precision == 0) precision = 1;
+            if (!significant(value, precision, &digits, &exponent))
+                return 0;
+            // glibc keeps no digit after the point when rounding carried
+            // into this exponent; let it print that case itself.
+            if (c->alt && exponent == precision) return 0;
+            if (exponent >= -4 && exponent < precision)
+                length = fixed(text, digits, precision - 1 - exponent,
+                    c->alt);
+            else
+                length = exponential(text, digits, precision - 1, exponent,
+                    c->alt, upper);
+            if (!c->alt) length = trimZeros(text, length);
+            break;
+    }
+    putField(out, c, c->zero && !c->left, sign, "", 0, 0, text, length);
+    return 1;
+}
+
+
+// Format `format` into `out`, or return UNSUPPORTED.
+static int formatFast(struct Output *out, const char *format, va_list args)
+{
+    const char *cursor = format;
+    for (;;)
+    {
+        const char *literal = cursor;
+        const char *percent = strchr(cursor, '%');
+        cursor = (percent != NULL) ? percent : cursor + strlen(cursor);
+        if (cursor > literal) put(out, literal, cursor - literal);
+        if (*cursor == '\0') return 0;
+        const char *p = cursor + 1;
+        if (*p == '%')
+        {
+            put(out, "%", 1);
+            cursor = p + 1;
+            continue;
+        }
+
+        // Plain %d %i %u %s and %ld %li %lu, most of what messages hold,
+        // skip the parsing and field layout below.
+        int wide = (*p == 'l' && p[1] != 'l');
+        char plain = p[wide];
+        if (plain == 'd' || plain == 'i')
+        {
+            long long value = wide ? va_arg(args, long) : va_arg(args, int);
+            putDecimal(out, (value < 0) ? -(uint64_t)value : (uint64_t)value,
+                (value < 0) ? '-' : 0);
+            cursor = p + wide + 1;
+            continue;
+        }
+        if (plain == 'u')
+        {
+            putDecimal(out, wide ? va_arg(args, unsigned long) :
+                va_arg(args, unsigned int), 0);
+            cursor = p + wide + 1;
+            continue;
+        }
+        if (plain == 's' && !wide)
+        {
+            const char *value = va_arg(args, const char *);
+            if (value == NULL) value = "(null)";
+            put(out, value, strlen(value));
+            cursor = p + 1;
+            continue;
+        }
+
+        struct Conversion c = { 0, 0, 0, 0, 0, 0, -1 };
+        for (;; p++)
+        {
+            if      (*p == '-') c.left  = 1;
+            else if (*p == '+') c.plus  = 1;
+            else if (*p == ' ') c.space = 1;
+            else if (*p == '#') c.alt   = 1;
+            else if (*p == '0') c.zero  = 1;
+            else break;
+        }
+
+        if (*p == '*')
+        {
+            int width = va_arg(args, int);
+            if (width == INT_MIN) return UNSUPPORTED;
+            if (width < 0)
+            {
+                c.left = 1;
+                width  = -width;
+            }
+            c.width = width;
+            p++;
+            if (*p >= '0' && *p <= '9') return UNSUPPORTED;
+        }
+        for (; *p >= '0' && *p <= '9'; p++)
+        {
+            c.width = c.width * 10 + (*p - '0');
+            if (c.width > MAX_WIDTH) return UNSUPPORTED;
+        }
+        if (*p == '$' || c.width > MAX_WIDTH) return UNSUPPORTED;
+
+        if (*p == '.')
+        {
+            p++;
+            c.precision = 0;
+            if (*p == '*')
+            {
+                int precision = va_arg(args, int);
+                c.precision = (precision < 0) ? -1 : precision;
+                p++;
+                if (*p >= '0' && *p <= '9') return UNSUPPORTED;
+            }
+            for (; *p >= '0' && *p <= '9'; p++)
+            {
+                c.precision = c.precision * 10 + (*p - '0');
+                if (c.precision > MAX_WIDTH) return UNSUPPORTED;
+            }
+            if (c.precision > MAX_WIDTH) return UNSUPPORTED;
+        }
+
+        int length = LEN_NONE;
+        switch (*p)
+        {
+            case 'h':
+                length = (p[1] == 'h') ? LEN_HH : LEN_H;
+                p += (p[1] == 'h') ? 2 : 1;
+                break;
+            case 'l':
+                length = (p[1] == 'l') ? LEN_LL : LEN_L;
+                p += (p[1] == 'l') ? 2 : 1;
+                break;
+            case 'q': length = LEN_LL; p++; break;
+            case 'L': length = LEN_BIGL; p++; break;
+            case 'j': length = LEN_J; p++; break;
+            case 'z': case 'Z': length = LEN_Z; p++; break;
+            case 't': length = LEN_T; p++; break;
+        }
+
+        char conversion = *p++;
+        switch (conversion)
+        {
+            case 'd': case 'i':
+            {
+                long long value;
+                switch (length)
+                {
+                    case LEN_HH: value = (signed char)va_arg(args, int); break;
+                    case LEN_H:  value = (short)va_arg(args, int); break;
+                    case LEN_L:  value = va_arg(args, long); break;
+                    case LEN_LL: case LEN_BIGL:
+                        value = va_arg(args, long long);
+                        break;
+                    case LEN_J:  value = va_arg(args, intmax_t); break;
+                    case LEN_Z:  value = va_arg(args, ssize_t); break;
+                    case LEN_T:  value = va_arg(args, ptrdiff_t); break;
+                    default:     value = va_arg(args, int); break;
+                }
+                uint64_t magnitude = (value < 0) ? -(uint64_t)value :
+                    (uint64_t)value;
+                char sign = (value < 0) ? '-' : c.plus ? '+' : c.space ? ' ' :
+                    0;
+                putInteger(out, &c, magnitude, sign, 10, 0);
+                break;
+            }
+
+            case 'u': case 'o': case 'x': case 'X':
+            {
+                unsigned long long value;
+                switch (length)
+                {
+                    case LEN_HH:
+                        value = (unsigned char)va_arg(args, unsigned int);
+                        break;
+                    case LEN_H:
+                        value = (unsigned short)va_arg(args, unsigned int);
+                        break;
+                    case LEN_L:  value = va_arg(args, unsigned long); break;
+                    case LEN_LL: case LEN_BIGL:
+                        value = va_arg(args, unsigned long long);
+                        break;
+                    case LEN_J:  value = va_arg(args, uintmax_t); break;
+                    case LEN_Z:  value = va_arg(args, size_t); break;
+                    case LEN_T:  value = va_arg(args, ptrdiff_t); break;
+                    default:     value = va_arg(args, unsigned int); break;
+                }
+                int base = (conversion == 'u') ? 10 : (conversion == 'o') ?
+                    8 : 16;
+                putInteger(out, &c, value, 0, base, conversion == 'X');
+                break;
+            }
+
+            case 'c':
+            {
+                if (length != LEN_NONE) return UNSUPPORTED;
+                char value = (unsigned char)va_arg(args, int);
+                putField(out, &c, 0, 0, "", 0, 0, &value, 1);
+                break;
+            }
+
+            case 's':
+            {
+                if (length != LEN_NONE) return UNSUPPORTED;
+                const char *value = va_arg(args, const char *);
+                if (value == NULL)
+                    value = (c.precision < 0 || c.precision >= 6) ?
+                        "(null)" : "";
+                size_t count = (c.precision < 0) ? strlen(value) :
+                    strnlen(value, c.precision);
+                putField(out, &c, 0, 0, "", 0, 0, value, count);
+                break;
+            }
+
+            case 'p':  // as %#lx, "(nil)" for NULL
+            {
+                void *value = va_arg(args, void *);
+                if (value == NULL)
+                    putField(out, &c, 0, 0, "", 0, 0, "(nil)", 5);
+                else
+                {
+                    c.alt = 1;
+                    putInteger(out, &c, (uintptr_t)value, c.plus ? '+' :
+                        c.space ? ' ' : 0, 16, 0);
+                }
+                break;
+            }
+
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+            {
+                if (length == LEN_BIGL) return UNSUPPORTED;
+                double value = va_arg(args, double);
+                if (!__builtin_isfinite(value) || !putDouble(out, &c, value,
+                    conversion))
+                    return UNSUPPORTED;
+                break;
+            }
+
+            default:  // %a, %n, %m, wide characters, unknown and truncated
+                return UNSUPPORTED;
+        }
+        cursor = p;
+    }
+}
+
+
+// vsnprintf(), faster for the conversions messages use.
+int printfFormat(char *buffer, size_t size, const char *format, va_list args)
+{
+    if (!__atomic_load_n(&fastFormat, __ATOMIC_RELAXED))
+        return vsnprintf(buffer, size, format, args);
+
+    struct Output out = { buffer, size, 0 };
+    va_list copy;
+    va_copy(copy, args);
+    int result = formatFast(&out, format, copy);
+    va_end(copy);
+    if (result == UNSUPPORTED || out.length > INT_MAX)
+        return vsnprintf(buffer, size, format, args);
+
+    if (size > 0)
+        buffer[(out.length < size) ? out.length : size - 1] = '\0';
+    return (int)out.length;
+}
+
+// Don't call this function. The message formatter, for the benchmark.
+int __DisplayVformat(char *buffer, size_t size, const char *format,
+    va_list args)
+{
+    return printfFormat(buffer, size, format, args);
+}
+
+// Use the built-in formatter for messages, or always vsnprintf().
+int GetFastFormat() { return fastFormat; }
+int SetFastFormat(int f)
+{
+    if (f == DISABLE || f == ENABLE)
+        __atomic_store_n(&fastFormat, f, __ATOMIC_RELAXED);
+    else
+    {
+        fprintf(stderr, "ERROR: Invalid fast format value.\n");
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,334 @@
+/**
+ * @file
+ * @brief Internal declarations shared between the Display source files.
+ *
+ * Nothing in this header is part of the public interface. Symbols declared
+ * with `DISPLAY_INTERNAL` are hidden from the shared library's export table.
+ */
+
+#ifndef __ESPA_DISPLAY_PRIVATE__
+#define __ESPA_DISPLAY_PRIVATE__
+
+// The library itself has no call sites to register.
+#define DISPLAY_NO_SITE_REGISTRY
+#include "Display.h"
+
+#define DISPLAY_INTERNAL __attribute__((visibility("hidden")))
+
+
+
+// Shared state defined in Display.c.
+extern FILE *streams[3];
+extern char  file[32];
+
+
+// Write an already formatted buffer to `stream`. Handles the NOFPRINTF and
+// MATLAB build variants so every output path behaves the same way.
+DISPLAY_INTERNAL void dwrite(FILE *stream, const char *buffer, size_t length);
+
+// dwrite() while holding the lock of `stream` (unless this thread is inside
+// DisplayLock()).
+DISPLAY_INTERNAL void dlockedWrite(FILE *stream, const char *buffer,
+    size_t length);
+
+// Queue a finished record for the writer thread in asynchronous mode, or
+// write it immediately with dlockedWrite() (always inside DisplayLock()).
+DISPLAY_INTERNAL void dsubmit(FILE *stream, const char *buffer, size_t length);
+
+// True if the calling thread is inside DisplayLock().
+DISPLAY_INTERNAL int displayLocked();
+
+// Write a finished record of `level` where PrintType `type` goes (mapped,
+// rotating or buffered stream, or dsubmit()), or to `fd` for CUSTOM.
+DISPLAY_INTERNAL void displayWrite(int type, FILE *fd, int level,
+    const char *buffer, size_t length);
+
+
+// Severity levels (DisplayLevel.c).
+DISPLAY_INTERNAL int levelResolve(struct DisplaySite *site);
+DISPLAY_INTERNAL int levelSiteState(struct DisplaySite *site, int state);
+
+// Severity of a message sent through the legacy __Display() entry point.
+static inline int levelOfType(int type)
+{
+    return (type == ERROR) ? LEVEL_ERROR :
+           (type == WARNING) ? LEVEL_WARNING : LEVEL_STANDARD;
+}
+
+// Name of a level, e.g. "WARNING".
+static inline const char *levelName(int level)
+{
+    static const char *names[] = {
+        "TRACE", "DEBUG", "INFO", "STANDARD", "WARNING", "ERROR"
+    };
+    return (level >= LEVEL_TRACE && level <= LEVEL_ERROR) ?
+        names[level] : names[LEVEL_STANDARD];
+}
+
+// Tag printed after the trace header. LEVEL_STANDARD has none.
+static inline const char *levelTag(int level)
+{
+    switch (level)
+    {
+        case LEVEL_TRACE:   return "[TRACE] ";
+        case LEVEL_DEBUG:   return "[DEBUG] ";
+        case LEVEL_INFO:    return "[INFO] ";
+        case LEVEL_WARNING: return "[WARNING] ";
+        case LEVEL_ERROR:   return "[ERROR] ";
+        default:            return NULL;
+    }
+}
+
+
+// Record builder (DisplayRecord.c). One record holds one complete output line.
+#define RECORD_SIZE (2*BUFFLEN)  ///< Stack storage reserved for one record.
+#define DEFAULT_MESSAGE_LIMIT (1 << 20)  ///< Default SetMaxMessageLength().
+
+struct DisplayRecord {
+    char   *data;      // NUL-terminated contents
+    size_t  length;    // bytes used, excluding the NUL
+    size_t  capacity;  // bytes available, excluding the NUL
+};
+
+DISPLAY_INTERNAL void recordInit(struct DisplayRecord *record, char *storage,
+    size_t size);
+DISPLAY_INTERNAL void recordAppend(struct DisplayRecord *record,
+    const char *text, size_t length);
+DISPLAY_INTERNAL void recordAppendString(struct DisplayRecord *record,
+    const char *text);
+DISPLAY_INTERNAL void recordAppendf(struct DisplayRecord *record,
+    const char *format, ...) __attribute__((format(printf, 2, 3)));
+DISPLAY_INTERNAL void recordVappendf(struct DisplayRecord *record, size_t limit,
+    const char *format, va_list args);
+DISPLAY_INTERNAL size_t recordReserve(struct DisplayRecord *record,
+    size_t length);
+DISPLAY_INTERNAL void recordDone(struct DisplayRecord *record);
+DISPLAY_INTERNAL size_t recordLimit();
+
+
+// Additional outputs (DisplaySink.c). A finished text line, with the parts
+// needed to add or strip its color codes without formatting it again.
+struct SinkLine {
+    const char *data;
+    size_t      length;
+    const char *color;         // color requested by the caller
+    int         colored;       // `data` contains color codes
+    int         trace;         // `data` starts with a trace header
+    size_t      contentStart;  // end of the leading color code
+    size_t      contentEnd;    // start of the trailing RESET (or newline)
+    size_t      bodyStart;     // start of the message, after the header
+};
+
+DISPLAY_INTERNAL void sinksWrite(const struct SinkLine *line, int level);
+DISPLAY_INTERNAL void sinksCrashFlush();
+DISPLAY_INTERNAL unsigned long sinksDropped();
+
+
+// Structured output (DisplayStructured.c).
+DISPLAY_INTERNAL int structuredFormat();
+struct DisplayBytes;
+DISPLAY_INTERNAL size_t structuredRecord(struct DisplayRecord *record,
+    const char *function, int level, const char *format, va_list args,
+    const struct DisplayField *fields, int count,
+    const struct DisplayBytes *dump, unsigned long suppressed);
+DISPLAY_INTERNAL void fieldsAppend(struct DisplayRecord *record,
+    const struct DisplayField *fields, int count);
+
+
+// Telemetry (DisplayStats.c). Callers check statsOn() first, so disabled
+// statistics cost a single branch.
+DISPLAY_INTERNAL extern int statsEnabled;
+
+static inline int statsOn()
+{
+    return __builtin_expect(__atomic_load_n(&statsEnabled, __ATOMIC_RELAXED),
+        0);
+}
+
+DISPLAY_INTERNAL void statsMessage(int level, int type, size_t bytes);
+DISPLAY_INTERNAL void statsTruncated();
+DISPLAY_INTERNAL void statsSuppressed(unsigned long count);
+DISPLAY_INTERNAL void statsLockWait(long long ns);
+DISPLAY_INTERNAL void statsWrite(long long ns);
+DISPLAY_INTERNAL long long statsClock();
+DISPLAY_INTERNAL void statsDumpStop();
+
+
+// Call-site registry (DisplayControl.c).
+DISPLAY_INTERNAL void controlStop();
+
+
+// Header layout (DisplayPattern.c).
+DISPLAY_INTERNAL void patternAppend(struct DisplayRecord *record,
+    const struct DisplaySite *site, const char *function, int level);
+
+
+// Thread identity (DisplayThread.c).
+#define THREAD_TAG_SIZE 48  ///< Room for "[tid:name]" with a 31-char name.
+
+DISPLAY_INTERNAL const char *threadTag(size_t *length);
+DISPLAY_INTERNAL int threadIdentity(const char **name);
+
+
+// Timestamp engine (DisplayTime.c).
+#define TIMESTAMP_SIZE 32  ///< Buffer size for timestampFormat().
+
+DISPLAY_INTERNAL long long timestampNow();
+DISPLAY_INTERNAL size_t timestampFormat(char *out);
+DISPLAY_INTERNAL size_t timestampFormatAt(long long ns, char *out);
+DISPLAY_INTERNAL size_t timestampFormatSafe(char *out);
+DISPLAY_INTERNAL size_t timestampFormatSafeAt(long long ns, char *out);
+
+
+// vsnprintf() replacement for messages (DisplayPrintf.c).
+DISPLAY_INTERNAL int printfFormat(char *buffer, size_t size,
+    const char *format, va_list args);
+
+// printf format scanner (DisplayFormat.c). Also built into display-decode.
+enum FormatArg {
+    ARG_NONE,
+    ARG_INT,          // int, also used for '*' width and precision
+    ARG_WIDE,         // 64-bit integer read according to `length`
+    ARG_DOUBLE,
+    ARG_LDOUBLE,
+    ARG_STRING,
+    ARG_POINTER,
+    ARG_UNSUPPORTED   // cannot be captured raw (%n, %m, wide, positional...)
+};
+
+enum FormatLength {
+    LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_J, LEN_Z, LEN_T, LEN_BIGL
+};
+
+struct FormatSpec {
+    const char   *start;          // the '%'
+    const char   *lengthStart;    // length modifier, or conversion if none
+    const char   *end;            // one past the conversion character
+    char          conversion;
+    unsigned char length;         // FormatLength
+    unsigned char arg;            // FormatArg
+    unsigned char starWidth;      // width is taken from an int argument
+    unsigned char starPrecision;  // precision is taken from an int argument
+};
+
+DISPLAY_INTERNAL int formatNext(const char **cursor, struct FormatSpec *spec);
+
+
+// Binary output (DisplayBinary.c). Stream layout, all integers in host order:
+//
+//   header   "DSPLYBIN", u32 0x01020304, u8 version, u8 precision,
+//            u16 length, process file name
+//   site     u8 'S', u32 id, u32 line, u16 file length, u16 function length,
+//            u32 format length, file, function, format
+//   message  u8 'M', u32 site id, u8 level, i64 ns, u32 length, arguments
+//   text     u8 'T', u32 site id, u8 level, i64 ns, u16 function length,
+//            u32 length, function, preformatted message
+//
+// Message arguments follow the format in order, each '*' as an ARG_INT:
+// ARG_INT 4 bytes, ARG_WIDE 8, ARG_DOUBLE 8, ARG_LDOUBLE sizeof(long double),
+// ARG_POINTER 8, ARG_STRING u32 length (0xffffffff for NULL) plus bytes.
+#define BINARY_MAGIC     "DSPLYBIN"
+#define BINARY_ENDIAN    0x01020304u
+#define BINARY_VERSION   2
+#define BINARY_NULL      0xffffffffu
+#define TAG_SITE         'S'
+#define TAG_MESSAGE      'M'
+#define TAG_TEXT         'T'
+
+DISPLAY_INTERNAL extern FILE *binaryStream;
+DISPLAY_INTERNAL void binaryWrite(struct DisplaySite *site,
+    const char *function, int level, const char *format, va_list args);
+DISPLAY_INTERNAL size_t binaryTextStart(struct DisplayRecord *record,
+    struct DisplaySite *site, const char *function, int level,
+    const char *format);
+DISPLAY_INTERNAL void binaryTextSubmit(struct DisplayRecord *record,
+    size_t lengthAt, size_t start);
+DISPLAY_INTERNAL int binaryCapture(struct DisplayRecord *record,
+    struct DisplaySite *site, const char *format, va_list args);
+
+
+// Memory-mapped files (DisplayMapped.c).
+#define DEFAULT_MAPPED_CHUNK (4 << 20)
+
+DISPLAY_INTERNAL extern struct DisplayMappedFile *mappedStreams[3];
+DISPLAY_INTERNAL void mappedWrite(struct DisplayMappedFile *file,
+    const char *buffer, size_t length);
+
+
+// Rotating files (DisplayRotate.c).
+DISPLAY_INTERNAL extern struct DisplayRotatingFile *rotatingStreams[3];
+DISPLAY_INTERNAL void rotatingWrite(struct DisplayRotatingFile *file,
+    const char *buffer, size_t length);
+DISPLAY_INTERNAL int rotatingStreamWrite(int type, const char *buffer,
+    size_t length);
+DISPLAY_INTERNAL void rotatingCrashFlush(struct DisplayRotatingFile *file);
+
+
+// Hex dumps (DisplayHex.c).
+struct DisplayBytes {
+    const void *data;
+    size_t      length;
+};
+
+DISPLAY_INTERNAL void hexAppend(struct DisplayRecord *record, const void *data,
+    size_t length);
+DISPLAY_INTERNAL void hexCompact(char *out, const void *data, size_t length);
+
+
+// Coalescing of repeated messages (DisplayCoalesce.c). Callers check
+// coalesceOn() first.
+DISPLAY_INTERNAL extern unsigned int coalesceWindow;
+
+static inline int coalesceOn()
+{
+    return __builtin_expect(
+        __atomic_load_n(&coalesceWindow, __ATOMIC_RELAXED) != 0, 0);
+}
+
+DISPLAY_INTERNAL int coalesceRepeat(int type, const struct DisplaySite *site,
+    const char *function, int level, const char *color, const char *format,
+    const char *body, size_t length);
+DISPLAY_INTERNAL void coalesceFlush();
+DISPLAY_INTERNAL void coalesceStop();
+
+// Print "last message repeated `count` times" (Display.c).
+DISPLAY_INTERNAL void displayRepeats(int type, const char *function, int level,
+    const char *color, unsigned long count);
+
+
+// Flight recorder (DisplayHistory.c). Callers check historyOn() first.
+static inline int historyOn()
+{
+    return __builtin_expect(
+        __atomic_load_n(&__displayHistory, __ATOMIC_RELAXED), 0);
+}
+
+DISPLAY_INTERNAL void historyRemember(struct DisplaySite *site,
+    const char *format, va_list args);
+DISPLAY_INTERNAL size_t historyDump();
+DISPLAY_INTERNAL void historyCrashDump();
+
+
+// Stream buffering policies (DisplayBuffer.c).
+DISPLAY_INTERNAL void bufferWrite(int type, const char *record, size_t length,
+    int urgent);
+DISPLAY_INTERNAL void buffersFlush();
+DISPLAY_INTERNAL void buffersStop();
+DISPLAY_INTERNAL void buffersCrashFlush();
+
+
+// Asynchronous mode (DisplayAsync.c).
+DISPLAY_INTERNAL extern int asyncMode;
+DISPLAY_INTERNAL void asyncPush(FILE *stream, const char *buffer, size_t length);
+DISPLAY_INTERNAL void asyncStop();
+DISPLAY_INTERNAL void asyncFlush();
+DISPLAY_INTERNAL void asyncCrashDrain();
+
+
+// Crash handling (DisplayCrash.c). All are async-signal-safe.
+DISPLAY_INTERNAL void crashWrite(int fd, const char *buffer, size_t length);
+DISPLAY_INTERNAL void crashFlushStream(FILE *stream);
+DISPLAY_INTERNAL void crashReplay(int fd, long long ns, const char *function,
+    int level, const char *format, const char *data, size_t length);
+
+#endif  // end of include guard
@@ -0,0 +1,158 @@
+#include "DisplayPrivate.h"
+
+// Record builder. A record is one complete output line (trace, level tag,
+// body, color codes and newline) assembled in a single contiguous buffer so
+// that it can be written with one call. The buffer is supplied by the caller,
+// normally on its stack, and is always kept NUL-terminated.
+//
+// A line that outgrows its stack buffer moves to a per-thread arena. The arena
+// only grows, so after the first long message a thread formats long messages
+// without touching the heap. It is freed when the thread exits.
+
+// Variables
+static size_t          messageLimit = DEFAULT_MESSAGE_LIMIT;  // body length cap
+static pthread_key_t   arenaKey;
+static pthread_once_t  arenaOnce = PTHREAD_ONCE_INIT;
+static __thread char  *arena;        // this thread's spill buffer
+static __thread size_t arenaSize;
+static __thread int    arenaBusy;    // a record of this thread is using it
+
+
+
+// Set the longest message body printed, in bytes. Longer messages are cut.
+size_t GetMaxMessageLength() { return messageLimit; }
+int SetMaxMessageLength(size_t length)
+{
+    if (length == 0)
+    {
+        fprintf(stderr, "ERROR: Invalid maximum message length.\n");
+        exit(1);
+    }
+    __atomic_store_n(&messageLimit, length, __ATOMIC_RELAXED);
+    return 0;
+}
+
+size_t recordLimit()
+{
+    return __atomic_load_n(&messageLimit, __ATOMIC_RELAXED);
+}
+
+
+static void arenaFree(void *data)
+{
+    free(data);
+}
+
+static void arenaKeyCreate()
+{
+    pthread_key_create(&arenaKey, arenaFree);
+}
+
+// Make room for `length` more bytes, moving the record into the arena if
+// needed. Returns the room available, which may be less if the arena is
+// already in use further up the stack or cannot grow.
+size_t recordReserve(struct DisplayRecord *record, size_t length)
+{
+    size_t room = record->capacity - record->length;
+    if (length <= room) return room;
+    if (record->data != arena && arenaBusy) return room;
+
+    size_t needed = record->length + length + 1;
+    if (needed > arenaSize)
+    {
+        size_t size = (arenaSize > 0) ? arenaSize : RECORD_SIZE;
+        while (size < needed) size *= 2;
+
+        // The contents only need copying when leaving the stack.
+        char *grown = (record->data == arena) ? realloc(arena, size) :
+            malloc(size);
+        if (grown == NULL) return room;
+        if (record->data != arena) free(arena);
+
+        pthread_once(&arenaOnce, arenaKeyCreate);
+        pthread_setspecific(arenaKey, grown);
+        if (record->data == arena) record->data = grown;
+        arena     = grown;
+        arenaSize = size;
+    }
+
+    if (record->data != arena)
+    {
+        memcpy(arena, record->data, record->length + 1);
+        record->data = arena;
+        arenaBusy    = 1;
+    }
+    record->capacity = arenaSize - 1;
+    return record->capacity - record->length;
+}
+
+
+
+// Start an empty record in `storage`.
+void recordInit(struct DisplayRecord *record, char *storage, size_t size)
+{
+    record->data     = storage;
+    record->length   = 0;
+    record->capacity = size - 1;  // keep room for the terminating NUL
+    record->data[0]  = '\0';
+}
+
+// Finish with a record, handing the arena back if it was using it.
+void recordDone(struct DisplayRecord *record)
+{
+    if (record->data == arena) arenaBusy = 0;
+}
+
+// Append `length` bytes of `text`, truncating if the record cannot grow.
+void recordAppend(struct DisplayRecord *record, const char *text, size_t length)
+{
+    size_t room = recordReserve(record, length);
+    if (length > room) length = room;
+    memcpy(record->data + record->length, text, length);
+    record->length += length;
+    record->data[record->length] = '\0';
+}
+
+// Append a NUL-terminated string.
+void recordAppendString(struct DisplayRecord *record, const char *text)
+{
+    recordAppend(record, text, strlen(text));
+}
+
+// Append printf-style formatted text, writing at most `limit` characters.
+void recordVappendf(struct DisplayRecord *record, size_t limit,
+    const char *format, va_list args)
+{
+    size_t room = record->capacity - record->length;
+    if (limit == 0) return;
+
+    va_list retry;
+    va_copy(retry, args);
+    int written = printfFormat(record->data + record->length,
+        ((limit < room) ? limit : room) + 1, format, args);
+
+    // Did not fit: grow and format again.
+    if (written > 0 && (size_t)written > room && room < limit)
+    {
+        size_t wanted = ((size_t)written < limit) ? (size_t)written : limit;
+        room = recordReserve(record, wanted);
+        if (room > wanted) room = wanted;
+        written = printfFormat(record->data + record->length, room + 1, format,
+            retry);
+    }
+    va_end(retry);
+
+    if (room > limit) room = limit;
+    if (written > 0 && (size_t)written > room && statsOn()) statsTruncated();
+    if (written > 0)
+        record->length += ((size_t)written < room) ? (size_t)written : room;
+    record->data[record->length] = '\0';
+}
+
+void recordAppendf(struct DisplayRecord *record, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    recordVappendf(record, recordLimit(), format, args);
+    va_end(args);
+}
@@ -0,0 +1,317 @@
+#include "DisplayPrivate.h"
+
+#include <errno.h>
+#include <semaphore.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Rotating log files. Writers append to the current file through a pointer
+// they load once per record. When the file gets too large (or too old), the
+// writer that notices posts a semaphore and carries on; a background thread
+// renames the file, opens a new one at the same path and swaps the pointer.
+//
+// The old file can only be closed once no writer is still using it. Writers
+// announce themselves in one of two counters, picked by the parity of an
+// epoch number. After a swap the rotation thread bumps the epoch, so new
+// writers use the other counter, and waits for the old counter to drain.
+// CloseRotatingFile() does the same with the per-PrintType pointers, so a
+// file is only freed once no writer can still be using it.
+
+#define ROTATE_FLUSH_SEC 1        // flush the current file at least this often
+#define ROTATE_BUFFER    65536    // stdio buffer of each file
+
+struct DisplayRotatingFile {
+    char         *path;
+    size_t        maxBytes;    // rotate beyond this size, 0 to never
+    unsigned int  maxSeconds;  // rotate after this long, 0 to never
+    int           keep;        // rotated files kept: path.1 ... path.keep
+    int           compress;    // gzip rotated files
+    FILE         *current;
+    size_t        written;     // bytes in `current`
+    time_t        opened;      // when `current` was opened
+    unsigned int  epoch;
+    unsigned long active[2];   // writers per epoch parity
+    int           requested;   // RotateFile() was called
+    int           stop;
+    sem_t         wake;
+    pthread_t     thread;
+    char         *buffers[2];  // stdio buffers, swapped with the files
+};
+
+// Variables
+struct DisplayRotatingFile *rotatingStreams[3];  // per PrintType, NULL if unused
+static unsigned int         streamEpoch;         // as `epoch`, for those
+static unsigned long        streamActive[2];
+
+
+
+// Open `path` for appending with a large stdio buffer.
+static FILE *rotateOpen(struct DisplayRotatingFile *file, char *buffer)
+{
+    FILE *stream = fopen(file->path, "a");
+    if (stream == NULL) return NULL;
+    setvbuf(stream, buffer, _IOFBF, ROTATE_BUFFER);
+
+    struct stat info;
+    size_t size = (fstat(fileno(stream), &info) == 0) ? (size_t)info.st_size : 0;
+    __atomic_store_n(&file->written, size, __ATOMIC_RELAXED);
+    file->opened = time(NULL);
+    return stream;
+}
+
+// Name of rotated file number `index` (0 is the live file).
+static void rotateName(struct DisplayRotatingFile *file, int index,
+    int compressed, char *out, size_t size)
+{
+    if (index == 0)
+        snprintf(out, size, "%s", file->path);
+    else
+        snprintf(out, size, "%s.%d%s", file->path, index,
+            compressed ? ".gz" : "");
+}
+
+// gzip `name` in place. Failures leave the file uncompressed.
+static void rotateCompress(const char *name)
+{
+    extern char **environ;
+    char *argv[] = { "gzip", "-f", (char *)name, NULL };
+    pid_t pid;
+    if (posix_spawnp(&pid, "gzip", NULL, NULL, argv, environ) == 0)
+        while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {}
+}
+
+// Move the live file aside and start a new one. Runs on the rotation thread.
+static void rotate(struct DisplayRotatingFile *file)
+{
+    size_t size = strlen(file->path) + 32;
+    char   from[size], to[size];
+    int    gz = file->compress;
+
+    // path.keep is dropped, path.N becomes path.N+1 and path becomes path.1.
+    // With keep == 0 that drops the live file itself.
+    rotateName(file, file->keep, gz, to, size);
+    unlink(to);
+    for (int i = file->keep - 1; i >= 0; i--)
+    {
+        rotateName(file, i, gz && i > 0, from, size);
+        rotateName(file, i + 1, gz && i > 0, to, size);
+        rename(from, to);
+    }
+
+    // If the new file cannot be opened, keep writing to the old one.
+    FILE *old    = file->current;
+    char *buffer = file->buffers[1];
+    FILE *fresh  = rotateOpen(file, buffer);
+    if (fresh == NULL) return;
+
+    __atomic_store_n(&file->current, fresh, __ATOMIC_SEQ_CST);
+    file->buffers[1] = file->buffers[0];
+    file->buffers[0] = buffer;
+
+    // Wait for writers that may still hold the old file.
+    unsigned int epoch = __atomic_fetch_add(&file->epoch, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&file->active[epoch & 1], __ATOMIC_SEQ_CST) != 0)
+        sched_yield();
+
+    fclose(old);
+    if (gz && file->keep > 0)
+    {
+        rotateName(file, 1, 0, from, size);
+        rotateCompress(from);
+    }
+}
+
+static void *rotateMain(void *arg)
+{
+    struct DisplayRotatingFile *file = arg;
+
+    while (!__atomic_load_n(&file->stop, __ATOMIC_ACQUIRE))
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += ROTATE_FLUSH_SEC;
+        sem_timedwait(&file->wake, &deadline);
+
+        int due = __atomic_exchange_n(&file->requested, 0, __ATOMIC_ACQ_REL);
+        if (file->maxBytes > 0 &&
+            __atomic_load_n(&file->written, __ATOMIC_RELAXED) >= file->maxBytes)
+            due = 1;
+        if (file->maxSeconds > 0 &&
+            time(NULL) - file->opened >= (time_t)file->maxSeconds)
+            due = 1;
+        if (due && !__atomic_load_n(&file->stop, __ATOMIC_ACQUIRE))
+            rotate(file);
+        fflush(file->current);
+    }
+    return NULL;
+}
+
+
+
+// Append a finished record to the current file. Never waits for a rotation.
+void rotatingWrite(struct DisplayRotatingFile *file, const char *buffer,
+    size_t length)
+{
+    unsigned int epoch = __atomic_load_n(&file->epoch, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&file->active[epoch & 1], 1, __ATOMIC_SEQ_CST);
+
+    FILE *stream = __atomic_load_n(&file->current, __ATOMIC_SEQ_CST);
+    dwrite(stream, buffer, length);
+    size_t before = __atomic_fetch_add(&file->written, length, __ATOMIC_RELAXED);
+
+    __atomic_sub_fetch(&file->active[epoch & 1], 1, __ATOMIC_SEQ_CST);
+
+    // Only the writer that crosses the limit asks for a rotation.
+    if (file->maxBytes > 0 && before < file->maxBytes &&
+        before + length >= file->maxBytes)
+        sem_post(&file->wake);
+}
+
+
+
+// Append a finished record to the rotating file of PrintType `type`, if it
+// has one. Returns 0 if it has none.
+int rotatingStreamWrite(int type, const char *buffer, size_t length)
+{
+    unsigned int epoch = __atomic_load_n(&streamEpoch, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&streamActive[epoch & 1], 1, __ATOMIC_SEQ_CST);
+
+    struct DisplayRotatingFile *file =
+        __atomic_load_n(&rotatingStreams[type], __ATOMIC_SEQ_CST);
+    if (file != NULL) rotatingWrite(file, buffer, length);
+
+    __atomic_sub_fetch(&streamActive[epoch & 1], 1, __ATOMIC_SEQ_CST);
+    return file != NULL;
+}
+
+
+
+// Open (or continue) the log file at `path`, rotating it once it reaches
+// `maxBytes` or is `maxSeconds` old (0 disables either limit) and keeping
+// `keep` rotated files.
+struct DisplayRotatingFile *OpenRotatingFile(const char *path, size_t maxBytes,
+    unsigned int maxSeconds, int keep)
+{
+    if (keep < 0)
+    {
+        fprintf(stderr, "ERROR: Invalid rotated file count.\n");
+        exit(1);
+    }
+
+    struct DisplayRotatingFile *file = calloc(1, sizeof(*file));
+    if (file == NULL) return NULL;
+    file->path       = strdup(path);
+    file->maxBytes   = maxBytes;
+    file->maxSeconds = maxSeconds;
+    file->keep       = keep;
+    file->buffers[0] = malloc(ROTATE_BUFFER);
+    file->buffers[1] = malloc(ROTATE_BUFFER);
+
+    if (file->path == NULL || file->buffers[0] == NULL ||
+        file->buffers[1] == NULL ||
+        (file->current = rotateOpen(file, file->buffers[0])) == NULL)
+    {
+        free(file->buffers[0]);
+        free(file->buffers[1]);
+        free(file->path);
+        free(file);
+        return NULL;
+    }
+
+    sem_init(&file->wake, 0, 0);
+    if (pthread_create(&file->thread, NULL, rotateMain, file) != 0)
+    {
+        fclose(file->current);
+        sem_destroy(&file->wake);
+        free(file->buffers[0]);
+        free(file->buffers[1]);
+        free(file->path);
+        free(file);
+        return NULL;
+    }
+    return file;
+}
+
+
+// Stop rotating and close the file, once no message is still being written
+// to it. Make sure nothing logs to it any more (it is removed from
+// SetRotatingStream(), but not from sinks).
+int CloseRotatingFile(struct DisplayRotatingFile *file)
+{
+    if (file == NULL) return -1;
+
+    for (int i = STANDARD; i <= ERROR; i++)
+        if (rotatingStreams[i] == file)
+            SetRotatingStream(i, NULL);
+
+    // Wait for writers that may still hold the file.
+    unsigned int epoch = __atomic_fetch_add(&streamEpoch, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&streamActive[epoch & 1], __ATOMIC_SEQ_CST) != 0)
+        sched_yield();
+
+    __atomic_store_n(&file->stop, 1, __ATOMIC_RELEASE);
+    sem_post(&file->wake);
+    pthread_join(file->thread, NULL);
+
+    int result = fclose(file->current);
+    sem_destroy(&file->wake);
+    free(file->buffers[0]);
+    free(file->buffers[1]);
+    free(file->path);
+    free(file);
+    return result;
+}
+
+
+// Ask for a rotation now, e.g. on SIGHUP. The rotation itself happens on the
+// background thread.
+int RotateFile(struct DisplayRotatingFile *file)
+{
+    if (file == NULL) return -1;
+    __atomic_store_n(&file->requested, 1, __ATOMIC_RELEASE);
+    sem_post(&file->wake);
+    return 0;
+}
+
+
+// gzip rotated files (path.1.gz, ...). Disabled by default.
+int GetRotatingCompress(struct DisplayRotatingFile *file) { return file->compress; }
+int SetRotatingCompress(struct DisplayRotatingFile *file, int c)
+{
+    if (c != ENABLE && c != DISABLE)
+    {
+        fprintf(stderr, "ERROR: Invalid value, use ENABLE or DISABLE.\n");
+        exit(1);
+    }
+    __atomic_store_n(&file->compress, c, __ATOMIC_RELAXED);
+    return 0;
+}
+
+
+// Send one PrintType to a rotating file instead of its FILE* stream. NULL
+// reverts to the stream set with SetStream().
+struct DisplayRotatingFile *GetRotatingStream(int streamType)
+{
+    if (streamType >= STANDARD && streamType <= ERROR)
+        return __atomic_load_n(&rotatingStreams[streamType], __ATOMIC_ACQUIRE);
+    else
+        return NULL;
+}
+int SetRotatingStream(int streamType, struct DisplayRotatingFile *file)
+{
+    if (streamType < STANDARD || streamType > ERROR)
+    {
+        fprintf(stderr, "ERROR: Invalid stream type. See PrintType enum.");
+        exit(1);
+    }
+    __atomic_store_n(&rotatingStreams[streamType], file, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+
+// Write out the buffer of the current file, for the crash handler.
+void rotatingCrashFlush(struct DisplayRotatingFile *file)
+{
+    crashFlushStream(__atomic_load_n(&file->current, __ATOMIC_ACQUIRE));
+}
@@ -0,0 +1,387 @@
+#include "DisplayPrivate.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Additional outputs. The stream of each PrintType stays the primary output;
+// every message sent there is also handed, already formatted, to each sink
+// registered here. A sink only ever receives the finished record (with or
+// without its color codes), so fanning out never formats a message again.
+//
+// Sinks are written in turn on the caller's thread, after the console. Stream
+// sinks take only their own stream's lock, or are written by the writer
+// thread in asynchronous mode. Sockets are written without blocking, and
+// memory-mapped and rotating files need no lock at all. Only a callback, or
+// a stream sink in synchronous mode, can hold the caller up.
+//
+// Writers take a reference to each sink under sinkLock and write after
+// releasing it, so no lock of ours is held across a stream lock or a
+// callback. The registry holds one reference too; RemoveSink() waits for the
+// others to go, or, where waiting could deadlock, leaves the last writer to
+// release the sink.
+
+#define MAX_SINKS 16
+
+enum SinkKind {
+    SINK_STREAM, SINK_FILE, SINK_MAPPED, SINK_ROTATING, SINK_SOCKET,
+    SINK_CALLBACK
+};
+
+struct DisplaySink {
+    int                         kind;
+    int                         level;     // lowest severity passed on
+    int                         color;     // ENABLE to keep color codes
+    FILE                       *stream;    // SINK_STREAM, SINK_FILE (owned)
+    struct DisplayMappedFile   *mapped;    // SINK_MAPPED
+    struct DisplayRotatingFile *rotating;  // SINK_ROTATING
+    int                         socket;    // SINK_SOCKET (owned)
+    DisplaySinkCallback         callback;  // SINK_CALLBACK
+    void                       *context;
+    unsigned long               dropped;   // records a socket could not take
+    int                         users;     // references: registry, writers
+};
+
+// Variables
+static struct DisplaySink *sinks[MAX_SINKS];
+static int                 sinkCount;
+static pthread_rwlock_t    sinkLock = PTHREAD_RWLOCK_INITIALIZER;
+static unsigned long       removedDropped;  // drops of sinks since removed
+static __thread struct DisplaySink *sinkWriting;  // sink this thread writes
+
+
+
+static int validSinkLevel(int level)
+{
+    return level >= LEVEL_TRACE && level <= LEVEL_ERROR + 1;
+}
+
+// Register `sink`, or free it and return NULL if the table is full.
+static struct DisplaySink *sinkAdd(struct DisplaySink *sink, int level)
+{
+    if (!validSinkLevel(level))
+    {
+        fprintf(stderr, "ERROR: Invalid display level.\n");
+        exit(1);
+    }
+    sink->level = level;
+
+    pthread_rwlock_wrlock(&sinkLock);
+    if (sinkCount == MAX_SINKS)
+    {
+        pthread_rwlock_unlock(&sinkLock);
+        free(sink);
+        return NULL;
+    }
+    sinks[sinkCount] = sink;
+    __atomic_store_n(&sinkCount, sinkCount + 1, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&sinkLock);
+    return sink;
+}
+
+static struct DisplaySink *sinkNew(int kind, int color)
+{
+    struct DisplaySink *sink = calloc(1, sizeof(*sink));
+    if (sink == NULL) return NULL;
+    sink->kind   = kind;
+    sink->color  = color;
+    sink->socket = -1;
+    sink->users  = 1;
+    return sink;
+}
+
+
+// Send messages to another stream as well, e.g. stderr or an open log file.
+// Colors are kept if `stream` is a terminal. The caller keeps ownership.
+struct DisplaySink *AddStreamSink(FILE *stream, int level)
+{
+    if (stream == NULL) return NULL;
+    int tty = isatty(fileno(stream));
+    struct DisplaySink *sink = sinkNew(SINK_STREAM, tty ? ENABLE : DISABLE);
+    if (sink == NULL) return NULL;
+    sink->stream = stream;
+    return sinkAdd(sink, level);
+}
+
+// Append messages to the file at `path`, which is closed by RemoveSink().
+struct DisplaySink *AddFileSink(const char *path, int level)
+{
+    struct DisplaySink *sink = sinkNew(SINK_FILE, DISABLE);
+    if (sink == NULL) return NULL;
+    if ((sink->stream = fopen(path, "a")) == NULL)
+    {
+        free(sink);
+        return NULL;
+    }
+    return sinkAdd(sink, level);
+}
+
+// Copy messages into a file opened with OpenMappedFile().
+struct DisplaySink *AddMappedSink(struct DisplayMappedFile *file, int level)
+{
+    if (file == NULL) return NULL;
+    struct DisplaySink *sink = sinkNew(SINK_MAPPED, DISABLE);
+    if (sink == NULL) return NULL;
+    sink->mapped = file;
+    return sinkAdd(sink, level);
+}
+
+// Copy messages into a file opened with OpenRotatingFile().
+struct DisplaySink *AddRotatingSink(struct DisplayRotatingFile *file, int level)
+{
+    if (file == NULL) return NULL;
+    struct DisplaySink *sink = sinkNew(SINK_ROTATING, DISABLE);
+    if (sink == NULL) return NULL;
+    sink->rotating = file;
+    return sinkAdd(sink, level);
+}
+
+// Send each message as one datagram to the unix-domain socket at `path`. A
+// message the socket cannot take right away is dropped, not waited for.
+struct DisplaySink *AddSocketSink(const char *path, int level)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(address.sun_path)) return NULL;
+    strcpy(address.sun_path, path);
+
+    struct DisplaySink *sink = sinkNew(SINK_SOCKET, DISABLE);
+    if (sink == NULL) return NULL;
+    sink->socket = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sink->socket < 0 ||
+        connect(sink->socket, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        if (sink->socket >= 0) close(sink->socket);
+        free(sink);
+        return NULL;
+    }
+    return sinkAdd(sink, level);
+}
+
+// Pass every message to `callback`, on the thread that logged it.
+struct DisplaySink *AddCallbackSink(DisplaySinkCallback callback,
+    void *context, int level)
+{
+    if (callback == NULL) return NULL;
+    struct DisplaySink *sink = sinkNew(SINK_CALLBACK, DISABLE);
+    if (sink == NULL) return NULL;
+    sink->callback = callback;
+    sink->context  = context;
+    return sinkAdd(sink, level);
+}
+
+
+// Release what a sink owns, once nobody refers to it.
+static void sinkFree(struct DisplaySink *sink)
+{
+    __atomic_add_fetch(&removedDropped, GetSinkDropped(sink), __ATOMIC_RELAXED);
+
+    // Queued records may still point at the stream.
+    if (asyncMode && (sink->kind == SINK_STREAM || sink->kind == SINK_FILE))
+        DisplayFlush();
+    if (sink->kind == SINK_FILE)   fclose(sink->stream);
+    if (sink->kind == SINK_SOCKET) close(sink->socket);
+    free(sink);
+}
+
+static void sinkRelease(struct DisplaySink *sink)
+{
+    if (__atomic_sub_fetch(&sink->users, 1, __ATOMIC_ACQ_REL) == 0)
+        sinkFree(sink);
+}
+
+// Unregister a sink and release what it owns. Once this returns, no thread is
+// writing to it any more, unless it is called inside DisplayLock() or from the
+// sink's own callback: writers may then be waiting for this thread, and the
+// last of them releases the sink instead.
+int RemoveSink(struct DisplaySink *sink)
+{
+    pthread_rwlock_wrlock(&sinkLock);
+    int found = 0;
+    for (int i = 0; i < sinkCount; i++)
+    {
+        if (sinks[i] != sink) continue;
+        sinks[i] = sinks[sinkCount - 1];
+        __atomic_store_n(&sinkCount, sinkCount - 1, __ATOMIC_RELEASE);
+        found = 1;
+        break;
+    }
+    pthread_rwlock_unlock(&sinkLock);
+    if (!found) return -1;
+
+    if (displayLocked() || sinkWriting == sink)
+    {
+        sinkRelease(sink);
+        return 0;
+    }
+    while (__atomic_load_n(&sink->users, __ATOMIC_ACQUIRE) > 1)
+        sched_yield();
+    sinkFree(sink);
+    return 0;
+}
+
+
+// Per-sink settings.
+int GetSinkLevel(struct DisplaySink *sink) { return sink->level; }
+int SetSinkLevel(struct DisplaySink *sink, int level)
+{
+    if (!validSinkLevel(level))
+    {
+        fprintf(stderr, "ERROR: Invalid display level.\n");
+        exit(1);
+    }
+    __atomic_store_n(&sink->level, level, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int GetSinkColor(struct DisplaySink *sink) { return sink->color; }
+int SetSinkColor(struct DisplaySink *sink, int c)
+{
+    if (c != ENABLE && c != DISABLE)
+    {
+        fprintf(stderr, "ERROR: Invalid colorfulness value.\n");
+        exit(1);
+    }
+    __atomic_store_n(&sink->color, c, __ATOMIC_RELAXED);
+    return 0;
+}
+
+unsigned long GetSinkDropped(struct DisplaySink *sink)
+{
+    return __atomic_load_n(&sink->dropped, __ATOMIC_RELAXED);
+}
+
+// Messages dropped by all socket sinks, including removed ones.
+unsigned long sinksDropped()
+{
+    unsigned long total = __atomic_load_n(&removedDropped, __ATOMIC_RELAXED);
+    pthread_rwlock_rdlock(&sinkLock);
+    for (int i = 0; i < sinkCount; i++)
+        total += GetSinkDropped(sinks[i]);
+    pthread_rwlock_unlock(&sinkLock);
+    return total;
+}
+
+
+
+// Produce `line` with (`color` set) or without its color codes by copying
+// its parts into `storage`, or into the heap if it is too small. Returns the
+// record unchanged when it already has the requested form, or is structured
+// output (no `color`), which is never colored.
+static const char *lineVariant(const struct SinkLine *line, int color,
+    char *storage, size_t size, char **heap, size_t *length)
+{
+    if (color == line->colored || line->color == NULL)
+    {
+        *length = line->length;
+        return line->data;
+    }
+
+    const char *content = line->data + line->contentStart;
+    size_t contentLength = line->contentEnd - line->contentStart;
+    size_t tail = line->contentEnd + (line->colored ? strlen(RESET) : 0);
+    size_t tailLength = line->length - tail;
+
+    // Like buildRecord(), only put the color in front of a trace header.
+    const char *prefix = (color && line->trace) ? line->color : "";
+    const char *suffix = color ? RESET : "";
+    size_t prefixLength = strlen(prefix), suffixLength = strlen(suffix);
+
+    *length = prefixLength + contentLength + suffixLength + tailLength;
+    char *out = storage;
+    if (*length > size && (out = *heap = malloc(*length)) == NULL)
+        return NULL;
+    memcpy(out, prefix, prefixLength);
+    memcpy(out + prefixLength, content, contentLength);
+    memcpy(out + prefixLength + contentLength, suffix, suffixLength);
+    memcpy(out + prefixLength + contentLength + suffixLength,
+        line->data + tail, tailLength);
+    return out;
+}
+
+static void sinkWrite(struct DisplaySink *sink, const char *buffer,
+    size_t length, int level)
+{
+    switch (sink->kind)
+    {
+        case SINK_STREAM:
+        case SINK_FILE:
+            dsubmit(sink->stream, buffer, length);
+            break;
+        case SINK_MAPPED:
+            mappedWrite(sink->mapped, buffer, length);
+            break;
+        case SINK_ROTATING:
+            rotatingWrite(sink->rotating, buffer, length);
+            break;
+        case SINK_SOCKET:
+            if (send(sink->socket, buffer, length, MSG_DONTWAIT | MSG_NOSIGNAL)
+                    < 0)
+                __atomic_add_fetch(&sink->dropped, 1, __ATOMIC_RELAXED);
+            break;
+        case SINK_CALLBACK:
+            sink->callback(buffer, length, level, sink->context);
+            break;
+    }
+}
+
+// Hand a finished line to every sink that accepts its level.
+void sinksWrite(const struct SinkLine *line, int level)
+{
+    if (__atomic_load_n(&sinkCount, __ATOMIC_ACQUIRE) == 0) return;
+
+    char                storage[2][RECORD_SIZE];
+    char               *heap[2]    = { NULL, NULL };
+    const char         *variant[2] = { NULL, NULL };  // without, with color
+    size_t              length[2]  = { 0, 0 };
+    struct DisplaySink *taken[MAX_SINKS];
+    int                 count = 0;
+
+    pthread_rwlock_rdlock(&sinkLock);
+    for (int i = 0; i < sinkCount; i++)
+    {
+        if (level < __atomic_load_n(&sinks[i]->level, __ATOMIC_RELAXED))
+            continue;
+        __atomic_add_fetch(&sinks[i]->users, 1, __ATOMIC_RELAXED);
+        taken[count++] = sinks[i];
+    }
+    pthread_rwlock_unlock(&sinkLock);
+
+    // Restored afterwards: a callback may print, which writes the sinks again.
+    struct DisplaySink *outer = sinkWriting;
+    for (int i = 0; i < count; i++)
+    {
+        struct DisplaySink *sink = taken[i];
+        int color = __atomic_load_n(&sink->color, __ATOMIC_RELAXED) == ENABLE;
+        if (variant[color] == NULL)
+            variant[color] = lineVariant(line, color, storage[color],
+                sizeof(storage[color]), &heap[color], &length[color]);
+        if (variant[color] != NULL)
+        {
+            sinkWriting = sink;
+            sinkWrite(sink, variant[color], length[color], level);
+        }
+        sinkRelease(sink);
+    }
+    sinkWriting = outer;
+
+    free(heap[0]);
+    free(heap[1]);
+}
+
+
+// Write out the buffers of stream, file and rotating sinks, for the crash
+// handler. Takes no lock.
+void sinksCrashFlush()
+{
+    int count = __atomic_load_n(&sinkCount, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++)
+    {
+        struct DisplaySink *sink = sinks[i];
+        if (sink == NULL) continue;
+        if (sink->kind == SINK_STREAM || sink->kind == SINK_FILE)
+            crashFlushStream(sink->stream);
+        else if (sink->kind == SINK_ROTATING)
+            rotatingCrashFlush(sink->rotating);
+    }
+}
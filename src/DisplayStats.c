@@ -0,0 +1,264 @@
+#include "DisplayPrivate.h"
+
+#include <semaphore.h>
+#include <stddef.h>
+
+// Logging telemetry. Each thread counts into its own block of counters,
+// aligned to a cache line so that threads never write to a shared line; only
+// DisplayGetStats() reads them all. A thread's counts are folded into
+// `retired` when it exits.
+//
+// Everything is off until SetStats(ENABLE), so the cost when disabled is one
+// predictable branch in each place that counts.
+
+#define NSEC_PER_SEC 1000000000LL
+
+struct ThreadStats {
+    unsigned long long  messages[LEVEL_ERROR + 1];
+    unsigned long long  bytes[CUSTOM + 1];
+    unsigned long long  truncated;
+    unsigned long long  suppressed;
+    unsigned long long  lockWaitNs;
+    unsigned long long  writeNs;
+    struct ThreadStats *next;
+} __attribute__((aligned(64)));
+
+// Variables
+int                        statsEnabled = DISABLE;
+static struct ThreadStats *threadStats;   // every live thread's counters
+static struct ThreadStats  retired;       // counts of exited threads
+static pthread_mutex_t     statsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t       statsKey;
+static pthread_once_t      statsOnce = PTHREAD_ONCE_INIT;
+static __thread struct ThreadStats *localStats;
+
+static FILE     *dumpStream;    // periodic dump destination, NULL if none
+static unsigned  dumpSeconds;
+static pthread_t dumpThread;
+static sem_t     dumpWake;
+static int       dumpStop;
+
+static const char *typeNames[] = { "standard", "warning", "error", "custom" };
+static const char *levelNames[] = {
+    "trace", "debug", "info", "standard", "warning", "error"
+};
+
+
+
+// Add `from` to `to`, reading `from` with relaxed atomics.
+static void statsFold(struct ThreadStats *to, struct ThreadStats *from)
+{
+    unsigned long long *src = (unsigned long long *)from;
+    unsigned long long *dst = (unsigned long long *)to;
+    size_t count = offsetof(struct ThreadStats, next) / sizeof(*src);
+    for (size_t i = 0; i < count; i++)
+        dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+// Thread exit: keep its counts, drop its block. Runs on the exiting thread, so
+// a message from a later destructor starts a new block, which is set for this
+// key again and retired in turn.
+static void statsRetire(void *data)
+{
+    struct ThreadStats *stats = data;
+    localStats = NULL;
+    pthread_mutex_lock(&statsLock);
+    statsFold(&retired, stats);
+    struct ThreadStats **link = &threadStats;
+    while (*link != stats) link = &(*link)->next;
+    *link = stats->next;
+    pthread_mutex_unlock(&statsLock);
+    free(stats);
+}
+
+static void statsKeyCreate() { pthread_key_create(&statsKey, statsRetire); }
+
+// The calling thread's counters, created on first use. NULL if out of memory.
+static struct ThreadStats *statsLocal()
+{
+    if (localStats != NULL) return localStats;
+
+    struct ThreadStats *stats = aligned_alloc(64, sizeof(*stats));
+    if (stats == NULL) return NULL;
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_once(&statsOnce, statsKeyCreate);
+    pthread_setspecific(statsKey, stats);
+    pthread_mutex_lock(&statsLock);
+    stats->next = threadStats;
+    threadStats = stats;
+    pthread_mutex_unlock(&statsLock);
+    return localStats = stats;
+}
+
+// Only the owning thread writes its counters, so a plain add is enough; the
+// relaxed store keeps concurrent readers well defined.
+static inline void statsAdd(unsigned long long *counter,
+    unsigned long long value)
+{
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+
+
+// Count a message of `level` that produced `bytes` bytes on `type`'s stream.
+void statsMessage(int level, int type, size_t bytes)
+{
+    struct ThreadStats *stats = statsLocal();
+    if (stats == NULL) return;
+    if (level >= LEVEL_TRACE && level <= LEVEL_ERROR)
+        statsAdd(&stats->messages[level], 1);
+    if (type >= STANDARD && type <= CUSTOM)
+        statsAdd(&stats->bytes[type], bytes);
+}
+
+void statsTruncated()
+{
+    struct ThreadStats *stats = statsLocal();
+    if (stats != NULL) statsAdd(&stats->truncated, 1);
+}
+
+void statsSuppressed(unsigned long count)
+{
+    struct ThreadStats *stats = statsLocal();
+    if (stats != NULL) statsAdd(&stats->suppressed, count);
+}
+
+void statsLockWait(long long ns)
+{
+    struct ThreadStats *stats = statsLocal();
+    if (stats != NULL) statsAdd(&stats->lockWaitNs, (unsigned long long)ns);
+}
+
+void statsWrite(long long ns)
+{
+    struct ThreadStats *stats = statsLocal();
+    if (stats != NULL) statsAdd(&stats->writeNs, (unsigned long long)ns);
+}
+
+// Monotonic nanoseconds, for measuring waits and writes.
+long long statsClock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+
+// Collect telemetry. Disabled by default.
+int GetStats() { return statsEnabled; }
+int SetStats(int s)
+{
+    if (s != ENABLE && s != DISABLE)
+    {
+        fprintf(stderr, "ERROR: Invalid stats value.\n");
+        exit(1);
+    }
+    __atomic_store_n(&statsEnabled, s, __ATOMIC_RELAXED);
+    return 0;
+}
+
+
+// Sum the counters of every thread, past and present.
+int DisplayGetStats(struct DisplayStats *out)
+{
+    struct ThreadStats total;
+    memset(&total, 0, sizeof(total));
+
+    pthread_mutex_lock(&statsLock);
+    statsFold(&total, &retired);
+    for (struct ThreadStats *stats = threadStats; stats != NULL;
+         stats = stats->next)
+        statsFold(&total, stats);
+    pthread_mutex_unlock(&statsLock);
+
+    memset(out, 0, sizeof(*out));
+    for (int i = LEVEL_TRACE; i <= LEVEL_ERROR; i++)
+        out->messages[i] = total.messages[i];
+    for (int i = STANDARD; i <= CUSTOM; i++)
+        out->bytes[i] = total.bytes[i];
+    out->truncated  = total.truncated;
+    out->suppressed = total.suppressed;
+    out->dropped    = GetAsyncDropped() + sinksDropped();
+    out->lockWaitNs = total.lockWaitNs;
+    out->writeNs    = total.writeNs;
+    return 0;
+}
+
+
+// Write the current statistics to `stream` as one logfmt line.
+int DisplayPrintStats(FILE *stream)
+{
+    struct DisplayStats  stats;
+    char                 storage[RECORD_SIZE];
+    struct DisplayRecord record;
+    char                 timestamp[TIMESTAMP_SIZE];
+
+    DisplayGetStats(&stats);
+    timestampFormat(timestamp);
+    recordInit(&record, storage, sizeof(storage));
+    recordAppendf(&record, "[%s][%s] stats:", timestamp, file);
+    for (int i = LEVEL_TRACE; i <= LEVEL_ERROR; i++)
+        recordAppendf(&record, " messages_%s=%llu", levelNames[i],
+            stats.messages[i]);
+    for (int i = STANDARD; i <= CUSTOM; i++)
+        recordAppendf(&record, " bytes_%s=%llu", typeNames[i], stats.bytes[i]);
+    recordAppendf(&record, " truncated=%llu suppressed=%llu dropped=%llu "
+        "lock_wait_us=%llu write_us=%llu\n", stats.truncated,
+        stats.suppressed, stats.dropped, stats.lockWaitNs / 1000,
+        stats.writeNs / 1000);
+
+    dlockedWrite(stream, record.data, record.length);
+    fflush(stream);
+    recordDone(&record);
+    return 0;
+}
+
+
+
+static void *dumpMain(void *unused)
+{
+    (void)unused;
+    while (!__atomic_load_n(&dumpStop, __ATOMIC_ACQUIRE))
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += dumpSeconds;
+        if (sem_timedwait(&dumpWake, &deadline) != 0 &&
+            !__atomic_load_n(&dumpStop, __ATOMIC_ACQUIRE))
+            DisplayPrintStats(dumpStream);
+    }
+    return NULL;
+}
+
+// Print the statistics to `stream` every `seconds` seconds, from a background
+// thread. A NULL stream or 0 seconds stops it.
+int SetStatsDump(FILE *stream, unsigned int seconds)
+{
+    statsDumpStop();
+    if (stream == NULL || seconds == 0) return 0;
+
+    dumpStream  = stream;
+    dumpSeconds = seconds;
+    __atomic_store_n(&dumpStop, 0, __ATOMIC_RELEASE);
+    sem_init(&dumpWake, 0, 0);
+    if (pthread_create(&dumpThread, NULL, dumpMain, NULL) != 0)
+    {
+        sem_destroy(&dumpWake);
+        dumpStream = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Stop the periodic dump, if running.
+void statsDumpStop()
+{
+    if (dumpStream == NULL) return;
+    __atomic_store_n(&dumpStop, 1, __ATOMIC_RELEASE);
+    sem_post(&dumpWake);
+    pthread_join(dumpThread, NULL);
+    sem_destroy(&dumpWake);
+    dumpStream = NULL;
+}
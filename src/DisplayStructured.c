@@ -0,0 +1,267 @@
+#include "DisplayPrivate.h"
+
+#include <math.h>
+
+// Structured output. In JSON or logfmt mode every record is one line of named
+// fields (time, level, file, function, thread, message and any DisplayKV()
+// fields) instead of the bracketed trace header, so log collectors need no
+// pattern matching.
+//
+// Strings are escaped with a lookup table, straight into the record. The
+// message is formatted into the record first and then escaped in place,
+// working backwards from its end, so no temporary buffer is needed.
+
+// Variables
+static int outputFormat = TEXT;
+
+// What follows the backslash for each byte that must be escaped, 'u' for a
+// \u00XX sequence, or 0 if the byte is written as it is.
+static const char escapeTable[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    ['"'] = '"', ['\\'] = '\\'
+};
+
+// Extra bytes needed to escape each byte.
+#define ESCAPE_EXTRA(c) \
+    (escapeTable[(unsigned char)(c)] == 0 ? 0 : \
+     escapeTable[(unsigned char)(c)] == 'u' ? 5 : 1)
+
+static const char hexDigits[] = "0123456789abcdef";
+
+static const char *levelNames[] = {
+    "trace", "debug", "info", "standard", "warning", "error"
+};
+
+
+
+// Choose how records are written: TEXT (default), JSON or LOGFMT.
+int GetOutputFormat() { return outputFormat; }
+int SetOutputFormat(int f)
+{
+    if (f != TEXT && f != JSON && f != LOGFMT)
+    {
+        fprintf(stderr, "ERROR: Invalid output format value.\n");
+        exit(1);
+    }
+    __atomic_store_n(&outputFormat, f, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int structuredFormat()
+{
+    return __atomic_load_n(&outputFormat, __ATOMIC_RELAXED);
+}
+
+
+
+// Escape record->data[start, record->length) in place.
+static void escapeTail(struct DisplayRecord *record, size_t start)
+{
+    size_t extra = 0;
+    for (size_t i = start; i < record->length; i++)
+        extra += ESCAPE_EXTRA(record->data[i]);
+    if (extra == 0) return;
+
+    // Out of room: drop the end of the text until its escaped form fits.
+    size_t room = recordReserve(record, extra);
+    while (extra > room && record->length > start)
+        extra -= ESCAPE_EXTRA(record->data[--record->length]);
+
+    char *src = record->data + record->length;
+    char *dst = src + extra;
+    record->length += extra;
+    record->data[record->length] = '\0';
+    while (dst != src)
+    {
+        unsigned char c    = (unsigned char)*--src;
+        char          code = escapeTable[c];
+        if (code == 0)
+            *--dst = (char)c;
+        else if (code == 'u')
+        {
+            *--dst = hexDigits[c & 0xf];
+            *--dst = hexDigits[c >> 4];
+            *--dst = '0';
+            *--dst = '0';
+            *--dst = 'u';
+            *--dst = '\\';
+        }
+        else
+        {
+            *--dst = code;
+            *--dst = '\\';
+        }
+    }
+}
+
+// Append `text` escaped.
+static void escapeAppend(struct DisplayRecord *record, const char *text)
+{
+    size_t start = record->length;
+    recordAppendString(record, text);
+    escapeTail(record, start);
+}
+
+// True if a logfmt value must be quoted.
+static int logfmtNeedsQuotes(const char *text)
+{
+    if (*text == '\0') return 1;
+    for (; *text != '\0'; text++)
+        if (*text == ' ' || *text == '=' || escapeTable[(unsigned char)*text])
+            return 1;
+    return 0;
+}
+
+static void appendString(struct DisplayRecord *record, int format,
+    const char *text)
+{
+    if (format == LOGFMT && !logfmtNeedsQuotes(text))
+    {
+        recordAppendString(record, text);
+        return;
+    }
+    recordAppend(record, "\"", 1);
+    escapeAppend(record, text);
+    recordAppend(record, "\"", 1);
+}
+
+// Shortest of %.15g and %.17g that reads back as the same double.
+static void appendDouble(struct DisplayRecord *record, int format, double value)
+{
+    if (!isfinite(value))
+    {
+        recordAppendString(record, (format == JSON) ? "null" :
+            isnan(value) ? "NaN" : (value > 0) ? "+Inf" : "-Inf");
+        return;
+    }
+    char text[32];
+    snprintf(text, sizeof(text), "%.15g", value);
+    if (strtod(text, NULL) != value)
+        snprintf(text, sizeof(text), "%.17g", value);
+    recordAppendString(record, text);
+}
+
+// Append `key` and its separator: `,"key":` or ` key=`.
+static void appendKey(struct DisplayRecord *record, int format,
+    const char *key, int first)
+{
+    if (format == JSON)
+    {
+        recordAppendString(record, first ? "\"" : ",\"");
+        escapeAppend(record, key);
+        recordAppend(record, "\":", 2);
+    }
+    else
+    {
+        if (!first) recordAppend(record, " ", 1);
+        recordAppendString(record, key);
+        recordAppend(record, "=", 1);
+    }
+}
+
+static void appendField(struct DisplayRecord *record, int format,
+    const struct DisplayField *field)
+{
+    appendKey(record, format, field->key, 0);
+    switch (field->type)
+    {
+        case FIELD_INT:
+            recordAppendf(record, "%lld", field->i);
+            break;
+        case FIELD_FLOAT:
+            appendDouble(record, format, field->d);
+            break;
+        case FIELD_BOOL:
+            recordAppendString(record, field->i ? "true" : "false");
+            break;
+        default:
+            if (field->s == NULL)
+                recordAppendString(record, "null");
+            else
+                appendString(record, format, field->s);
+            break;
+    }
+}
+
+
+// A dump, as a "bytes" field of plain hex digits written in place.
+static void appendBytes(struct DisplayRecord *record, int format,
+    const struct DisplayBytes *dump)
+{
+    int quoted = (format == JSON || dump->length == 0);
+    appendKey(record, format, "bytes", 0);
+    if (quoted) recordAppend(record, "\"", 1);
+    size_t room  = recordReserve(record, 2 * dump->length);
+    size_t bytes = (room / 2 < dump->length) ? room / 2 : dump->length;
+    hexCompact(record->data + record->length, dump->data, bytes);
+    record->length += 2 * bytes;
+    record->data[record->length] = '\0';
+    if (quoted) recordAppend(record, "\"", 1);
+}
+
+
+
+// Append DisplayKV() fields to a text record, logfmt style: " key=value".
+void fieldsAppend(struct DisplayRecord *record,
+    const struct DisplayField *fields, int count)
+{
+    for (int i = 0; i < count; i++)
+        appendField(record, LOGFMT, &fields[i]);
+}
+
+
+// Format a complete message as one JSON object or logfmt line, with `dump`
+// (if not NULL) as a last field. Returns where the message starts, after the
+// time, level and origin fields.
+size_t structuredRecord(struct DisplayRecord *record, const char *function,
+    int level, const char *format, va_list args,
+    const struct DisplayField *fields, int count,
+    const struct DisplayBytes *dump, unsigned long suppressed)
+{
+    int  style = structuredFormat();
+    char timestamp[TIMESTAMP_SIZE];
+    timestampFormat(timestamp);
+
+    const char *name;
+    int         thread = threadIdentity(&name);
+
+    if (style == JSON) recordAppend(record, "{", 1);
+    appendKey(record, style, "time", 1);
+    appendString(record, style, timestamp);
+    appendKey(record, style, "level", 0);
+    appendString(record, style, (level >= LEVEL_TRACE && level <= LEVEL_ERROR) ?
+        levelNames[level] : "standard");
+    appendKey(record, style, "file", 0);
+    appendString(record, style, file);
+    appendKey(record, style, "function", 0);
+    appendString(record, style, function);
+    appendKey(record, style, "thread", 0);
+    recordAppendf(record, "%d", thread);
+    if (name[0] != '\0')
+    {
+        appendKey(record, style, "thread_name", 0);
+        appendString(record, style, name);
+    }
+
+    // The message is always quoted, even in logfmt.
+    size_t message = record->length;
+    appendKey(record, style, "message", 0);
+    recordAppend(record, "\"", 1);
+    size_t start = record->length;
+    recordVappendf(record, recordLimit(), format, args);
+    escapeTail(record, start);
+    recordAppend(record, "\"", 1);
+
+    if (suppressed > 0)
+    {
+        appendKey(record, style, "suppressed", 0);
+        recordAppendf(record, "%lu", suppressed);
+    }
+    for (int i = 0; i < count; i++)
+        appendField(record, style, &fields[i]);
+    if (dump != NULL) appendBytes(record, style, dump);
+
+    recordAppendString(record, (style == JSON) ? "}\n" : "\n");
+    return message;
+}
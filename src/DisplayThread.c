@@ -0,0 +1,92 @@
+#include "DisplayPrivate.h"
+
+#include <sys/syscall.h>
+
+// Thread identity for the trace header. Each thread renders its "[tid:name]"
+// fragment once and keeps it in thread-local storage; it is only rendered
+// again when the thread is renamed or the selected fields change, so printing
+// it costs a copy rather than a gettid() call and a format per message.
+
+#define THREAD_NAME_SIZE 32
+
+// Variables
+static int             threadFields;           // THREAD_ID | THREAD_NAME
+static __thread pid_t  threadId;               // 0 until first used
+static __thread char   threadName[THREAD_NAME_SIZE];
+static __thread char   threadText[THREAD_TAG_SIZE];
+static __thread size_t threadLength;
+static __thread int    threadRendered = -1;    // fields `threadText` shows
+
+
+
+// Select the thread information shown in the trace header: 0 (default),
+// THREAD_ID, THREAD_NAME, or both.
+int GetShowThread() { return threadFields; }
+int SetShowThread(int fields)
+{
+    if (fields & ~(THREAD_ID | THREAD_NAME))
+    {
+        fprintf(stderr, "ERROR: Invalid show thread value.\n");
+        exit(1);
+    }
+    __atomic_store_n(&threadFields, fields, __ATOMIC_RELAXED);
+    return 0;
+}
+
+
+// Name the calling thread in the trace header. Names longer than 31
+// characters are cut; NULL or "" removes the name.
+int DisplaySetThreadName(const char *name)
+{
+    snprintf(threadName, sizeof(threadName), "%s", name != NULL ? name : "");
+    threadRendered = -1;
+    return 0;
+}
+
+const char *DisplayGetThreadName() { return threadName; }
+
+
+// Return the calling thread's kernel id, and its name (possibly "") in `name`.
+int threadIdentity(const char **name)
+{
+    if (threadId == 0)
+        threadId = (pid_t)syscall(SYS_gettid);
+    *name = threadName;
+    return (int)threadId;
+}
+
+
+// Return the calling thread's header fragment, e.g. "[4242:worker]", or ""
+// when thread information is disabled. The length is stored in `length`.
+const char *threadTag(size_t *length)
+{
+    int fields = __atomic_load_n(&threadFields, __ATOMIC_RELAXED);
+    if (fields != threadRendered)
+    {
+        const char *name;
+        threadIdentity(&name);
+
+        // A thread without a name shows its id instead.
+        int showId   = (fields & THREAD_ID) || threadName[0] == '\0';
+        int showName = (fields & THREAD_NAME) && threadName[0] != '\0';
+        int written;
+        if (fields == 0)
+            written = 0;
+        else if (showId && showName)
+            written = snprintf(threadText, sizeof(threadText), "[%d:%s]",
+                (int)threadId, threadName);
+        else if (showName)
+            written = snprintf(threadText, sizeof(threadText), "[%s]",
+                threadName);
+        else
+            written = snprintf(threadText, sizeof(threadText), "[%d]",
+                (int)threadId);
+
+        threadText[written] = '\0';
+        threadLength   = (size_t)written;
+        threadRendered = fields;
+    }
+
+    *length = threadLength;
+    return threadText;
+}
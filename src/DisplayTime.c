@@ -0,0 +1,200 @@
+#include "DisplayPrivate.h"
+
+#include <stdint.h>
+
+// Timestamp engine for the trace header. The calendar part ("%T") only
+// changes once a second, so each thread keeps the last formatted second and
+// only calls localtime_r() when it rolls over. Sub-second digits are patched
+// in from the selected clock on every call.
+//
+// All clocks report wall-clock time. MONOTONIC and TSC are anchored to
+// CLOCK_REALTIME when selected and then advance steadily, unaffected by later
+// adjustments of the system clock.
+
+#define NSEC_PER_SEC     1000000000LL
+#define TSC_CALIBRATE_NS 10000000LL  // 10ms calibration window
+
+// Variables
+static int       precision = SECONDS;   // sub-second digits to print
+static int       clockType = REALTIME;  // clock used for timestamps
+static long long monotonicOffset;       // realtime - monotonic, in ns
+static long      zoneOffset;            // local - UTC, in seconds, last seen
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+static uint64_t  tscBase;        // TSC reading at calibration
+static long long tscBaseNs;      // wall-clock ns at `tscBase`
+static uint64_t  tscMult;        // ns per tick, 32.32 fixed point
+#endif
+
+// Last formatted second, per thread.
+static __thread time_t cachedSecond = -1;
+static __thread char   cachedText[16];
+static __thread size_t cachedLength;
+
+static const long long precisionDivisor[] = {
+    NSEC_PER_SEC, 1000000LL, 1000LL, 1LL
+};
+static const int precisionDigits[] = { 0, 3, 6, 9 };
+
+
+
+static long long clockNs(clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+// Set number of sub-second digits printed after the seconds. Default SECONDS
+// (no fraction), matching the historical "%T" format.
+int GetTimestampPrecision() { return precision; }
+int SetTimestampPrecision(int p)
+{
+    if (p >= SECONDS && p <= NANOSECONDS)
+        __atomic_store_n(&precision, p, __ATOMIC_RELAXED);
+    else
+    {
+        fprintf(stderr, "ERROR: Invalid timestamp precision value.\n");
+        exit(1);
+    }
+    return 0;
+}
+
+
+// Select the clock used for timestamps. Selecting TSC calibrates the time
+// stamp counter against CLOCK_MONOTONIC, which takes about 10ms. Platforms
+// without a TSC use MONOTONIC instead.
+int GetTimestampClock() { return clockType; }
+int SetTimestampClock(int c)
+{
+    if (c != REALTIME && c != MONOTONIC && c != TSC)
+    {
+        fprintf(stderr, "ERROR: Invalid timestamp clock value.\n");
+        exit(1);
+    }
+
+    monotonicOffset = clockNs(CLOCK_REALTIME) - clockNs(CLOCK_MONOTONIC);
+
+    #ifdef HAVE_TSC
+    if (c == TSC)
+    {
+        struct timespec pause = { 0, TSC_CALIBRATE_NS };
+        long long mono0 = clockNs(CLOCK_MONOTONIC);
+        uint64_t  tsc0  = __rdtsc();
+        nanosleep(&pause, NULL);
+        long long mono1 = clockNs(CLOCK_MONOTONIC);
+        uint64_t  tsc1  = __rdtsc();
+
+        if (tsc1 > tsc0 && mono1 > mono0)
+        {
+            tscMult   = ((uint64_t)(mono1 - mono0) << 32) / (tsc1 - tsc0);
+            tscBase   = tsc1;
+            tscBaseNs = mono1 + monotonicOffset;
+        }
+        else
+            c = MONOTONIC;  // unusable counter
+    }
+    #else
+    if (c == TSC) c = MONOTONIC;
+    #endif
+
+    __atomic_store_n(&clockType, c, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+// Current wall-clock time in nanoseconds since the epoch.
+long long timestampNow()
+{
+    switch (__atomic_load_n(&clockType, __ATOMIC_ACQUIRE))
+    {
+        case MONOTONIC:
+            return clockNs(CLOCK_MONOTONIC) + monotonicOffset;
+        #ifdef HAVE_TSC
+        case TSC:
+        {
+            unsigned __int128 ticks = __rdtsc() - tscBase;
+            return tscBaseNs + (long long)((ticks * tscMult) >> 32);
+        }
+        #endif
+        default:
+            return clockNs(CLOCK_REALTIME);
+    }
+}
+
+
+// Write the current time ("HH:MM:SS", plus ".fff", ".ffffff" or ".fffffffff"
+// depending on precision) into `out`, which must hold TIMESTAMP_SIZE bytes.
+// Returns the length, excluding the terminating NUL.
+size_t timestampFormat(char *out)
+{
+    return timestampFormatAt(timestampNow(), out);
+}
+
+// timestampFormat() for a time `ns` returned by timestampNow().
+size_t timestampFormatAt(long long ns, char *out)
+{
+    time_t second = (time_t)(ns / NSEC_PER_SEC);
+
+    if (second != cachedSecond)
+    {
+        struct tm timeinfo;
+        localtime_r(&second, &timeinfo);
+        cachedLength = strftime(cachedText, sizeof(cachedText), "%T",
+            &timeinfo);
+        cachedSecond = second;
+        __atomic_store_n(&zoneOffset, timeinfo.tm_gmtoff, __ATOMIC_RELAXED);
+    }
+
+    memcpy(out, cachedText, cachedLength);
+    size_t length = cachedLength;
+
+    int p = __atomic_load_n(&precision, __ATOMIC_RELAXED);
+    if (p != SECONDS)
+    {
+        long long fraction = (ns % NSEC_PER_SEC) / precisionDivisor[p];
+        int       digits   = precisionDigits[p];
+        out[length] = '.';
+        for (int i = digits; i > 0; i--)
+        {
+            out[length + i] = '0' + (char)(fraction % 10);
+            fraction /= 10;
+        }
+        length += digits + 1;
+    }
+
+    out[length] = '\0';
+    return length;
+}
+
+
+// Async-signal-safe "HH:MM:SS" of the current time, for DisplayEmergency().
+// Uses the time zone offset seen by the last regular timestamp instead of
+// calling localtime_r(). `out` must hold TIMESTAMP_SIZE bytes.
+size_t timestampFormatSafe(char *out)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return timestampFormatSafeAt((long long)ts.tv_sec * NSEC_PER_SEC, out);
+}
+
+// timestampFormatSafe() for a time `ns` returned by timestampNow().
+size_t timestampFormatSafeAt(long long ns, char *out)
+{
+    long long local = ns / NSEC_PER_SEC +
+        __atomic_load_n(&zoneOffset, __ATOMIC_RELAXED);
+    int seconds = (int)(((local % 86400) + 86400) % 86400);
+    int fields[3] = { seconds / 3600, seconds / 60 % 60, seconds % 60 };
+
+    for (int i = 0; i < 3; i++)
+    {
+        out[3 * i]     = '0' + (char)(fields[i] / 10);
+        out[3 * i + 1] = '0' + (char)(fields[i] % 10);
+        out[3 * i + 2] = ':';
+    }
+    out[8] = '\0';
+    return 8;
+}
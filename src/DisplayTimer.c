@@ -0,0 +1,202 @@
+#include "DisplayPrivate.h"
+
+// Timing scopes. Each DisplayTimeScope() or DisplayTimerStart() expansion owns
+// a static DisplayTimer: a log-linear histogram of the durations measured
+// there. Recording is a handful of relaxed atomic additions, with no lock and
+// no output; the first measurement pushes the timer onto a lock-free list so
+// DisplayPrintTimers() can find it. Timers with the same name are merged when
+// printed.
+//
+// Buckets: durations below 8 ns have one bucket each; every power of two above
+// that is split into 8 equal buckets, so a percentile is within 1/16 of the
+// true value. Durations of 2^48 ns (about three days) or more share the last
+// bucket. Minimum and maximum are exact.
+
+#define SUB_BITS 3
+#define SUB_COUNT (1 << SUB_BITS)
+#define MAX_BITS 48
+
+// Variables
+static struct DisplayTimer *timers;  // every timer used so far
+
+
+
+// Bucket of a duration of `ns` nanoseconds.
+static int bucketOf(unsigned long long ns)
+{
+    if (ns < SUB_COUNT) return (int)ns;
+    if (ns >= 1ULL << MAX_BITS) ns = (1ULL << MAX_BITS) - 1;
+    int exponent = 63 - __builtin_clzll(ns);
+    return (exponent - SUB_BITS + 1) * SUB_COUNT +
+        (int)((ns >> (exponent - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+// Middle of bucket `index`, in nanoseconds.
+static unsigned long long bucketValue(int index)
+{
+    if (index < SUB_COUNT) return (unsigned long long)index;
+    int shift = index / SUB_COUNT - 1;
+    unsigned long long low =
+        (unsigned long long)(SUB_COUNT + index % SUB_COUNT) << shift;
+    return low + ((1ULL << shift) >> 1);
+}
+
+
+// Monotonic nanoseconds, for timing scopes.
+long long __DisplayTimerNow() { return statsClock(); }
+
+// Don't call this function. Use the DisplayTimeScope(name) macro instead!
+void __DisplayTimerRecord(struct DisplayTimer *timer, long long ns)
+{
+    unsigned long long value = (ns > 0) ? (unsigned long long)ns : 0;
+
+    // First measurement: make the timer visible to DisplayPrintTimers().
+    if (!__atomic_load_n(&timer->listed, __ATOMIC_ACQUIRE) &&
+        !__atomic_exchange_n(&timer->listed, 1, __ATOMIC_ACQ_REL))
+    {
+        struct DisplayTimer *head = __atomic_load_n(&timers, __ATOMIC_RELAXED);
+        do timer->next = head;
+        while (!__atomic_compare_exchange_n(&timers, &head, timer, 1,
+                   __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    __atomic_add_fetch(&timer->buckets[bucketOf(value)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&timer->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&timer->total, value, __ATOMIC_RELAXED);
+
+    // A zero minimum means "none yet".
+    unsigned long long seen = __atomic_load_n(&timer->min, __ATOMIC_RELAXED);
+    while ((seen == 0 || value + 1 < seen) &&
+           !__atomic_compare_exchange_n(&timer->min, &seen, value + 1, 1,
+               __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    seen = __atomic_load_n(&timer->max, __ATOMIC_RELAXED);
+    while (value > seen &&
+           !__atomic_compare_exchange_n(&timer->max, &seen, value, 1,
+               __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Don't call this function. Cleanup of the DisplayTimeScope(name) macro.
+void __DisplayTimerScopeEnd(struct DisplayTimerScope *scope)
+{
+    __DisplayTimerRecord(scope->timer, __DisplayTimerNow() - scope->start);
+}
+
+
+
+// Snapshot of one or more timers sharing a name.
+struct TimerSummary {
+    const char        *name;
+    unsigned long long buckets[DISPLAY_TIMER_BUCKETS];
+    unsigned long long count;
+    unsigned long long total;
+    unsigned long long min;
+    unsigned long long max;
+};
+
+static void summaryAdd(struct TimerSummary *summary, struct DisplayTimer *timer)
+{
+    for (int i = 0; i < DISPLAY_TIMER_BUCKETS; i++)
+        summary->buckets[i] +=
+            __atomic_load_n(&timer->buckets[i], __ATOMIC_RELAXED);
+    summary->count += __atomic_load_n(&timer->count, __ATOMIC_RELAXED);
+    summary->total += __atomic_load_n(&timer->total, __ATOMIC_RELAXED);
+
+    unsigned long long min = __atomic_load_n(&timer->min, __ATOMIC_RELAXED);
+    unsigned long long max = __atomic_load_n(&timer->max, __ATOMIC_RELAXED);
+    if (min != 0 && (summary->min == 0 || min < summary->min))
+        summary->min = min;
+    if (max > summary->max) summary->max = max;
+}
+
+// Duration below which `fraction` of the measurements fall, clamped to the
+// exact extremes.
+static unsigned long long summaryPercentile(const struct TimerSummary *summary,
+    double fraction)
+{
+    unsigned long long rank = (unsigned long long)(fraction *
+        (double)(summary->count - 1)) + 1;
+    unsigned long long seen = 0;
+    unsigned long long value = summary->max;
+    for (int i = 0; i < DISPLAY_TIMER_BUCKETS; i++)
+    {
+        seen += summary->buckets[i];
+        if (seen >= rank) { value = bucketValue(i); break; }
+    }
+    if (value < summary->min - 1) value = summary->min - 1;
+    if (value > summary->max)     value = summary->max;
+    return value;
+}
+
+// Print a duration with three significant digits and a unit.
+static void appendDuration(struct DisplayRecord *record, unsigned long long ns)
+{
+    if (ns < 1000)          recordAppendf(record, " %8lluns", ns);
+    else if (ns < 1000000)  recordAppendf(record, " %8.3gus", (double)ns / 1e3);
+    else if (ns < 1000000000ULL)
+                            recordAppendf(record, " %8.3gms", (double)ns / 1e6);
+    else                    recordAppendf(record, " %8.3gs ", (double)ns / 1e9);
+}
+
+
+// Print one row per timer name: count, min, p50, p99 and max.
+int DisplayPrintTimers(FILE *stream)
+{
+    struct DisplayTimer *head = __atomic_load_n(&timers, __ATOMIC_ACQUIRE);
+    if (head == NULL) return 0;
+
+    char                 storage[RECORD_SIZE];
+    struct DisplayRecord record;
+    char                 timestamp[TIMESTAMP_SIZE];
+    timestampFormat(timestamp);
+    recordInit(&record, storage, sizeof(storage));
+    recordAppendf(&record, "[%s][%s] timers:\n%-24s %10s %10s %10s %10s %10s\n",
+        timestamp, file, "name", "count", "min", "p50", "p99", "max");
+
+    // Timers are only ever added at the head, so each name is printed at its
+    // first occurrence, merged with every later timer of the same name.
+    struct TimerSummary *summary = malloc(sizeof(*summary));
+    if (summary == NULL) { recordDone(&record); return -1; }
+    for (struct DisplayTimer *timer = head; timer != NULL; timer = timer->next)
+    {
+        int printed = 0;
+        for (struct DisplayTimer *other = head; other != timer;
+             other = other->next)
+            if (strcmp(other->name, timer->name) == 0) printed = 1;
+        if (printed) continue;
+
+        memset(summary, 0, sizeof(*summary));
+        summary->name = timer->name;
+        for (struct DisplayTimer *same = timer; same != NULL; same = same->next)
+            if (strcmp(same->name, timer->name) == 0) summaryAdd(summary, same);
+        if (summary->count == 0) continue;
+
+        recordAppendf(&record, "%-24s %10llu", summary->name, summary->count);
+        appendDuration(&record, summary->min - 1);
+        appendDuration(&record, summaryPercentile(summary, 0.50));
+        appendDuration(&record, summaryPercentile(summary, 0.99));
+        appendDuration(&record, summary->max);
+        recordAppend(&record, "\n", 1);
+    }
+    free(summary);
+
+    dlockedWrite(stream, record.data, record.length);
+    fflush(stream);
+    recordDone(&record);
+    return 0;
+}
+
+// Clear every timer's measurements. Timers stay listed.
+int DisplayResetTimers()
+{
+    for (struct DisplayTimer *timer = __atomic_load_n(&timers, __ATOMIC_ACQUIRE);
+         timer != NULL; timer = timer->next)
+    {
+        for (int i = 0; i < DISPLAY_TIMER_BUCKETS; i++)
+            __atomic_store_n(&timer->buckets[i], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&timer->count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&timer->total, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&timer->min, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&timer->max, 0, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
@@ -0,0 +1,405 @@
+/*
+ * display-decode: turn a Display binary stream (see `SetBinaryStream()`) back
+ * into the usual text output.
+ *
+ *      $ display-decode trace.bin
+ *      $ display-decode < trace.bin
+ *
+ * The whole stream is read into memory first. Call-site definitions may appear
+ * after messages that use them when the stream was written in asynchronous
+ * mode, so definitions are collected in a first pass and messages are printed
+ * in a second one. A record cut short by a crash ends decoding quietly.
+ */
+
+#include "DisplayPrivate.h"
+
+#include <stdint.h>
+
+struct Site {
+    int         defined;
+    uint32_t    line;
+    char       *file;
+    char       *function;
+    char       *format;
+};
+
+struct Reader {
+    const unsigned char *data;
+    size_t               length;
+    size_t               offset;
+};
+
+static struct Site *sites;
+static uint32_t     siteCount;
+static int          precision;
+static char        *processFile;
+
+static const int precisionDigits[] = { 0, 3, 6, 9 };
+
+
+
+// Bounds-checked readers. Each returns 0 if the input is exhausted.
+static int readBytes(struct Reader *in, void *out, size_t count)
+{
+    if (in->length - in->offset < count) return 0;
+    if (out != NULL) memcpy(out, in->data + in->offset, count);
+    in->offset += count;
+    return 1;
+}
+
+static char *readString(struct Reader *in, size_t count)
+{
+    char *text = malloc(count + 1);
+    if (text == NULL || !readBytes(in, text, count))
+    {
+        free(text);
+        return NULL;
+    }
+    text[count] = '\0';
+    return text;
+}
+
+static unsigned char *readAll(FILE *input, size_t *length)
+{
+    size_t         capacity = 1 << 16;
+    unsigned char *data     = malloc(capacity);
+    *length = 0;
+    while (data != NULL)
+    {
+        *length += fread(data + *length, 1, capacity - *length, input);
+        if (*length < capacity) break;
+        unsigned char *grown = realloc(data, capacity *= 2);
+        if (grown == NULL) free(data);
+        data = grown;
+    }
+    return data;
+}
+
+
+
+static void printTimestamp(FILE *out, long long ns)
+{
+    time_t    second = (time_t)(ns / 1000000000LL);
+    struct tm timeinfo;
+    char      text[16];
+    localtime_r(&second, &timeinfo);
+    strftime(text, sizeof(text), "%T", &timeinfo);
+    fputs(text, out);
+
+    int digits = precisionDigits[precision];
+    if (digits > 0)
+    {
+        long long fraction = ns % 1000000000LL;
+        for (int i = digits; i < 9; i++) fraction /= 10;
+        fprintf(out, ".%0*lld", digits, fraction);
+    }
+}
+
+static void printHeader(FILE *out, long long ns, const char *function,
+    int level)
+{
+    fputc('[', out);
+    printTimestamp(out, ns);
+    fprintf(out, "][%s][%s]", processFile, function);
+
+    const char *tag = levelTag(level);
+    fputs(tag != NULL ? tag : " ", out);
+}
+
+// Print literal format text, collapsing "%%".
+static void printLiteral(FILE *out, const char *start, const char *end)
+{
+    for (const char *p = start; p < end; p++)
+    {
+        fputc(*p, out);
+        if (p[0] == '%' && p + 1 < end && p[1] == '%') p++;
+    }
+}
+
+// Re-run a single conversion with its recorded argument.
+#define PRINT_SPEC(out, text, stars, star, value) \
+    ((stars) == 0 ? fprintf(out, text, value) : \
+     (stars) == 1 ? fprintf(out, text, star[0], value) : \
+                    fprintf(out, text, star[0], star[1], value))
+
+static int printMessage(FILE *out, const char *format, struct Reader *args)
+{
+    const char        *cursor = format;
+    struct FormatSpec  spec;
+
+    for (;;)
+    {
+        const char *literal = cursor;
+        if (!formatNext(&cursor, &spec))
+        {
+            printLiteral(out, literal, literal + strlen(literal));
+            return 1;
+        }
+        printLiteral(out, literal, spec.start);
+
+        int32_t star[2];
+        int     stars = spec.starWidth + spec.starPrecision;
+        for (int i = 0; i < stars; i++)
+            if (!readBytes(args, &star[i], sizeof(star[i]))) return 0;
+
+        // 64-bit integers were widened to long long when recorded.
+        char text[64];
+        size_t head = spec.lengthStart - spec.start;
+        if (head > sizeof(text) - 4) return 0;
+        memcpy(text, spec.start, head);
+        if (spec.arg == ARG_WIDE)
+        {
+            text[head++] = 'l';
+            text[head++] = 'l';
+            text[head++] = spec.conversion;
+        }
+        else
+        {
+            size_t tail = spec.end - spec.lengthStart;
+            if (head + tail >= sizeof(text)) return 0;
+            memcpy(text + head, spec.lengthStart, tail);
+            head += tail;
+        }
+        text[head] = '\0';
+
+        switch (spec.arg)
+        {
+            case ARG_INT:
+            {
+                int32_t value;
+                if (!readBytes(args, &value, sizeof(value))) return 0;
+                PRINT_SPEC(out, text, stars, star, (int)value);
+                break;
+            }
+            case ARG_WIDE:
+            {
+                int64_t value;
+                if (!readBytes(args, &value, sizeof(value))) return 0;
+                PRINT_SPEC(out, text, stars, star, (long long)value);
+                break;
+            }
+            case ARG_DOUBLE:
+            {
+                double value;
+                if (!readBytes(args, &value, sizeof(value))) return 0;
+                PRINT_SPEC(out, text, stars, star, value);
+                break;
+            }
+            case ARG_LDOUBLE:
+            {
+                long double value;
+                if (!readBytes(args, &value, sizeof(value))) return 0;
+                PRINT_SPEC(out, text, stars, star, value);
+                break;
+            }
+            case ARG_POINTER:
+            {
+                uint64_t value;
+                if (!readBytes(args, &value, sizeof(value))) return 0;
+                PRINT_SPEC(out, text, stars, star, (void *)(uintptr_t)value);
+                break;
+            }
+            case ARG_STRING:
+            {
+                uint32_t length;
+                if (!readBytes(args, &length, sizeof(length))) return 0;
+                char *value = NULL;
+                if (length != BINARY_NULL &&
+                    (value = readString(args, length)) == NULL)
+                    return 0;
+                PRINT_SPEC(out, text, stars, star, value);
+                free(value);
+                break;
+            }
+            default:
+                return 0;
+        }
+    }
+}
+
+
+
+// First pass: collect call-site definitions.
+static int collectSites(struct Reader in)
+{
+    uint8_t tag;
+    while (readBytes(&in, &tag, sizeof(tag)))
+    {
+        uint32_t id, line, formatLength, length;
+        uint16_t fileLength, functionLength;
+
+        if (tag == TAG_SITE)
+        {
+            if (!readBytes(&in, &id, sizeof(id)) ||
+                !readBytes(&in, &line, sizeof(line)) ||
+                !readBytes(&in, &fileLength, sizeof(fileLength)) ||
+                !readBytes(&in, &functionLength, sizeof(functionLength)) ||
+                !readBytes(&in, &formatLength, sizeof(formatLength)))
+                return 1;
+
+            if (id >= siteCount)
+            {
+                uint32_t count = id + 64;
+                struct Site *grown = realloc(sites, count * sizeof(*sites));
+                if (grown == NULL) return 0;
+                memset(grown + siteCount, 0, (count - siteCount) * sizeof(*sites));
+                sites     = grown;
+                siteCount = count;
+            }
+            struct Site *site = &sites[id];
+            site->line     = line;
+            site->file     = readString(&in, fileLength);
+            site->function = readString(&in, functionLength);
+            site->format   = readString(&in, formatLength);
+            if (site->file == NULL || site->function == NULL ||
+                site->format == NULL)
+                return 1;
+            site->defined = 1;
+        }
+        else if (tag == TAG_MESSAGE)
+        {
+            if (!readBytes(&in, NULL, sizeof(uint32_t) + sizeof(uint8_t) +
+                    sizeof(int64_t)) ||
+                !readBytes(&in, &length, sizeof(length)) ||
+                !readBytes(&in, NULL, length))
+                return 1;
+        }
+        else if (tag == TAG_TEXT)
+        {
+            if (!readBytes(&in, NULL, sizeof(uint32_t) + sizeof(uint8_t) +
+                    sizeof(int64_t)) ||
+                !readBytes(&in, &functionLength, sizeof(functionLength)) ||
+                !readBytes(&in, &length, sizeof(length)) ||
+                !readBytes(&in, NULL, functionLength + (size_t)length))
+                return 1;
+        }
+        else
+        {
+            fprintf(stderr, "display-decode: corrupt record at offset %zu\n",
+                in.offset - 1);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Second pass: print messages.
+static int printMessages(FILE *out, struct Reader in)
+{
+    uint8_t tag;
+    while (readBytes(&in, &tag, sizeof(tag)))
+    {
+        uint32_t id, length, formatLength;
+        uint16_t fileLength, functionLength;
+        uint8_t  level;
+        int64_t  ns;
+
+        if (tag == TAG_SITE)
+        {
+            if (!readBytes(&in, NULL, 2 * sizeof(uint32_t)) ||
+                !readBytes(&in, &fileLength, sizeof(fileLength)) ||
+                !readBytes(&in, &functionLength, sizeof(functionLength)) ||
+                !readBytes(&in, &formatLength, sizeof(formatLength)) ||
+                !readBytes(&in, NULL, (size_t)fileLength + functionLength +
+                    formatLength))
+                return 1;
+            continue;
+        }
+
+        if (!readBytes(&in, &id, sizeof(id)) ||
+            !readBytes(&in, &level, sizeof(level)) ||
+            !readBytes(&in, &ns, sizeof(ns)))
+            return 1;
+
+        if (tag == TAG_TEXT)
+        {
+            if (!readBytes(&in, &functionLength, sizeof(functionLength)) ||
+                !readBytes(&in, &length, sizeof(length)))
+                return 1;
+            char *function = readString(&in, functionLength);
+            char *text     = readString(&in, length);
+            if (function == NULL || text == NULL)
+            {
+                free(function);
+                free(text);
+                return 1;
+            }
+            printHeader(out, ns, function, level);
+            fprintf(out, "%s\n", text);
+            free(function);
+            free(text);
+            continue;
+        }
+
+        if (!readBytes(&in, &length, sizeof(length)) ||
+            in.length - in.offset < length)
+            return 1;
+        struct Reader args = { in.data + in.offset, length, 0 };
+        in.offset += length;
+
+        if (id >= siteCount || !sites[id].defined)
+        {
+            printHeader(out, ns, "?", level);
+            fprintf(out, "<undefined call site %u>\n", id);
+            continue;
+        }
+        printHeader(out, ns, sites[id].function, level);
+        if (!printMessage(out, sites[id].format, &args))
+            fputs(" <malformed arguments>", out);
+        fputc('\n', out);
+    }
+    return 1;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    FILE *input = stdin;
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "-h") == 0))
+    {
+        fprintf(stderr, "usage: %s [binary-stream]\n", argv[0]);
+        return 2;
+    }
+    if (argc == 2 && (input = fopen(argv[1], "rb")) == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    struct Reader in = { NULL, 0, 0 };
+    unsigned char *data = readAll(input, &in.length);
+    in.data = data;
+    if (data == NULL)
+    {
+        fprintf(stderr, "display-decode: out of memory\n");
+        return 1;
+    }
+
+    char     magic[8];
+    uint32_t endian;
+    uint8_t  version, stampPrecision;
+    uint16_t fileLength;
+    if (!readBytes(&in, magic, sizeof(magic)) ||
+        memcmp(magic, BINARY_MAGIC, sizeof(magic)) != 0 ||
+        !readBytes(&in, &endian, sizeof(endian)) ||
+        !readBytes(&in, &version, sizeof(version)) ||
+        !readBytes(&in, &stampPrecision, sizeof(stampPrecision)) ||
+        !readBytes(&in, &fileLength, sizeof(fileLength)) ||
+        (processFile = readString(&in, fileLength)) == NULL)
+    {
+        fprintf(stderr, "display-decode: not a Display binary stream\n");
+        return 1;
+    }
+    if (endian != BINARY_ENDIAN || version != BINARY_VERSION)
+    {
+        fprintf(stderr, "display-decode: stream was written by an "
+            "incompatible host or version\n");
+        return 1;
+    }
+    precision = (stampPrecision <= NANOSECONDS) ? stampPrecision : SECONDS;
+
+    if (!collectSites(in) || !printMessages(stdout, in))
+        return 1;
+    return 0;
+}